@@ -1,15 +1,26 @@
 #include "flogger.h"
 
-#include <iomanip>
 #include <mutex>
 #include <map>
+#include <vector>
 #include <thread>
-#include <fstream>
-#include <deque>
 #include <cassert>
 #include <atomic>
 #include <chrono>
-#include <condition_variable>
+#include <ctime>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#if defined __linux__
+    #include <unistd.h>
+    #include <sys/syscall.h>
+    #include <linux/futex.h>
+    #include <fcntl.h>
+    #include <cerrno>
+    #include <pthread.h>
+#endif
 
 namespace
 {
@@ -19,7 +30,7 @@ namespace
     public:
         static LogRegistry& Instance();
         std::shared_ptr<flog::Flogger> Get   (std::string const& id);
-        std::shared_ptr<flog::Flogger> Create(std::string const& id, std::string const& filename);
+        std::shared_ptr<flog::Flogger> Create(std::string const& id, std::string const& filename, std::size_t capacity, flog::OverflowPolicy overflowPolicy);
         void Shutdown();
 
     private:
@@ -40,11 +51,11 @@ namespace
         return itr == floggers_.end() ? nullptr : itr->second;
     }
 
-    std::shared_ptr<flog::Flogger> LogRegistry::Create(std::string const& id, std::string const& filename)
+    std::shared_ptr<flog::Flogger> LogRegistry::Create(std::string const& id, std::string const& filename, std::size_t capacity, flog::OverflowPolicy overflowPolicy)
     {
         std::lock_guard<std::mutex> lock(mutex_);
         auto& tmp = floggers_[id];
-        if (!tmp) { tmp = std::make_shared<flog::Flogger>(filename); }
+        if (!tmp) { tmp = std::make_shared<flog::Flogger>(filename, capacity, overflowPolicy); }
         return tmp;
     }
 
@@ -63,6 +74,9 @@ namespace
         return instance;
     }
 
+    //  called when a thread that has logged exits, with its queue (see ThreadQueue)
+    void OrphanQueue(void* queue);
+
 #if defined WIN32
 
     #define WIN32_EXTRA_LEAN
@@ -82,87 +96,826 @@ namespace
     #pragma comment(lib, "winmm.lib")
     MMRESULT result = timeBeginPeriod(1);
 
+    //  WaitOnAddress() is the Windows (8 and later) equivalent of a futex
+    #pragma comment(lib, "synchronization.lib")
+
     struct OsSpecific
     {
         static unsigned long GetThreadId()
         {   
             return GetCurrentThreadId();
         }
+
+        static void LocalTime(std::time_t const& seconds, std::tm& tm)
+        {
+            localtime_s(&tm, &seconds);
+        }
+
+        static void Pause()
+        {
+            YieldProcessor();
+        }
+
+        // sleep until woken - unless 'address' no longer holds 'expected'
+        static void Wait(std::atomic<unsigned>& address, unsigned expected)
+        {
+            WaitOnAddress(&address, &expected, sizeof(expected), INFINITE);
+        }
+
+        static void Wake(std::atomic<unsigned>& address)
+        {
+            WakeByAddressSingle(&address);
+        }
+
+        typedef HANDLE File;
+        static File const INVALID_FILE;
+
+        static File OpenFile(std::string const& filename)
+        {
+            return CreateFileA(filename.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        }
+
+        static void WriteFile(File file, char const* data, std::size_t size)
+        {
+            while (size > 0)
+            {
+                DWORD written = 0;
+                if (!::WriteFile(file, data, static_cast<DWORD>(size), &written, nullptr)) { return; }
+                data += written;
+                size -= written;
+            }
+        }
+
+        static void CloseFile(File file)
+        {
+            CloseHandle(file);
+        }
+
+        //  a value per thread, handed to OrphanQueue() when the thread exits (fiber local storage
+        //  is the only kind with a callback)
+        typedef DWORD ThreadKey;
+
+        static ThreadKey CreateThreadKey()
+        {
+            return FlsAlloc(&OnThreadExit);
+        }
+
+        static void DeleteThreadKey(ThreadKey key)
+        {
+            FlsFree(key);
+        }
+
+        static void* GetThreadValue(ThreadKey key)
+        {
+            return FlsGetValue(key);
+        }
+
+        static void SetThreadValue(ThreadKey key, void* value)
+        {
+            FlsSetValue(key, value);
+        }
+
+    private:
+        static VOID WINAPI OnThreadExit(PVOID value)
+        {
+            if (value) { OrphanQueue(value); }
+        }
+    };
+
+    OsSpecific::File const OsSpecific::INVALID_FILE = INVALID_HANDLE_VALUE;
+
+#elif defined __linux__
+
+    struct OsSpecific
+    {
+        // gettid() is a system call, so each thread only asks once
+        static unsigned long GetThreadId()
+        {   
+            static __thread unsigned long thread_id = 0;
+            if (thread_id == 0) { thread_id = static_cast<unsigned long>(syscall(SYS_gettid)); }
+            return thread_id;
+        }
+
+        static void LocalTime(std::time_t const& seconds, std::tm& tm)
+        {
+            localtime_r(&seconds, &tm);
+        }
+
+        static void Pause()
+        {
+        #if defined __x86_64__ || defined __i386__
+            __builtin_ia32_pause();
+        #endif
+        }
+
+        // sleep until woken - unless 'address' no longer holds 'expected'
+        static void Wait(std::atomic<unsigned>& address, unsigned expected)
+        {
+            syscall(SYS_futex, &address, FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+        }
+
+        static void Wake(std::atomic<unsigned>& address)
+        {
+            syscall(SYS_futex, &address, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+        }
+
+        typedef int File;
+        static File const INVALID_FILE = -1;
+
+        static File OpenFile(std::string const& filename)
+        {
+            return open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        }
+
+        static void WriteFile(File file, char const* data, std::size_t size)
+        {
+            while (size > 0)
+            {
+                auto const written = write(file, data, size);
+                if (written < 0)
+                {
+                    if (errno == EINTR) { continue; }
+                    return;
+                }
+                data += written;
+                size -= static_cast<std::size_t>(written);
+            }
+        }
+
+        static void CloseFile(File file)
+        {
+            close(file);
+        }
+
+        //  a value per thread, handed to OrphanQueue() when the thread exits
+        typedef pthread_key_t ThreadKey;
+
+        static ThreadKey CreateThreadKey()
+        {
+            ThreadKey key;
+            pthread_key_create(&key, &OrphanQueue);
+            return key;
+        }
+
+        static void DeleteThreadKey(ThreadKey key)
+        {
+            pthread_key_delete(key);
+        }
+
+        static void* GetThreadValue(ThreadKey key)
+        {
+            return pthread_getspecific(key);
+        }
+
+        static void SetThreadValue(ThreadKey key, void* value)
+        {
+            pthread_setspecific(key, value);
+        }
     };
 
 #endif
+
+    //  before the worker goes to sleep, it checks for new messages this many times, then yields
+    //  this many times - a busy logger never has to be woken
+    unsigned const SPIN_COUNT  = 4000;
+    unsigned const YIELD_COUNT = 16;
+
+    //  keeps the queue positions that the producers and the worker update on separate cache lines
+    std::size_t const CACHE_LINE = 64;
+
+    //  the worker's output buffer starts this big (it grows to fit the largest batch)
+    std::size_t const BATCH_BUFFER_SIZE = 256 * 1024;
+
+    //  the digits of 'value', written backwards from 'end' (std::to_chars() isn't available on
+    //  VS2013).  returns where they start.
+    char* FormatUnsigned(unsigned long long value, char* end)
+    {
+        do
+        {
+            *--end = static_cast<char>('0' + value % 10);
+            value /= 10;
+        }
+        while (value != 0);
+        return end;
+    }
+
+    //  the same format as a std::ostream uses by default.  returns the length.
+    std::size_t FormatDouble(double value, char (&buffer)[32])
+    {
+    #if defined WIN32
+        auto const size = _snprintf_s(buffer, sizeof(buffer), _TRUNCATE, "%g", value);
+    #else
+        auto const size = snprintf(buffer, sizeof(buffer), "%g", value);
+    #endif
+        return size > 0 ? std::min<std::size_t>(size, sizeof(buffer) - 1) : 0;
+    }
+
+    //=============================================================================================
+    //  each thread that logs has its own bounded ring of preallocated slots (Dmitry Vyukov's
+    //  bounded queue, with a single producer).  Each slot's sequence number says whether it is
+    //  free for the producer at that position, or holds a message for the consumer at that
+    //  position.  The consumer side is claimed with a compare-and-swap, so that the producer can
+    //  drop its oldest message when the ring is full.
+    //
+    //  Once its thread has exited, a queue is 'orphaned' and handed to the next new thread (with
+    //  whatever it still holds), so there are never more queues than threads that have logged at
+    //  the same time.
+    //
+    struct ThreadQueue
+    {
+        explicit ThreadQueue(std::size_t capacity);
+
+        bool TryPush(flog::detail::LogMessage& message);
+        bool Full() const;      // only for the producer
+        bool TryPop(flog::detail::LogMessage& message);
+        std::size_t ClaimBatch(std::size_t& first);
+        bool Empty() const;
+
+        // the worker formats a claimed message where it is, then hands the slot back
+        flog::detail::LogMessage const& Message(std::size_t pos) const { return slots_[pos & mask_].message_; }
+        void Release(std::size_t pos) { slots_[pos & mask_].sequence_.store(pos + mask_ + 1, std::memory_order_release); }
+
+        std::atomic<bool>               orphaned_;
+
+        // set by the producer while it queues a message:  STAMPING while it reads the clock, then
+        // the message's timestamp.  0 otherwise.
+        char                            pad0_[CACHE_LINE];
+        std::atomic<long long>          in_flight_;
+
+        // only used by the worker:  the messages that it has claimed but not yet written
+        char                            pad1_[CACHE_LINE];
+        std::size_t                     claimed_;
+        std::size_t                     claimed_end_;
+
+    private:
+        struct Slot
+        {
+            std::atomic<std::size_t>    sequence_;
+            flog::detail::LogMessage    message_;
+        };
+
+        std::unique_ptr<Slot[]>         slots_;
+        std::size_t const               mask_;
+
+        char                            pad2_[CACHE_LINE];
+        std::size_t                     enqueue_pos_;       // only used by the producer
+        char                            pad3_[CACHE_LINE];
+        std::atomic<std::size_t>        dequeue_pos_;
+        char                            pad4_[CACHE_LINE];
+    };
+
+    long long const STAMPING = 1;
+
+    // the capacity, rounded up to a power of 2 (so that a position maps to a slot with a mask)
+    std::size_t RingSize(std::size_t capacity)
+    {
+        std::size_t size = 2;
+        while (size < capacity) { size <<= 1; }
+        return size;
+    }
+
+    ThreadQueue::ThreadQueue(std::size_t capacity)
+        : orphaned_     (false)
+        , in_flight_    (0)
+        , claimed_      (0)
+        , claimed_end_  (0)
+        , slots_        (new Slot[RingSize(capacity)])
+        , mask_         (RingSize(capacity) - 1)
+        , enqueue_pos_  (0)
+        , dequeue_pos_  (0)
+    {
+        for (std::size_t i = 0; i <= mask_; ++i)
+        {
+            slots_[i].sequence_.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool ThreadQueue::TryPush(flog::detail::LogMessage& message)
+    {
+        auto& slot = slots_[enqueue_pos_ & mask_];
+        if (slot.sequence_.load(std::memory_order_acquire) != enqueue_pos_)
+        {
+            return false;       // full
+        }
+
+        slot.message_ = std::move(message);
+        slot.sequence_.store(enqueue_pos_ + 1, std::memory_order_release);
+        ++enqueue_pos_;
+        return true;
+    }
+
+    bool ThreadQueue::Full() const
+    {
+        return slots_[enqueue_pos_ & mask_].sequence_.load(std::memory_order_acquire) != enqueue_pos_;
+    }
+
+    bool ThreadQueue::TryPop(flog::detail::LogMessage& message)
+    {
+        auto pos = dequeue_pos_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            auto& slot = slots_[pos & mask_];
+            auto const diff = static_cast<std::intptr_t>(slot.sequence_.load(std::memory_order_acquire)) - static_cast<std::intptr_t>(pos + 1);
+            if (diff == 0)
+            {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    message = std::move(slot.message_);
+                    slot.sequence_.store(pos + mask_ + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;       // empty
+            }
+            else
+            {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    //  claims every message that has been published from the head of the queue onwards (as long
+    //  as the producer doesn't drop the oldest message in the meantime).  returns how many, from
+    //  'first'.
+    std::size_t ThreadQueue::ClaimBatch(std::size_t& first)
+    {
+        auto pos = dequeue_pos_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            std::size_t count = 0;
+            while (count <= mask_ && slots_[(pos + count) & mask_].sequence_.load(std::memory_order_acquire) == pos + count + 1)
+            {
+                ++count;
+            }
+
+            if (count == 0) { return 0; }
+            if (dequeue_pos_.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed))
+            {
+                first = pos;
+                return count;
+            }
+        }
+    }
+
+    bool ThreadQueue::Empty() const
+    {
+        auto const pos = dequeue_pos_.load(std::memory_order_relaxed);
+        return slots_[pos & mask_].sequence_.load(std::memory_order_acquire) != pos + 1;
+    }
+
+    void OrphanQueue(void* queue)
+    {
+        static_cast<ThreadQueue*>(queue)->orphaned_.store(true, std::memory_order_release);
+    }
 }
 
 
 //=================================================================================================
 std::shared_ptr<flog::Flogger> flog::Get(std::string const& id) { return LogRegistry::Instance().Get(id); }
-std::shared_ptr<flog::Flogger> flog::Create(std::string const& id, std::string const& filename) { return LogRegistry::Instance().Create(id, filename); }
+std::shared_ptr<flog::Flogger> flog::Create(std::string const& id, std::string const& filename, std::size_t capacity, OverflowPolicy overflowPolicy) { return LogRegistry::Instance().Create(id, filename, capacity, overflowPolicy); }
 void flog::Shutdown() { LogRegistry::Instance().Shutdown(); }
 
 
 //=================================================================================================
+//  each thread that logs gets its own queue (see ThreadQueue) the first time it logs, so the
+//  producers never contend with each other.
+//
+//  The worker claims every message that is waiting in every queue, merges them by their
+//  timestamps (each queue is already in order), formats them all into one buffer, and writes that
+//  to the file with a single system call.  Anything stamped later than a message that has been
+//  stamped but not yet queued is held back for the next batch, so the lines are always written
+//  in the order of their timestamps.
+//
 struct flog::Flogger::Impl
 {
-    Impl() { worker_ = std::make_unique<std::thread>([this]() { MainLoop(); }); }
+    Impl(std::string const& filename, std::size_t capacity, OverflowPolicy overflowPolicy);
+    ~Impl();
 
     friend detail::LineLogger;
     void LogImpl(detail::LogMessage&& message);
+    void WakeWorker();
 
-    std::deque<detail::LogMessage>  messages_;
     std::atomic<LogLevel>           log_level_;
-    std::ofstream                   file_;
-    std::mutex                      mutex_;
-    std::condition_variable         condition_;
+    OverflowPolicy const            overflow_policy_;
+    std::atomic<unsigned long long> dropped_;
+    OsSpecific::File                file_;
     std::unique_ptr<std::thread>    worker_;
 
 private:
+    //  the next message that the worker will write from one of the queues
+    struct Cursor
+    {
+        ThreadQueue*                queue_;
+        long long                   timestamp_;
+    };
+
+    ThreadQueue& ThisThreadsQueue();
+    ThreadQueue* RegisterThread();
+    bool Push(ThreadQueue& queue, detail::LogMessage& message);
+    void RefreshQueues();
+    std::size_t ClaimBatch();
+    bool Empty();
+    void WaitForMessages();
+    void Format(detail::LogMessage const& message);
+    void FormatDeferred(detail::LogMessage const& message);
     void MainLoop();
+
+    //  every thread's queue, in the order they were registered.  a queue is only ever added (under
+    //  the mutex) - the worker copies the list when 'queue_count_' changes.
+    std::size_t const                           capacity_;
+    OsSpecific::ThreadKey const                 thread_key_;
+    std::mutex                                  queues_mutex_;
+    std::vector<std::unique_ptr<ThreadQueue>>   queues_;
+    std::atomic<std::size_t>                    queue_count_;
+
+    // the worker sleeps on 'wake_epoch_' (a futex), which the producers bump to wake it.  they
+    // only do so while 'sleeping_' is set.
+    char                            pad0_[CACHE_LINE];
+    std::atomic<unsigned>           wake_epoch_;
+    std::atomic<bool>               sleeping_;
+    char                            pad1_[CACHE_LINE];
+
+    // only used by the worker.  the time of day is only worked out again when the second changes.
+    std::vector<ThreadQueue*>       worker_queues_;
+    std::vector<Cursor>             cursors_;
+    long long                       watermark_;
+    std::string                     batch_;
+    std::time_t                     last_second_;
+    char                            time_of_day_[16];
 };
 
+namespace
+{
+    //  orders the cursors into a heap with the earliest message on top
+    struct Later
+    {
+        template <typename Cursor>
+        bool operator()(Cursor const& lhs, Cursor const& rhs) const { return lhs.timestamp_ > rhs.timestamp_; }
+    };
+}
+
+flog::Flogger::Impl::Impl(std::string const& filename, std::size_t capacity, OverflowPolicy overflowPolicy)
+    : log_level_        (LogLevel::All)
+    , overflow_policy_  (overflowPolicy)
+    , dropped_          (0)
+    , file_             (OsSpecific::OpenFile(filename))
+    , capacity_         (capacity)
+    , thread_key_       (OsSpecific::CreateThreadKey())
+    , queue_count_      (0)
+    , wake_epoch_       (0)
+    , sleeping_         (false)
+    , watermark_        (0)
+    , last_second_      (-1)
+{
+    batch_.reserve(BATCH_BUFFER_SIZE);
+    worker_ = std::make_unique<std::thread>([this]() { MainLoop(); });
+}
+
+flog::Flogger::Impl::~Impl()
+{
+    // no thread can orphan one of our queues once the key has gone
+    OsSpecific::DeleteThreadKey(thread_key_);
+
+    if (file_ != OsSpecific::INVALID_FILE)
+    {
+        OsSpecific::CloseFile(file_);
+    }
+}
+
+ThreadQueue& flog::Flogger::Impl::ThisThreadsQueue()
+{
+    auto queue = static_cast<ThreadQueue*>(OsSpecific::GetThreadValue(thread_key_));
+    return queue ? *queue : *RegisterThread();
+}
+
+//  adopts the queue of a thread that has exited, if there is one
+ThreadQueue* flog::Flogger::Impl::RegisterThread()
+{
+    std::lock_guard<std::mutex> lock(queues_mutex_);
+
+    ThreadQueue* queue = nullptr;
+    for (auto const& candidate : queues_)
+    {
+        auto orphaned = true;
+        if (candidate->orphaned_.load(std::memory_order_relaxed) && candidate->orphaned_.compare_exchange_strong(orphaned, false, std::memory_order_acquire))
+        {
+            queue = candidate.get();
+            break;
+        }
+    }
+
+    if (!queue)
+    {
+        queues_.push_back(std::make_unique<ThreadQueue>(capacity_));
+        queue = queues_.back().get();
+        queue_count_.store(queues_.size());
+    }
+
+    OsSpecific::SetThreadValue(thread_key_, queue);
+    return queue;
+}
+
+void flog::Flogger::Impl::RefreshQueues()
+{
+    if (queue_count_.load() == worker_queues_.size()) { return; }
+
+    std::lock_guard<std::mutex> lock(queues_mutex_);
+    worker_queues_.clear();
+    for (auto const& queue : queues_)
+    {
+        worker_queues_.push_back(queue.get());
+    }
+}
+
+//  claims what is waiting in every queue, and starts the merge.  a queue's messages are only
+//  claimed again once the last ones that were claimed have all been written (so what is claimed
+//  stays in one run, even if the producer drops its oldest message in the meantime).  returns
+//  how many messages are claimed and not yet written.
+//
+//  nothing stamped after the 'watermark_' can be written yet - a producer that is still queueing
+//  a message may yet queue one stamped as early as its 'in_flight_', and any other as early as
+//  now.  so the clock is read before the producers' stamps (the fence pairs with the one in
+//  LogImpl()), and their stamps before their queues.
+std::size_t flog::Flogger::Impl::ClaimBatch()
+{
+    RefreshQueues();
+
+    watermark_ = std::chrono::system_clock::now().time_since_epoch().count();
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (auto const queue : worker_queues_)
+    {
+        auto const in_flight = queue->in_flight_.load(std::memory_order_acquire);
+        if (in_flight != 0) { watermark_ = std::min(watermark_, in_flight); }
+    }
+
+    std::size_t total = 0;
+    cursors_.clear();
+    for (auto const queue : worker_queues_)
+    {
+        std::size_t first = 0;
+        std::size_t count = 0;
+        if (queue->claimed_ == queue->claimed_end_ && (count = queue->ClaimBatch(first)) != 0)
+        {
+            queue->claimed_     = first;
+            queue->claimed_end_ = first + count;
+        }
+
+        if (queue->claimed_ != queue->claimed_end_)
+        {
+            Cursor const cursor = { queue, queue->Message(queue->claimed_).timestamp_ };
+            cursors_.push_back(cursor);
+            total += queue->claimed_end_ - queue->claimed_;
+        }
+    }
+    std::make_heap(cursors_.begin(), cursors_.end(), Later());
+    return total;
+}
+
+bool flog::Flogger::Impl::Empty()
+{
+    RefreshQueues();
+    return std::all_of(worker_queues_.begin(), worker_queues_.end(), [](ThreadQueue const* queue) { return queue->Empty(); });
+}
+
 void flog::Flogger::Impl::LogImpl(detail::LogMessage&& message)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (log_level_ < LogLevel::Shutdown)
+    // once shut down, a thread that hasn't logged yet mustn't register a queue that the worker
+    // will never read
+    if (log_level_ == LogLevel::Shutdown) { return; }
+
+    auto& queue = ThisThreadsQueue();
+    auto const queued = Push(queue, message);
+
+    // the fence pairs with the one in WaitForMessages() - either we see that the worker is going
+    // to sleep, or it sees our message.  only the producer that clears 'sleeping_' makes the
+    // system call, rather than every one until the worker is back up.
+    if (queued)
     {
-        messages_.emplace_back(std::move(message));
-        condition_.notify_one();
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping_.load(std::memory_order_relaxed) && sleeping_.exchange(false)) { WakeWorker(); }
     }
 }
 
+//  the message is stamped as it is queued, once there is room for it - so that a producer waiting
+//  for room doesn't hold the other queues back.  'in_flight_' is set first, so that the worker
+//  holds back anything stamped later until it has been queued (see ClaimBatch()).  returns false
+//  if the message was dropped, or the logger has been shut down.
+bool flog::Flogger::Impl::Push(ThreadQueue& queue, detail::LogMessage& message)
+{
+    for (unsigned attempt = 0; log_level_ < LogLevel::Shutdown; ++attempt)
+    {
+        if (!queue.Full())
+        {
+            queue.in_flight_.store(STAMPING);
+            message.timestamp_ = std::chrono::system_clock::now().time_since_epoch().count();
+            queue.in_flight_.store(message.timestamp_, std::memory_order_relaxed);
+
+            queue.TryPush(message);     // only this thread pushes, so there is still room
+            queue.in_flight_.store(0, std::memory_order_release);
+            return true;
+        }
+
+        switch (overflow_policy_)
+        {
+        case OverflowPolicy::DropNewest:
+            ++dropped_;
+            return false;
+
+        case OverflowPolicy::DropOldest:
+            {
+                // the worker may have claimed them all - wait for it to hand a slot back
+                detail::LogMessage oldest;
+                if (queue.TryPop(oldest))   { ++dropped_; }
+                else                        { OsSpecific::Pause(); }
+            }
+            break;
+
+        case OverflowPolicy::Block:
+            if (attempt < SPIN_COUNT)   { OsSpecific::Pause(); }
+            else                        { std::this_thread::yield(); }
+            break;
+        }
+    }
+    return false;
+}
+
+void flog::Flogger::Impl::WakeWorker()
+{
+    wake_epoch_.fetch_add(1);
+    OsSpecific::Wake(wake_epoch_);
+}
+
+//  spin, then yield, then sleep until a producer wakes us - so that a producer only has to make a
+//  system call when the worker has actually gone to sleep
+void flog::Flogger::Impl::WaitForMessages()
+{
+    for (unsigned i = 0; i < SPIN_COUNT + YIELD_COUNT; ++i)
+    {
+        if (!Empty() || log_level_ == LogLevel::Shutdown) { return; }
+        if (i < SPIN_COUNT) { OsSpecific::Pause(); }
+        else                { std::this_thread::yield(); }
+    }
+
+    auto const epoch = wake_epoch_.load();
+    sleeping_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (Empty() && log_level_ != LogLevel::Shutdown)
+    {
+        OsSpecific::Wait(wake_epoch_, epoch);
+    }
+    sleeping_.store(false, std::memory_order_relaxed);
+}
+
+//  "hh:mm:ss.mmm <message>\n", appended to the batch
+void flog::Flogger::Impl::Format(detail::LogMessage const& message)
+{
+    // jump through a few hoops to convert the raw integer 'timestamp' back into a human-readable time string
+    auto const time_since_epoch     = std::chrono::system_clock::duration{ message.timestamp_ };
+    auto const time_point           = std::chrono::system_clock::time_point{ time_since_epoch };
+    auto const seconds              = std::chrono::system_clock::to_time_t(time_point);
+    auto const fractional_seconds   = std::chrono::duration_cast<std::chrono::milliseconds>(time_since_epoch).count() % 1000; 
+
+    if (seconds != last_second_)
+    {
+        auto tm = std::tm{0};
+        OsSpecific::LocalTime(seconds, tm);
+        strftime(time_of_day_, sizeof(time_of_day_), "%T", &tm);
+        last_second_ = seconds;
+    }
+
+    char const milliseconds[] = { '.', char('0' + fractional_seconds / 100), char('0' + fractional_seconds / 10 % 10), char('0' + fractional_seconds % 10), ' ' };
+    batch_.append(time_of_day_);
+    batch_.append(milliseconds, sizeof(milliseconds));
+    if (message.format_)    { FormatDeferred(message); }
+    else                    { batch_.append(message.Data(), message.Size()); }
+    batch_.push_back('\n');
+}
+
+//  each "{}" in the format string is replaced by the next of the encoded arguments (see 
+//  detail::Encode()).  a "{}" without an argument is left as it is.
+void flog::Flogger::Impl::FormatDeferred(detail::LogMessage const& message)
+{
+    auto        arg     = message.Data();
+    auto const  end     = arg + message.Size();
+    auto        format  = message.format_;
+
+    for (auto next = std::strstr(format, "{}"); next; next = std::strstr(format, "{}"))
+    {
+        batch_.append(format, next);
+        format = next + 2;
+        if (arg == end)
+        {
+            batch_.append("{}", 2);
+            continue;
+        }
+
+        auto const type = static_cast<detail::ArgType>(*arg++);
+        switch (type)
+        {
+        case detail::ArgType::Signed:
+        case detail::ArgType::Unsigned:
+            {
+                unsigned long long value;
+                std::memcpy(&value, arg, sizeof(value));
+                arg += sizeof(value);
+
+                auto const negative = type == detail::ArgType::Signed && static_cast<long long>(value) < 0;
+                char digits[20];
+                auto const first = FormatUnsigned(negative ? 0 - value : value, digits + sizeof(digits));
+                if (negative) { batch_.push_back('-'); }
+                batch_.append(first, digits + sizeof(digits));
+            }
+            break;
+
+        case detail::ArgType::Double:
+            {
+                double value;
+                std::memcpy(&value, arg, sizeof(value));
+                arg += sizeof(value);
+
+                char buffer[32];
+                batch_.append(buffer, FormatDouble(value, buffer));
+            }
+            break;
+
+        case detail::ArgType::Bool:
+            batch_.push_back(*arg++ ? '1' : '0');
+            break;
+
+        case detail::ArgType::Char:
+            batch_.push_back(*arg++);
+            break;
+
+        case detail::ArgType::String:
+            {
+                std::size_t size;
+                std::memcpy(&size, arg, sizeof(size));
+                arg += sizeof(size);
+                batch_.append(arg, size);
+                arg += size;
+            }
+            break;
+        }
+    }
+    batch_.append(format);
+}
+
 void flog::Flogger::Impl::MainLoop()
 {
     try
     {
         while (true)
         {
-            detail::LogMessage message;
+            while (log_level_ != LogLevel::Shutdown && ClaimBatch() == 0)
+            {
+                WaitForMessages();
+            }
+
+            if (log_level_ == LogLevel::Shutdown) { return; }
 
+            // the earliest message of all the queues each time, up to the watermark.  each slot is
+            // handed back to its producer as soon as its message has been formatted.
+            batch_.clear();
+            while (!cursors_.empty() && cursors_.front().timestamp_ <= watermark_)
             {
-                std::unique_lock<std::mutex> lock(mutex_);
-                while (log_level_ != LogLevel::Shutdown && messages_.empty())
+                std::pop_heap(cursors_.begin(), cursors_.end(), Later());
+                auto& cursor = cursors_.back();
+                auto& queue  = *cursor.queue_;
+                Format(queue.Message(queue.claimed_));
+                queue.Release(queue.claimed_);
+
+                // once a queue's claimed messages have all gone, claim what it has queued since -
+                // some of it may still be earlier than what the other queues have left
+                std::size_t first = 0;
+                std::size_t count = 0;
+                if (++queue.claimed_ == queue.claimed_end_ && (count = queue.ClaimBatch(first)) != 0)
                 {
-                    condition_.wait(lock);
+                    queue.claimed_     = first;
+                    queue.claimed_end_ = first + count;
                 }
 
-                if (log_level_ == LogLevel::Shutdown) { return; }
-                message = std::move(messages_.front());
-                messages_.pop_front();
+                if (queue.claimed_ == queue.claimed_end_)
+                {
+                    cursors_.pop_back();
+                }
+                else
+                {
+                    cursor.timestamp_ = queue.Message(queue.claimed_).timestamp_;
+                    std::push_heap(cursors_.begin(), cursors_.end(), Later());
+                }
             }
 
-            // jump through a few hoops to convert the raw integer 'timestamp' back into a human-readable time string
-            auto const time_since_epoch     = std::chrono::system_clock::duration{ message.timestamp_ };
-            auto const time_point           = std::chrono::system_clock::time_point{ time_since_epoch };
-            auto const seconds              = std::chrono::system_clock::to_time_t(time_point);
-            auto const fractional_seconds   = std::chrono::duration_cast<std::chrono::milliseconds>(time_since_epoch).count() % 1000; 
-
-            auto tm = std::tm{0};
-            //gmtime_s(&tm, &seconds);
-            localtime_s(&tm, &seconds);
-            char buffer[16];
-            strftime(buffer, 16, "%T", &tm);
-
-            // log the message
-            file_ << buffer << "." << std::setw(3) << std::setfill('0') << fractional_seconds << " " << message.oss_.str() << "\n";
+            // the rest are held back until the next time around - which won't be long, as the
+            // producer that is holding them up has already read the clock.  it may not be
+            // running, though, so let it have the processor.
+            if (batch_.empty())
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            OsSpecific::WriteFile(file_, batch_.data(), batch_.size());
         }
     }
     catch (std::exception& e)
@@ -177,9 +930,8 @@ void flog::Flogger::Impl::MainLoop()
 }
 
 //=================================================================================================
-flog::Flogger::Flogger(std::string const& filename) : mImpl(std::make_unique<Impl>()) 
+flog::Flogger::Flogger(std::string const& filename, std::size_t capacity, OverflowPolicy overflowPolicy) : mImpl(std::make_unique<Impl>(filename, capacity, overflowPolicy)) 
 {
-    mImpl->file_.open(filename, std::ios::trunc);
 }
 
 flog::Flogger::~Flogger() 
@@ -196,24 +948,18 @@ flog::detail::LineLogger flog::Flogger::Fatal()      { return detail::LineLogger
 
 void flog::Flogger::Shutdown()
 {
-    {
-        std::lock_guard<std::mutex> lock(mImpl->mutex_);
-        if (mImpl->log_level_ == LogLevel::Shutdown) { return; }
-        mImpl->log_level_ = LogLevel::Shutdown;
-        mImpl->file_.close();
-        mImpl->messages_.clear();
-        mImpl->condition_.notify_one();
-    }
+    // anything still queued is thrown away
+    if (mImpl->log_level_.exchange(LogLevel::Shutdown) == LogLevel::Shutdown) { return; }
+    mImpl->WakeWorker();
     mImpl->worker_->join();
     mImpl->worker_.reset();
 }
 
 void flog::Flogger::SetLogLevel(LogLevel log_level) 
 { 
-    std::lock_guard<std::mutex>(mImpl->mutex_);
-    if (mImpl->log_level_ != LogLevel::Shutdown)
+    auto current = mImpl->log_level_.load();
+    while (current != LogLevel::Shutdown && !mImpl->log_level_.compare_exchange_weak(current, log_level))
     {
-        mImpl->log_level_ = log_level; 
     }
 }
 
@@ -222,12 +968,90 @@ flog::LogLevel flog::Flogger::GetLogLevel() const
     return mImpl->log_level_; 
 }
 
+void flog::Flogger::LogDeferred(detail::LogMessage&& message)
+{
+    mImpl->LogImpl(std::move(message));
+}
+
+unsigned long long flog::Flogger::GetDroppedCount() const
+{
+    return mImpl->dropped_;
+}
+
 //=================================================================================================
 flog::detail::LogMessage::LogMessage(LogLevel messageLevel)
-    : thread_id_(OsSpecific::GetThreadId())
+    : timestamp_(0)     // stamped as it is queued
+    , thread_id_(OsSpecific::GetThreadId())
     , message_level_(messageLevel)
-    , timestamp_(std::chrono::system_clock::now().time_since_epoch().count())
+    , format_(nullptr)
+    , size_(0)
+{
+}
+
+flog::detail::LogMessage::LogMessage(LogMessage&& rhs)
+    : timestamp_        (rhs.timestamp_)
+    , thread_id_        (rhs.thread_id_)
+    , message_level_    (rhs.message_level_)
+    , format_           (rhs.format_)
+    , size_             (rhs.size_)
+    , overflow_         (std::move(rhs.overflow_))
+{
+    std::memcpy(text_, rhs.text_, size_);
+    rhs.size_ = 0;
+}
+
+flog::detail::LogMessage& flog::detail::LogMessage::operator=(LogMessage&& rhs)
+{
+    timestamp_      = rhs.timestamp_;
+    thread_id_      = rhs.thread_id_;
+    message_level_  = rhs.message_level_;
+    format_         = rhs.format_;
+    size_           = rhs.size_;
+    overflow_       = std::move(rhs.overflow_);
+    std::memcpy(text_, rhs.text_, size_);
+    rhs.size_ = 0;
+    rhs.overflow_.clear();
+    return *this;
+}
+
+void flog::detail::LogMessage::Append(char const* text, std::size_t size)
+{
+    if (overflow_.empty() && size_ + size <= TEXT_CAPACITY)
+    {
+        std::memcpy(text_ + size_, text, size);
+        size_ += size;
+        return;
+    }
+
+    // too big for the buffer - from now on, the whole message lives in 'overflow_'
+    if (overflow_.empty()) { overflow_.assign(text_, size_); }
+    overflow_.append(text, size);
+}
+
+void flog::detail::LogMessage::AppendSigned(long long value)
+{
+    if (value < 0)
+    {
+        Append("-", 1);
+        AppendUnsigned(0 - static_cast<unsigned long long>(value));
+    }
+    else
+    {
+        AppendUnsigned(static_cast<unsigned long long>(value));
+    }
+}
+
+void flog::detail::LogMessage::AppendUnsigned(unsigned long long value)
+{
+    char buffer[20];
+    auto const first = FormatUnsigned(value, buffer + sizeof(buffer));
+    Append(first, buffer + sizeof(buffer) - first);
+}
+
+void flog::detail::LogMessage::AppendDouble(double value)
 {
+    char buffer[32];
+    Append(buffer, FormatDouble(value, buffer));
 }
 
 //=================================================================================================
@@ -3,17 +3,10 @@
 #include <string>
 #include <sstream>
 #include <memory>
+#include <cstring>
 
 namespace flog
 {
-    //=============================================================================================
-    //  manage the log file(s).  By convention, the main log file for any given application should 
-    //  have a <blank> ID.
-    class Flogger;
-    std::shared_ptr<Flogger> Get(std::string const& id = "");
-    std::shared_ptr<Flogger> Create(std::string const& id, std::string const& filename);
-    void Shutdown();
-
     //=============================================================================================
     enum class LogLevel
     {
@@ -27,11 +20,29 @@ namespace flog
     };
 
     //=============================================================================================
-    namespace detail { class LineLogger; }
+    //  what to do with a message when the thread's queue (of 'capacity' messages - each thread
+    //  that logs has its own) is already full
+    enum class OverflowPolicy
+    {
+        Block,          // wait for the worker to make room
+        DropNewest,     // throw away the new message
+        DropOldest,     // throw away the thread's oldest message still waiting, to make room for the new one
+    };
+
+    //=============================================================================================
+    //  manage the log file(s).  By convention, the main log file for any given application should 
+    //  have a <blank> ID.
+    class Flogger;
+    std::shared_ptr<Flogger> Get(std::string const& id = "");
+    std::shared_ptr<Flogger> Create(std::string const& id, std::string const& filename, std::size_t capacity = 1024, OverflowPolicy overflowPolicy = OverflowPolicy::Block);
+    void Shutdown();
+
+    //=============================================================================================
+    namespace detail { class LineLogger; struct LogMessage; }
     class Flogger final
     {
     public:
-        Flogger(std::string const& filename);
+        Flogger(std::string const& filename, std::size_t capacity = 1024, OverflowPolicy overflowPolicy = OverflowPolicy::Block);
         ~Flogger();
 
         // prevent copying and assignment
@@ -53,10 +64,22 @@ namespace flog
         detail::LineLogger Error();
         detail::LineLogger Fatal();
 
+        // deferred logging, for the hottest call sites:  only the address of 'format' and the raw
+        // values of the arguments are queued, and the worker formats the line.  'format' must be a
+        // string literal (it is read later, on the worker).  each "{}" in it is replaced by the
+        // next argument.
+        template <typename... Args>
+        void Deferred(LogLevel messageLevel, char const* format, Args const&... args);
+
         void SetLogLevel(LogLevel x);
         LogLevel GetLogLevel() const;
 
+        // the number of messages thrown away because the queue was full
+        unsigned long long GetDroppedCount() const;
+
     private:
+        void LogDeferred(detail::LogMessage&& message);
+
         friend class detail::LineLogger;
         struct Impl;
         std::unique_ptr<Impl> mImpl;
@@ -67,39 +90,37 @@ namespace flog
     {
         //=========================================================================================
         //  NOTE:  this class is an implementation detail.  It is not intended to be used directly.
-        //         also note that this is a move-only class.  it is not copyable (due to the internal
-        //         std::ostringstream member
+        //         also note that this is a move-only class.
+        //
+        //  the text is formatted straight into a fixed buffer - so logging a line doesn't allocate,
+        //  and moving a message into the queue just copies the text.  only a message that doesn't
+        //  fit moves (all of its text) into 'overflow_'.
         //
         struct LogMessage final
         {
+            static std::size_t const TEXT_CAPACITY = 256;
+
             long long           timestamp_;
             unsigned long       thread_id_;
             LogLevel            message_level_;
-            std::ostringstream  oss_;
+            char const*         format_;        // deferred messages only - the text holds the encoded arguments
+            std::size_t         size_;
+            char                text_[TEXT_CAPACITY];
+            std::string         overflow_;
 
             LogMessage(LogLevel messageLevel = LogLevel::All);
 
             // VS2013 doesn't currently support defaulted move construction/assignment.  Have to write it ourselves...
-            //
-            //LogMessage(LogMessage&&)                    = default;
-            //LogMessage& operator=(LogMessage&&)         = default;
-
-            LogMessage(LogMessage&& rhs)
-                : timestamp_        (std::move(rhs.timestamp_))
-                , thread_id_        (std::move(rhs.thread_id_))
-                , message_level_    (std::move(rhs.message_level_))
-                , oss_              (std::move(rhs.oss_))
-            {
-            }
+            LogMessage(LogMessage&& rhs);
+            LogMessage& operator=(LogMessage&& rhs);
 
-            LogMessage& operator=(LogMessage&& rhs)
-            {
-                timestamp_      = std::move(rhs.timestamp_);
-                thread_id_      = std::move(rhs.thread_id_);
-                message_level_  = std::move(rhs.message_level_);
-                oss_            = std::move(rhs.oss_);
-                return *this;
-            }
+            char const* Data() const { return overflow_.empty() ? text_ : overflow_.data(); }
+            std::size_t Size() const { return overflow_.empty() ? size_ : overflow_.size(); }
+
+            void Append(char const* text, std::size_t size);
+            void AppendSigned(long long value);
+            void AppendUnsigned(unsigned long long value);
+            void AppendDouble(double value);
         };
 
         //=========================================================================================
@@ -115,13 +136,118 @@ namespace flog
             LineLogger& operator=(LineLogger&&)      = delete;
             LineLogger& operator=(LineLogger const&) = delete;
 
+            // the common types are formatted without allocating.  anything else goes through a
+            // std::ostringstream.
             template <typename T>
-            LineLogger& operator<<(T const& t) { if (message_enabled_) { oss_ << t; } return *this; }
+            LineLogger& operator<<(T const& t) 
+            { 
+                if (message_enabled_) 
+                { 
+                    std::ostringstream oss;
+                    oss << t;
+                    auto const text = oss.str();
+                    log_message_.Append(text.data(), text.size());
+                } 
+                return *this; 
+            }
+
+            LineLogger& operator<<(char const* t)           { if (message_enabled_) { log_message_.Append(t, std::strlen(t)); } return *this; }
+            LineLogger& operator<<(std::string const& t)    { if (message_enabled_) { log_message_.Append(t.data(), t.size()); } return *this; }
+            LineLogger& operator<<(char t)                  { if (message_enabled_) { log_message_.Append(&t, 1); } return *this; }
+            LineLogger& operator<<(bool t)                  { if (message_enabled_) { log_message_.AppendUnsigned(t ? 1 : 0); } return *this; }
+            LineLogger& operator<<(short t)                 { if (message_enabled_) { log_message_.AppendSigned(t); } return *this; }
+            LineLogger& operator<<(int t)                   { if (message_enabled_) { log_message_.AppendSigned(t); } return *this; }
+            LineLogger& operator<<(long t)                  { if (message_enabled_) { log_message_.AppendSigned(t); } return *this; }
+            LineLogger& operator<<(long long t)             { if (message_enabled_) { log_message_.AppendSigned(t); } return *this; }
+            LineLogger& operator<<(unsigned short t)        { if (message_enabled_) { log_message_.AppendUnsigned(t); } return *this; }
+            LineLogger& operator<<(unsigned int t)          { if (message_enabled_) { log_message_.AppendUnsigned(t); } return *this; }
+            LineLogger& operator<<(unsigned long t)         { if (message_enabled_) { log_message_.AppendUnsigned(t); } return *this; }
+            LineLogger& operator<<(unsigned long long t)    { if (message_enabled_) { log_message_.AppendUnsigned(t); } return *this; }
+            LineLogger& operator<<(float t)                 { if (message_enabled_) { log_message_.AppendDouble(t); } return *this; }
+            LineLogger& operator<<(double t)                { if (message_enabled_) { log_message_.AppendDouble(t); } return *this; }
 
         private:
             Flogger::Impl*      flogger_impl_;
             LogMessage          log_message_;
             bool                message_enabled_;
         };
+
+        //=========================================================================================
+        //  NOTE:  the following are an implementation detail.  They are not intended to be used 
+        //         directly.
+        //
+        //  a deferred message's arguments, each encoded as its type followed by its raw value (a 
+        //  string's is its length then its characters).  anything that isn't one of these types
+        //  is formatted on the spot, and encoded as a string.
+        //
+        enum class ArgType : char
+        {
+            Signed,
+            Unsigned,
+            Double,
+            Bool,
+            Char,
+            String,
+        };
+
+        inline void EncodeArg(LogMessage& message, ArgType type, void const* value, std::size_t size)
+        {
+            auto const tag = static_cast<char>(type);
+            message.Append(&tag, 1);
+            message.Append(static_cast<char const*>(value), size);
+        }
+
+        inline void EncodeString(LogMessage& message, char const* text, std::size_t size)
+        {
+            EncodeArg(message, ArgType::String, &size, sizeof(size));
+            message.Append(text, size);
+        }
+
+        template <typename T>
+        void EncodeOne(LogMessage& message, T const& t)
+        {
+            std::ostringstream oss;
+            oss << t;
+            auto const text = oss.str();
+            EncodeString(message, text.data(), text.size());
+        }
+
+        inline void EncodeOne(LogMessage& message, char const* t)           { EncodeString(message, t, std::strlen(t)); }
+        inline void EncodeOne(LogMessage& message, std::string const& t)    { EncodeString(message, t.data(), t.size()); }
+        inline void EncodeOne(LogMessage& message, char t)                  { EncodeArg(message, ArgType::Char, &t, sizeof(t)); }
+        inline void EncodeOne(LogMessage& message, bool t)                  { EncodeArg(message, ArgType::Bool, &t, sizeof(t)); }
+        inline void EncodeOne(LogMessage& message, short t)                 { long long const v = t; EncodeArg(message, ArgType::Signed, &v, sizeof(v)); }
+        inline void EncodeOne(LogMessage& message, int t)                   { long long const v = t; EncodeArg(message, ArgType::Signed, &v, sizeof(v)); }
+        inline void EncodeOne(LogMessage& message, long t)                  { long long const v = t; EncodeArg(message, ArgType::Signed, &v, sizeof(v)); }
+        inline void EncodeOne(LogMessage& message, long long t)             { EncodeArg(message, ArgType::Signed, &t, sizeof(t)); }
+        inline void EncodeOne(LogMessage& message, unsigned short t)        { unsigned long long const v = t; EncodeArg(message, ArgType::Unsigned, &v, sizeof(v)); }
+        inline void EncodeOne(LogMessage& message, unsigned int t)          { unsigned long long const v = t; EncodeArg(message, ArgType::Unsigned, &v, sizeof(v)); }
+        inline void EncodeOne(LogMessage& message, unsigned long t)         { unsigned long long const v = t; EncodeArg(message, ArgType::Unsigned, &v, sizeof(v)); }
+        inline void EncodeOne(LogMessage& message, unsigned long long t)    { EncodeArg(message, ArgType::Unsigned, &t, sizeof(t)); }
+        inline void EncodeOne(LogMessage& message, float t)                 { double const v = t; EncodeArg(message, ArgType::Double, &v, sizeof(v)); }
+        inline void EncodeOne(LogMessage& message, double t)                { EncodeArg(message, ArgType::Double, &t, sizeof(t)); }
+
+        inline void Encode(LogMessage&)
+        {
+        }
+
+        template <typename T, typename... Rest>
+        void Encode(LogMessage& message, T const& t, Rest const&... rest)
+        {
+            EncodeOne(message, t);
+            Encode(message, rest...);
+        }
+    }
+
+    //=============================================================================================
+    template <typename... Args>
+    void Flogger::Deferred(LogLevel messageLevel, char const* format, Args const&... args)
+    {
+        if (GetLogLevel() > messageLevel) { return; }
+
+        detail::LogMessage message(messageLevel);
+        message.format_ = format;
+        detail::Encode(message, args...);
+        LogDeferred(std::move(message));
     }
 }
@@ -0,0 +1,134 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+
+#include "Flogger/Flogger.h"
+
+//=================================================================================================
+//  count every heap allocation made by the process
+//
+namespace
+{
+    std::atomic<unsigned long long> allocations(0);
+}
+
+void* operator new(std::size_t size)
+{
+    ++allocations;
+    if (auto const p = std::malloc(size ? size : 1)) { return p; }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) throw()
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) throw()
+{
+    operator delete(p);
+}
+
+//=================================================================================================
+//  the same line, logged with a LineLogger (formatted by the caller) or deferred (formatted by the
+//  worker)
+//
+void LogLine(flog::Flogger& log, bool deferred, unsigned t, unsigned i, unsigned lines)
+{
+    if (deferred)
+    {
+        log.Deferred(flog::LogLevel::Info, "thread {} line {} of {}:  value {}, status {}", t, i, lines, i * 0.5, "ok");
+    }
+    else
+    {
+        log() << "thread " << t << " line " << i << " of " << lines << ":  value " << i * 0.5 << ", status " << "ok";
+    }
+}
+
+//=================================================================================================
+//  log 'lines' lines from each of 'threads' threads, and report how long it took
+//
+double LogLines(flog::Flogger& log, bool deferred, unsigned threads, unsigned lines)
+{
+    std::vector<std::thread> workers;
+    auto const start = std::chrono::steady_clock::now();
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&log, deferred, t, lines]()
+        {
+            for (unsigned i = 0; i < lines; ++i)
+            {
+                LogLine(log, deferred, t, i, lines);
+            }
+        });
+    }
+    for (auto& worker : workers) { worker.join(); }
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / 1e9;
+}
+
+//=================================================================================================
+//  what a line costs the thread that logs it, while the queue has room:  bursts of lines (fewer
+//  than the queue holds) from a single thread, with a pause after each for the worker to catch up
+//
+double CallerNanoseconds(flog::Flogger& log, bool deferred, unsigned bursts)
+{
+    unsigned const BURST = 1000;
+
+    double total = 0;
+    for (unsigned b = 0; b < bursts; ++b)
+    {
+        auto const start = std::chrono::steady_clock::now();
+        for (unsigned i = 0; i < BURST; ++i)
+        {
+            LogLine(log, deferred, 0, i, BURST);
+        }
+        total += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return total / (static_cast<double>(bursts) * BURST);
+}
+
+//=================================================================================================
+void Run(std::string const& file, bool deferred, unsigned threads, unsigned lines)
+{
+    auto const log = flog::Create(deferred ? "deferred" : "", file);
+    auto const name = deferred ? "Deferred():  " : "LineLogger:  ";
+
+    // the first lines start the worker and size its buffers - leave them out
+    LogLines(*log, deferred, threads, 10000);
+
+    auto const before   = allocations.load();
+    auto const seconds  = LogLines(*log, deferred, threads, lines);
+    auto const total    = static_cast<double>(threads) * lines;
+    auto const made     = allocations.load() - before;
+
+    std::cout
+        << name << threads << " thread(s) x " << lines << " lines in " << seconds << "s:  "
+        << total / seconds << " lines/s, "
+        << seconds * threads * 1e9 / total << "ns per line (per thread), "
+        << made / total << " heap allocations per line"
+        << std::endl;
+
+    std::cout
+        << name << CallerNanoseconds(*log, deferred, 200) << "ns per line to the caller, while the queue has room"
+        << std::endl;
+}
+
+//=================================================================================================
+int main(int argc, char** argv)
+{
+    unsigned const threads  = argc > 1 ? std::atoi(argv[1]) : 4;
+    unsigned const lines    = argc > 2 ? std::atoi(argv[2]) : 1000000;
+    std::string const file  = argc > 3 ? argv[3] : "FloggerBench.log";
+
+    Run(file, false, threads, lines);
+    Run(file + ".deferred", true, threads, lines);
+
+    flog::Shutdown();
+    return EXIT_SUCCESS;
+}
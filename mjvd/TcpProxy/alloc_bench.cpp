@@ -0,0 +1,117 @@
+#include "stdafx.h"
+#include "alloc_bench.h"
+#include "alloc_counter.h"
+#include "utils.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <iomanip>
+#include <iostream>
+#include <cstdlib>
+
+#include <boost/asio.hpp>
+namespace ba = boost::asio;
+
+
+namespace
+{
+    // the data is sent in chunks of this size, and this much is sent before we start counting
+    std::size_t const CHUNK_SIZE = 64 * 1024;
+    std::size_t const WARM_UP    = 16 * 1024 * 1024;
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // a free port on the loopback interface, for the proxy to listen on
+    auto FreePort(ba::io_service& io_service) -> unsigned short
+    {
+        ba::ip::tcp::acceptor acceptor(io_service, ba::ip::tcp::endpoint(ba::ip::address_v4::loopback(), 0));
+        return acceptor.local_endpoint().port();
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // send 'bytes' through the proxy, and wait until the sink has received them all
+    auto Send(ba::ip::tcp::socket& socket, std::vector<char> const& chunk, std::size_t bytes, std::atomic<unsigned long long> const& received, unsigned long long target) -> void
+    {
+        for (std::size_t sent = 0; sent < bytes; sent += chunk.size())
+        {
+            ba::write(socket, ba::buffer(chunk));
+        }
+
+        while (received.load() < target)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto RunAllocBenchmark(ProxyParameters params, std::size_t megabytes) -> int
+{
+    ba::io_service benchService;
+
+    // the sink:  accepts a single connection, and reads (and throws away) everything
+    ba::ip::tcp::acceptor           sinkAcceptor(benchService, ba::ip::tcp::endpoint(ba::ip::address_v4::loopback(), 0));
+    std::atomic<unsigned long long> received(0);
+    std::thread sink([&benchService, &sinkAcceptor, &received]()
+    {
+        ba::ip::tcp::socket socket(benchService);
+        sinkAcceptor.accept(socket);
+
+        std::vector<char> buffer(CHUNK_SIZE);
+        boost::system::error_code ec;
+        for (;;)
+        {
+            auto const n = socket.read_some(ba::buffer(buffer), ec);
+            if (ec) { break; }
+            received += n;
+        }
+    });
+
+    // the proxy, in front of the sink
+    params.listen_addr  = "127.0.0.1";
+    params.listen_port  = std::to_string(FreePort(benchService));
+    params.dest_addr    = "127.0.0.1";
+    params.dest_port    = std::to_string(sinkAcceptor.local_endpoint().port());
+    params.more_destinations.clear();
+    params.dump_traffic = false;
+    params.metrics_port.clear();
+    params.handoff_path.clear();
+    params.drain_timeout_s = 0;
+
+    ba::io_service proxyService;
+    auto proxy = std::make_shared<Proxy>(proxyService, params);
+    proxy->Start();
+    std::thread runner([&proxyService]() { proxyService.run(); });
+
+    // warm up (which includes setting up the session), then count what is allocated while the
+    // data is relayed
+    std::vector<char> const chunk(CHUNK_SIZE, 'x');
+    auto const bytes = megabytes * 1024 * 1024;
+
+    ba::ip::tcp::socket client(benchService);
+    client.connect(ba::ip::tcp::endpoint(ba::ip::address_v4::loopback(), static_cast<unsigned short>(std::stoi(params.listen_port))));
+    Send(client, chunk, WARM_UP, received, WARM_UP);
+
+    auto const allocationsBefore = HeapAllocations();
+    auto const started           = std::chrono::steady_clock::now();
+    Send(client, chunk, bytes, received, WARM_UP + bytes);
+    auto const elapsed           = std::chrono::steady_clock::now() - started;
+    auto const allocations       = HeapAllocations() - allocationsBefore;
+
+    boost::system::error_code ignored;
+    client.close(ignored);
+    proxy->Stop();
+    runner.join();
+    sink.join();
+
+    auto const seconds = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() / 1e6;
+    std::cout
+        << TimeStamp() << "relayed " << megabytes << " MB in " << std::fixed << std::setprecision(3) << seconds << "s ("
+        << std::setprecision(1) << (seconds > 0 ? megabytes / seconds : 0) << " MB/s)\n"
+        << TimeStamp() << "heap allocations:  " << allocations << " (" << std::setprecision(3) << (megabytes ? double(allocations) / megabytes : 0) << " per MB relayed)"
+        << std::endl;
+
+    return EXIT_SUCCESS;
+}
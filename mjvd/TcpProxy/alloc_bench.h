@@ -0,0 +1,22 @@
+#ifndef INCLUDED_ALLOC_BENCH_HEADER
+#define INCLUDED_ALLOC_BENCH_HEADER
+
+
+#include <cstddef>
+
+#include "proxy.h"
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Measures how many heap allocations the proxy makes for each MB that it relays.  Runs a proxy
+// (with 'params', apart from the addresses) in front of a sink on the loopback interface, sends
+// 'megabytes' MB through it over a single session after a warm-up, and reports the allocations
+// made in the meantime.  The client and the sink use blocking socket calls, which don't
+// allocate - so everything that is counted was made by the proxy.
+//
+// Returns the process exit code.
+//
+auto RunAllocBenchmark(ProxyParameters params, std::size_t megabytes) -> int;
+
+
+#endif  //INCLUDED_ALLOC_BENCH_HEADER
@@ -0,0 +1,55 @@
+#include "stdafx.h"
+#include "alloc_counter.h"
+#include <new>
+#include <atomic>
+#include <cstdlib>
+
+
+namespace
+{
+    std::atomic<unsigned long long> gAllocations(0);
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto Allocate(std::size_t size) -> void*
+    {
+        gAllocations.fetch_add(1, std::memory_order_relaxed);
+        return std::malloc(size == 0 ? 1 : size);
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto HeapAllocations() -> unsigned long long
+{
+    return gAllocations.load(std::memory_order_relaxed);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// the replacement global allocation functions
+//
+void* operator new(std::size_t size)
+{
+    auto const p = Allocate(size);
+    if (!p) { throw std::bad_alloc(); }
+    return p;
+}
+
+void* operator new[](std::size_t size)
+{
+    auto const p = Allocate(size);
+    if (!p) { throw std::bad_alloc(); }
+    return p;
+}
+
+void* operator new  (std::size_t size, std::nothrow_t const&) throw()   { return Allocate(size); }
+void* operator new[](std::size_t size, std::nothrow_t const&) throw()   { return Allocate(size); }
+
+void operator delete  (void* p) throw()                                 { std::free(p); }
+void operator delete[](void* p) throw()                                 { std::free(p); }
+void operator delete  (void* p, std::nothrow_t const&) throw()          { std::free(p); }
+void operator delete[](void* p, std::nothrow_t const&) throw()          { std::free(p); }
+
+// the sized forms (C++14) are called in place of the unsized ones where the size is known
+void operator delete  (void* p, std::size_t) throw()                    { operator delete(p); }
+void operator delete[](void* p, std::size_t) throw()                    { operator delete[](p); }
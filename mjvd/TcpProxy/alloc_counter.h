@@ -0,0 +1,13 @@
+#ifndef INCLUDED_ALLOC_COUNTER_HEADER
+#define INCLUDED_ALLOC_COUNTER_HEADER
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The number of heap allocations (calls to the global operator new) made by the whole process so
+// far.  alloc_counter.cpp replaces the global operator new/delete to count them.  The count costs
+// one relaxed atomic increment per allocation - and the relay loop is meant to make none.
+//
+auto HeapAllocations() -> unsigned long long;
+
+
+#endif  //INCLUDED_ALLOC_COUNTER_HEADER
@@ -0,0 +1,56 @@
+#include "stdafx.h"
+#include "block_pool.h"
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+BlockPool::BlockPool(std::size_t maxFree)
+    : mBlockSize{0}
+    , mMaxFree  {maxFree}
+{
+    mFree.reserve(maxFree);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+BlockPool::~BlockPool()
+{
+    for (auto block : mFree)
+    {
+        ::operator delete(block);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto BlockPool::Allocate(std::size_t size) -> void*
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mBlockSize == 0)
+        {
+            mBlockSize = size;
+        }
+
+        if (size == mBlockSize && !mFree.empty())
+        {
+            auto const block = mFree.back();
+            mFree.pop_back();
+            return block;
+        }
+    }
+
+    return ::operator new(size);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto BlockPool::Deallocate(void* block, std::size_t size) -> void
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (size == mBlockSize && mFree.size() < mMaxFree)
+        {
+            mFree.push_back(block);
+            return;
+        }
+    }
+
+    ::operator delete(block);
+}
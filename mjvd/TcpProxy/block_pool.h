@@ -0,0 +1,72 @@
+#ifndef INCLUDED_BLOCK_POOL_HEADER
+#define INCLUDED_BLOCK_POOL_HEADER
+
+
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <boost/noncopyable.hpp>
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// A free list of equally sized blocks, so that the memory for each session (and its relay
+// buffers) is recycled rather than going back to the heap when the session closes.
+//
+// The block size is set by the first allocation.  Blocks of any other size, and blocks beyond
+// the first 'maxFree' that are returned, go straight to (and from) the heap.
+//
+// Sessions are usually created on one thread and destroyed on another, so the pool is locked -
+// but only for long enough to push or pop a pointer.
+//
+class BlockPool : private boost::noncopyable
+{
+public:
+    explicit BlockPool(std::size_t maxFree);
+    ~BlockPool();
+
+    auto Allocate  (std::size_t size) -> void*;
+    auto Deallocate(void* block, std::size_t size) -> void;
+
+private:
+    std::mutex          mMutex;
+    std::size_t         mBlockSize;     // 0 until the first allocation
+    std::vector<void*>  mFree;          // never grows beyond its initial capacity
+    std::size_t const   mMaxFree;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// A standard allocator that allocates from a BlockPool - for std::allocate_shared().  Each copy
+// keeps the pool alive, so the pool outlives everything that was allocated from it.
+//
+template <typename T>
+class PoolAllocator
+{
+public:
+    typedef T               value_type;
+    typedef T*              pointer;
+    typedef T const*        const_pointer;
+    typedef T&              reference;
+    typedef T const&        const_reference;
+    typedef std::size_t     size_type;
+    typedef std::ptrdiff_t  difference_type;
+
+    template <typename U> struct rebind { typedef PoolAllocator<U> other; };
+
+    explicit PoolAllocator(std::shared_ptr<BlockPool> const& pool) : mPool(pool) {}
+    template <typename U> PoolAllocator(PoolAllocator<U> const& other) : mPool(other.mPool) {}
+
+    auto allocate  (std::size_t n) -> T*            { return static_cast<T*>(mPool->Allocate(n * sizeof(T))); }
+    auto deallocate(T* p, std::size_t n) -> void    { mPool->Deallocate(p, n * sizeof(T)); }
+
+    template <typename U> auto operator==(PoolAllocator<U> const& other) const -> bool { return mPool == other.mPool; }
+    template <typename U> auto operator!=(PoolAllocator<U> const& other) const -> bool { return mPool != other.mPool; }
+
+private:
+    template <typename U> friend class PoolAllocator;
+    std::shared_ptr<BlockPool> mPool;
+};
+
+
+#endif  //INCLUDED_BLOCK_POOL_HEADER
@@ -0,0 +1,140 @@
+#include "stdafx.h"
+#include "buffer_ring.h"
+#include <cassert>
+#include <stdexcept>
+
+namespace ba = boost::asio;
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+BufferRing::BufferRing(BlockPool& pool, std::size_t bufferSize, std::size_t bufferCount)
+    : mBufferSize   {bufferSize}
+    , mBufferCount  {bufferCount}
+    , mPool         (pool)
+    , mStorage      {static_cast<char*>(pool.Allocate(bufferSize * bufferCount))}
+    , mSlots        (bufferCount)
+    , mHead         {0}
+    , mFilled       {0}
+    , mWriting      {0}
+    , mBufferedBytes{0}
+{
+    if (bufferSize == 0 || bufferCount == 0)
+    {
+        mPool.Deallocate(mStorage, mBufferSize * mBufferCount);
+        throw std::invalid_argument("BufferRing:  buffer size and count must be greater than zero");
+    }
+
+    // unless the data is being rewritten, each buffer is written as a single segment (plus
+    // perhaps a prefix) - so we never need to grow these later
+    mWriteBuffers.reserve(bufferCount + 1);
+    for (auto& slot : mSlots)
+    {
+        slot.segments.reserve(1);
+        slot.size = 0;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+BufferRing::~BufferRing()
+{
+    mPool.Deallocate(mStorage, mBufferSize * mBufferCount);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto BufferRing::Full() const -> bool
+{
+    return mFilled == mBufferCount;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto BufferRing::Empty() const -> bool
+{
+    return mFilled == mWriting;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto BufferRing::BufferedBytes() const -> std::size_t
+{
+    return mBufferedBytes;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto BufferRing::PrepareRead() -> ba::mutable_buffers_1
+{
+    assert(!Full());
+    auto const index = (mHead + mFilled) % mBufferCount;
+    return ba::buffer(mStorage + index * mBufferSize, mBufferSize);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto BufferRing::CommitRead(std::size_t n) -> ba::const_buffer
+{
+    assert(!Full() && n <= mBufferSize);
+    auto const index = (mHead + mFilled) % mBufferCount;
+    auto const data  = ba::const_buffer(mStorage + index * mBufferSize, n);
+
+    auto& slot = mSlots[index];
+    slot.segments.clear();
+    slot.segments.push_back(data);
+    slot.size = n;
+
+    mBufferedBytes += n;
+    ++mFilled;
+    return data;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto BufferRing::ReadScratch() -> std::string&
+{
+    assert(!Full());
+    auto& scratch = mSlots[(mHead + mFilled) % mBufferCount].scratch;
+    scratch.clear();
+    return scratch;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto BufferRing::CommitRead(std::vector<ba::const_buffer> const& segments) -> void
+{
+    assert(!Full());
+    if (segments.empty()) { return; }
+
+    auto& slot = mSlots[(mHead + mFilled) % mBufferCount];
+    slot.segments.assign(segments.begin(), segments.end());
+    slot.size = ba::buffer_size(segments);
+
+    mBufferedBytes += slot.size;
+    ++mFilled;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto BufferRing::PrepareWrite(ba::const_buffer const& prefix) -> ConstBuffers
+{
+    assert(mWriting == 0 && (!Empty() || ba::buffer_size(prefix) > 0));
+
+    mWriteBuffers.clear();
+    if (ba::buffer_size(prefix) > 0)
+    {
+        mWriteBuffers.push_back(prefix);
+    }
+    for (std::size_t i = 0; i < mFilled; ++i)
+    {
+        auto const& segments = mSlots[(mHead + i) % mBufferCount].segments;
+        mWriteBuffers.insert(mWriteBuffers.end(), segments.begin(), segments.end());
+    }
+    mWriting = mFilled;
+
+    return ConstBuffers(mWriteBuffers.begin(), mWriteBuffers.end());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto BufferRing::CommitWrite() -> void
+{
+    for (std::size_t i = 0; i < mWriting; ++i)
+    {
+        mBufferedBytes -= mSlots[(mHead + i) % mBufferCount].size;
+    }
+
+    mHead     = (mHead + mWriting) % mBufferCount;
+    mFilled  -= mWriting;
+    mWriting  = 0;
+}
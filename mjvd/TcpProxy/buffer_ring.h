@@ -0,0 +1,97 @@
+#ifndef INCLUDED_BUFFER_RING_HEADER
+#define INCLUDED_BUFFER_RING_HEADER
+
+
+#include <vector>
+#include <string>
+#include <boost/noncopyable.hpp>
+#include <boost/asio/buffer.hpp>
+
+#include "block_pool.h"
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// A fixed ring of equally sized buffers for one direction of a session.  Reads fill the buffers
+// in order, and everything that has been filled (but not yet written) is sent with a single
+// gathering write.  This lets us keep reading while earlier writes are still in flight, rather
+// than doing stop-and-wait with a single buffer.  Once every buffer is full, the owner should
+// stop reading until a write completes - that is our backpressure.
+//
+// The buffers themselves come from (and go back to) a BlockPool, so they are recycled from one
+// session to the next.
+//
+// Usage:  at most one read and one write may be outstanding at any one time.
+//
+class BufferRing : private boost::noncopyable
+{
+public:
+    // a lightweight view of the buffers being written.  Cheap to copy, so asio can hold onto it
+    // for the duration of the write without allocating.
+    class ConstBuffers
+    {
+    public:
+        typedef boost::asio::const_buffer                       value_type;
+        typedef std::vector<value_type>::const_iterator         const_iterator;
+
+        ConstBuffers(const_iterator begin, const_iterator end) : mBegin(begin), mEnd(end) {}
+        auto begin() const -> const_iterator { return mBegin; }
+        auto end()   const -> const_iterator { return mEnd; }
+
+    private:
+        const_iterator mBegin;
+        const_iterator mEnd;
+    };
+
+    // 'pool' must outlive the ring
+    BufferRing(BlockPool& pool, std::size_t bufferSize, std::size_t bufferCount);
+    ~BufferRing();
+
+    auto Full()  const -> bool;     // every buffer holds data that has not been written yet
+    auto Empty() const -> bool;     // there is nothing waiting to be written
+    auto BufferedBytes() const -> std::size_t;
+
+    // the next free buffer to read into.  Calling this more than once returns the same buffer,
+    // until CommitRead() is called.  Must not be called when Full().
+    auto PrepareRead() -> boost::asio::mutable_buffers_1;
+
+    // 'n' bytes have been read into the buffer from PrepareRead().  Returns the data that was read.
+    auto CommitRead(std::size_t n) -> boost::asio::const_buffer;
+
+    // when the data is being rewritten:  rather than the bytes that were read, write 'segments'.
+    // These may point into the buffer from PrepareRead(), or into ReadScratch() - both stay valid
+    // until the write completes.  If 'segments' is empty the buffer is not used up.
+    auto ReadScratch() -> std::string&;
+    auto CommitRead(std::vector<boost::asio::const_buffer> const& segments) -> void;
+
+    // all of the filled buffers, after 'prefix' (when it isn't empty).  They stay in use until
+    // CommitWrite() is called.  Must not be called while a write is still outstanding, or when
+    // there is nothing at all to write.
+    auto PrepareWrite(boost::asio::const_buffer const& prefix = boost::asio::const_buffer()) -> ConstBuffers;
+
+    // the buffers from the last PrepareWrite() have been written, and may now be reused
+    auto CommitWrite() -> void;
+
+private:
+    // what gets written for each buffer - normally just the bytes that were read into it
+    struct Slot
+    {
+        std::vector<boost::asio::const_buffer>  segments;
+        std::string                             scratch;
+        std::size_t                             size;
+    };
+
+    std::size_t const               mBufferSize;
+    std::size_t const               mBufferCount;
+    BlockPool&                      mPool;
+    char* const                     mStorage;       // mBufferCount x mBufferSize bytes, from mPool
+    std::vector<Slot>               mSlots;
+    std::vector<boost::asio::const_buffer> mWriteBuffers;
+
+    std::size_t                     mHead;          // the oldest filled buffer
+    std::size_t                     mFilled;        // number of filled buffers (including those being written)
+    std::size_t                     mWriting;       // number of buffers in the outstanding write
+    std::size_t                     mBufferedBytes;
+};
+
+
+#endif  //INCLUDED_BUFFER_RING_HEADER
@@ -0,0 +1,244 @@
+#include "stdafx.h"
+#include "datagram_batch.h"
+#include <cstring>
+#include <stdexcept>
+
+#include <boost/asio.hpp>
+namespace ba = boost::asio;
+
+
+#if defined(__linux__)
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <cerrno>
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+struct DatagramBatch::Native
+{
+    explicit Native(std::size_t capacity) : messages(capacity), iovecs(capacity), addresses(capacity) {}
+
+    std::vector<mmsghdr>            messages;
+    std::vector<iovec>              iovecs;
+    std::vector<sockaddr_storage>   addresses;
+};
+
+namespace
+{
+    auto LastError() -> boost::system::error_code
+    {
+        return boost::system::error_code(errno, boost::system::system_category());
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // sendmmsg() may stop part way through the batch - keep going until everything has been sent,
+    // or the socket won't take any more
+    auto SendAll(int fd, mmsghdr* messages, std::size_t count) -> std::size_t
+    {
+        std::size_t sent = 0;
+        while (sent < count)
+        {
+            auto const n = ::sendmmsg(fd, messages + sent, static_cast<unsigned>(count - sent), MSG_DONTWAIT);
+            if (n < 0)
+            {
+                if (errno == EINTR) { continue; }
+                break;
+            }
+            sent += n;
+        }
+        return sent;
+    }
+}
+
+#else   // !__linux__
+
+struct DatagramBatch::Native
+{
+    explicit Native(std::size_t) {}
+};
+
+#endif  // __linux__
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+DatagramBatch::DatagramBatch(std::size_t capacity)
+    : mCapacity {capacity}
+    , mStorage  (new char[capacity * MAX_DATAGRAM])
+    , mSizes    (capacity)
+    , mFrom     (capacity)
+    , mNative   (new Native(capacity))
+{
+    if (capacity == 0)
+    {
+        throw std::invalid_argument("DatagramBatch:  the capacity must be greater than zero");
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+DatagramBatch::~DatagramBatch()
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto DatagramBatch::Capacity() const -> std::size_t
+{
+    return mCapacity;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto DatagramBatch::Data(std::size_t index) const -> char const*
+{
+    return mStorage.get() + index * MAX_DATAGRAM;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto DatagramBatch::Size(std::size_t index) const -> std::size_t
+{
+    return mSizes[index];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto DatagramBatch::From(std::size_t index) const -> ba::ip::udp::endpoint const&
+{
+    return mFrom[index];
+}
+
+#if defined(__linux__)
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto DatagramBatch::Receive(ba::ip::udp::socket& socket, boost::system::error_code& error) -> std::size_t
+{
+    error = boost::system::error_code();
+
+    auto& native = *mNative;
+    for (std::size_t i = 0; i < mCapacity; ++i)
+    {
+        native.iovecs[i].iov_base = mStorage.get() + i * MAX_DATAGRAM;
+        native.iovecs[i].iov_len  = MAX_DATAGRAM;
+
+        auto& header = native.messages[i].msg_hdr;
+        std::memset(&header, 0, sizeof(header));
+        header.msg_name     = &native.addresses[i];
+        header.msg_namelen  = sizeof(sockaddr_storage);
+        header.msg_iov      = &native.iovecs[i];
+        header.msg_iovlen   = 1;
+    }
+
+    int received;
+    do
+    {
+        received = ::recvmmsg(socket.native_handle(), native.messages.data(), static_cast<unsigned>(mCapacity), MSG_DONTWAIT, nullptr);
+    }
+    while (received < 0 && errno == EINTR);
+
+    if (received < 0)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            error = LastError();
+        }
+        return 0;
+    }
+
+    for (int i = 0; i < received; ++i)
+    {
+        mSizes[i] = native.messages[i].msg_len;
+
+        auto& from = mFrom[i];
+        std::memcpy(from.data(), &native.addresses[i], native.messages[i].msg_hdr.msg_namelen);
+        from.resize(native.messages[i].msg_hdr.msg_namelen);
+    }
+    return received;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto DatagramBatch::Send(ba::ip::udp::socket& socket, std::size_t const* indices, std::size_t count) -> std::size_t
+{
+    auto& native = *mNative;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        native.iovecs[i].iov_base = mStorage.get() + indices[i] * MAX_DATAGRAM;
+        native.iovecs[i].iov_len  = mSizes[indices[i]];
+
+        auto& header = native.messages[i].msg_hdr;
+        std::memset(&header, 0, sizeof(header));
+        header.msg_iov      = &native.iovecs[i];
+        header.msg_iovlen   = 1;
+    }
+
+    return SendAll(socket.native_handle(), native.messages.data(), count);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto DatagramBatch::SendTo(ba::ip::udp::socket& socket, std::size_t count, ba::ip::udp::endpoint const& to) -> std::size_t
+{
+    auto& native = *mNative;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        native.iovecs[i].iov_base = mStorage.get() + i * MAX_DATAGRAM;
+        native.iovecs[i].iov_len  = mSizes[i];
+
+        auto& header = native.messages[i].msg_hdr;
+        std::memset(&header, 0, sizeof(header));
+        header.msg_name     = const_cast<sockaddr*>(to.data());
+        header.msg_namelen  = static_cast<socklen_t>(to.size());
+        header.msg_iov      = &native.iovecs[i];
+        header.msg_iovlen   = 1;
+    }
+
+    return SendAll(socket.native_handle(), native.messages.data(), count);
+}
+
+#else   // !__linux__
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto DatagramBatch::Receive(ba::ip::udp::socket& socket, boost::system::error_code& error) -> std::size_t
+{
+    error = boost::system::error_code();
+
+    std::size_t received = 0;
+    while (received < mCapacity)
+    {
+        boost::system::error_code ec;
+        auto const n = socket.receive_from(ba::buffer(mStorage.get() + received * MAX_DATAGRAM, MAX_DATAGRAM), mFrom[received], 0, ec);
+        if (ec)
+        {
+            if (ec != ba::error::would_block && received == 0)
+            {
+                error = ec;
+            }
+            break;
+        }
+        mSizes[received++] = n;
+    }
+    return received;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto DatagramBatch::Send(ba::ip::udp::socket& socket, std::size_t const* indices, std::size_t count) -> std::size_t
+{
+    std::size_t sent = 0;
+    for (; sent < count; ++sent)
+    {
+        boost::system::error_code ec;
+        socket.send(ba::buffer(Data(indices[sent]), mSizes[indices[sent]]), 0, ec);
+        if (ec) { break; }
+    }
+    return sent;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto DatagramBatch::SendTo(ba::ip::udp::socket& socket, std::size_t count, ba::ip::udp::endpoint const& to) -> std::size_t
+{
+    std::size_t sent = 0;
+    for (; sent < count; ++sent)
+    {
+        boost::system::error_code ec;
+        socket.send_to(ba::buffer(Data(sent), mSizes[sent]), to, 0, ec);
+        if (ec) { break; }
+    }
+    return sent;
+}
+
+#endif  // __linux__
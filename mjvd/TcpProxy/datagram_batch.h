@@ -0,0 +1,56 @@
+#ifndef INCLUDED_DATAGRAM_BATCH_HEADER
+#define INCLUDED_DATAGRAM_BATCH_HEADER
+
+
+#include <memory>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/asio/ip/udp.hpp>
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// A batch of datagrams, moved to and from UDP sockets with as few system calls as possible.  On
+// Linux each batch is a single recvmmsg(2) or sendmmsg(2), so small datagrams aren't limited to
+// one system call each.  Elsewhere it falls back to one non-blocking call per datagram.
+//
+// The sockets must be non-blocking, and nothing ever waits:  a receive takes whatever is already
+// queued, and a send stops (dropping the rest, as UDP may) once the socket's buffer is full.
+//
+class DatagramBatch : private boost::noncopyable
+{
+public:
+    // large enough for any UDP datagram
+    static std::size_t const MAX_DATAGRAM = 65536;
+
+    explicit DatagramBatch(std::size_t capacity);
+    ~DatagramBatch();
+
+    auto Capacity() const -> std::size_t;
+
+    // receive up to Capacity() of the datagrams that are waiting, into the batch.  Returns how
+    // many there were.  An error (other than there being nothing to receive) is only reported
+    // when nothing was received.
+    auto Receive(boost::asio::ip::udp::socket& socket, boost::system::error_code& error) -> std::size_t;
+
+    // the datagrams from the last Receive()
+    auto Data(std::size_t index) const -> char const*;
+    auto Size(std::size_t index) const -> std::size_t;
+    auto From(std::size_t index) const -> boost::asio::ip::udp::endpoint const&;
+
+    // send the datagrams at 'indices' on the connected 'socket', or the first 'count' datagrams to
+    // 'to'.  Each returns how many were sent.
+    auto Send  (boost::asio::ip::udp::socket& socket, std::size_t const* indices, std::size_t count) -> std::size_t;
+    auto SendTo(boost::asio::ip::udp::socket& socket, std::size_t count, boost::asio::ip::udp::endpoint const& to) -> std::size_t;
+
+private:
+    struct Native;      // the system call's own arrays, where it has any
+
+    std::size_t const                           mCapacity;
+    std::unique_ptr<char[]>                     mStorage;   // mCapacity x MAX_DATAGRAM bytes
+    std::vector<std::size_t>                    mSizes;
+    std::vector<boost::asio::ip::udp::endpoint> mFrom;
+    std::unique_ptr<Native>                     mNative;
+};
+
+
+#endif  //INCLUDED_DATAGRAM_BATCH_HEADER
@@ -0,0 +1,234 @@
+#include "stdafx.h"
+#include "dns_cache.h"
+#include "utils.h"
+#include <iostream>
+
+#include <boost/asio.hpp>
+namespace ba = boost::asio;
+
+
+namespace
+{
+    // how often the cache looks for names to refresh (or forget)
+    auto const SWEEP_INTERVAL = std::chrono::seconds(1);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+DnsCache::DnsCache(ba::io_service& io_service, ProxyParameters const& params)
+    : mIoService    (io_service)
+    , mTtl          {params.dns_ttl_s}
+    , mNegativeTtl  {params.dns_negative_ttl_s}
+    , mStale        {params.dns_stale_s}
+    , mResolver     {io_service}
+    , mSweepTimer   {io_service}
+    , mStopped      {false}
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto DnsCache::Start() -> void
+{
+    mIoService.post(std::bind(&DnsCache::HandleStart, shared_from_this()));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto DnsCache::Stop() -> void
+{
+    mIoService.post(std::bind(&DnsCache::HandleStop, shared_from_this()));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto DnsCache::HandleStart() -> void
+{
+    StartSweep();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Cancelling the resolver completes every outstanding resolve (with operation_aborted), which
+// passes the error on to anyone still waiting
+//
+auto DnsCache::HandleStop() -> void
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopped = true;
+    }
+
+    boost::system::error_code ignored;
+    mResolver.cancel();
+    mSweepTimer.cancel(ignored);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto DnsCache::Lookup(Entry const& entry, Clock::time_point now, boost::system::error_code& error, ba::ip::tcp::resolver::iterator& iterator) const -> bool
+{
+    // a good answer, even if it is stale
+    if (entry.endpoints != ba::ip::tcp::resolver::iterator() && now < entry.staleUntil)
+    {
+        error    = boost::system::error_code();
+        iterator = entry.endpoints;
+        return true;
+    }
+
+    // a recent failure
+    if (entry.error && now < entry.expires)
+    {
+        error    = entry.error;
+        iterator = ba::ip::tcp::resolver::iterator();
+        return true;
+    }
+
+    return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto DnsCache::Resolve(std::string const& host, std::string const& port, ba::io_service& io_service, Handler handler) -> void
+{
+    boost::system::error_code           error;
+    ba::ip::tcp::resolver::iterator     iterator;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        if (mStopped)
+        {
+            error = ba::error::operation_aborted;
+        }
+        else
+        {
+            auto const key = std::make_pair(host, port);
+            auto const now = Clock::now();
+            auto&      entry = mEntries[key];
+            entry.lastUsed = now;
+
+            // expired (or never resolved):  resolve again, whether or not we have something to
+            // hand out in the meantime
+            if (now >= entry.expires && !entry.resolving)
+            {
+                entry.resolving = true;
+                mIoService.post(std::bind(&DnsCache::StartResolve, shared_from_this(), key));
+            }
+
+            if (!Lookup(entry, now, error, iterator))
+            {
+                Waiter waiter = {&io_service, handler};
+                entry.waiters.push_back(waiter);
+                return;
+            }
+        }
+    }
+
+    io_service.post(std::bind(handler, error, iterator));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Called on mIoService, once the entry has been marked as resolving (which stops the sweep from
+// erasing it)
+//
+auto DnsCache::StartResolve(Key const& key) -> void
+{
+    if (mStopped)
+    {
+        HandleResolve(key, ba::error::operation_aborted, ba::ip::tcp::resolver::iterator());
+        return;
+    }
+
+    ba::ip::tcp::resolver::query query(key.first, key.second);
+    mResolver.async_resolve(
+        query,
+        std::bind(&DnsCache::HandleResolve, shared_from_this(), key, std::placeholders::_1, std::placeholders::_2));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto DnsCache::HandleResolve(Key const& key, boost::system::error_code const& error, ba::ip::tcp::resolver::iterator iterator) -> void
+{
+    std::vector<Waiter>             waiters;
+    boost::system::error_code       result;
+    ba::ip::tcp::resolver::iterator endpoints;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        auto  found = mEntries.find(key);
+        if (found == mEntries.end()) { return; }
+        auto& entry = found->second;
+        auto const now = Clock::now();
+
+        entry.resolving = false;
+        entry.resolved  = now;
+
+        if (!error)
+        {
+            entry.endpoints  = iterator;
+            entry.error      = boost::system::error_code();
+            entry.expires    = now + mTtl;
+            entry.staleUntil = entry.expires + mStale;
+        }
+        else if (error != ba::error::operation_aborted)
+        {
+            // keep any old answer (until it is too stale to use), and don't ask again for a while
+            auto const stale = entry.endpoints != ba::ip::tcp::resolver::iterator() && now < entry.staleUntil;
+            std::cout << TimeStamp() << "WARNING:  failed to resolve [" << key.first << "]:" << key.second << ":  " << error.message() << (stale ? " (using the previous answer)" : "") << std::endl;
+
+            entry.error   = error;
+            entry.expires = now + mNegativeTtl;
+        }
+
+        // anyone waiting had nothing to use, so a cancelled resolve fails them
+        if (!Lookup(entry, now, result, endpoints))
+        {
+            result    = error;
+            endpoints = ba::ip::tcp::resolver::iterator();
+        }
+        waiters.swap(entry.waiters);
+    }
+
+    for (auto& waiter : waiters)
+    {
+        waiter.io_service->post(std::bind(waiter.handler, result, endpoints));
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto DnsCache::StartSweep() -> void
+{
+    mSweepTimer.expires_from_now(SWEEP_INTERVAL);
+    mSweepTimer.async_wait(std::bind(&DnsCache::HandleSweep, shared_from_this(), std::placeholders::_1));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Refresh the names that have been used since they were last resolved, as they expire - so that
+// a busy destination is always fresh.  Forget the names that nobody has asked for in a while.
+//
+auto DnsCache::HandleSweep(boost::system::error_code const& error) -> void
+{
+    if (error || mStopped) { return; }
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto const now = Clock::now();
+
+        for (auto it = mEntries.begin(); it != mEntries.end(); )
+        {
+            auto& entry = it->second;
+            if (entry.resolving)
+            {
+                ++it;
+            }
+            else if (now - entry.lastUsed > mTtl + mStale)
+            {
+                it = mEntries.erase(it);
+            }
+            else
+            {
+                if (now >= entry.expires && entry.lastUsed >= entry.resolved)
+                {
+                    entry.resolving = true;
+                    StartResolve(it->first);
+                }
+                ++it;
+            }
+        }
+    }
+
+    StartSweep();
+}
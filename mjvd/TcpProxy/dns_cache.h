@@ -0,0 +1,101 @@
+#ifndef INCLUDED_DNS_CACHE_HEADER
+#define INCLUDED_DNS_CACHE_HEADER
+
+
+#include <map>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <string>
+#include <chrono>
+#include <utility>
+#include <functional>
+#include <boost/noncopyable.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include "proxy.h"
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Resolves the destinations once, and shares the answers between every session (and upstream
+// pool) on every worker thread - so that setting up a connection doesn't wait for a resolve.
+//
+//  - an answer is used for 'dns_ttl_s' seconds.  getaddrinfo() doesn't tell us the record's own
+//    TTL, so it is a setting.
+//  - once it has expired, the old answer is still handed out (for up to 'dns_stale_s' seconds)
+//    while it is resolved again in the background, so a slow or failing DNS server doesn't hold
+//    up new sessions to a destination that we already know.
+//  - names that are in use are refreshed in the background as they expire, before anyone asks.
+//  - a failure (with no old answer to fall back on) is remembered for 'dns_negative_ttl_s'
+//    seconds, so we don't send the DNS server a query for every new session.
+//  - requests for a name that is already being resolved wait for that one query.
+//
+// The resolves themselves run on the io_service passed to the constructor.
+//
+class DnsCache : public std::enable_shared_from_this<DnsCache>, private boost::noncopyable
+{
+public:
+    typedef std::function<void(boost::system::error_code const& error, boost::asio::ip::tcp::resolver::iterator iterator)> Handler;
+
+    DnsCache(boost::asio::io_service& io_service, ProxyParameters const& params);
+
+    // may be called from any thread
+    auto Start() -> void;
+    auto Stop()  -> void;
+
+    // may be called from any thread.  'handler' is always posted to 'io_service' (it is never
+    // called from inside Resolve()).
+    auto Resolve(std::string const& host, std::string const& port, boost::asio::io_service& io_service, Handler handler) -> void;
+
+private:
+    typedef std::chrono::steady_clock           Clock;
+    typedef std::pair<std::string, std::string> Key;
+
+    struct Waiter
+    {
+        boost::asio::io_service*    io_service;
+        Handler                     handler;
+    };
+
+    struct Entry
+    {
+        Entry() : resolving(false) {}
+
+        boost::asio::ip::tcp::resolver::iterator endpoints;     // the last good answer (if any)
+        boost::system::error_code   error;          // the last failure, if the last resolve failed
+        Clock::time_point           expires;        // when to resolve again
+        Clock::time_point           staleUntil;     // when 'endpoints' may no longer be used
+        Clock::time_point           resolved;       // when the last resolve finished
+        Clock::time_point           lastUsed;
+        bool                        resolving;
+        std::vector<Waiter>         waiters;        // waiting for the resolve, with nothing to use
+    };
+
+    auto HandleStart() -> void;
+    auto HandleStop()  -> void;
+    auto StartResolve(Key const& key) -> void;
+    auto HandleResolve(Key const& key, boost::system::error_code const& error, boost::asio::ip::tcp::resolver::iterator iterator) -> void;
+    auto StartSweep() -> void;
+    auto HandleSweep(boost::system::error_code const& error) -> void;
+
+    // the answer to hand out from 'entry' right now.  False if the caller must wait.
+    auto Lookup(Entry const& entry, Clock::time_point now, boost::system::error_code& error, boost::asio::ip::tcp::resolver::iterator& iterator) const -> bool;
+
+private:
+    boost::asio::io_service&        mIoService;
+    std::chrono::seconds const      mTtl;
+    std::chrono::seconds const      mNegativeTtl;
+    std::chrono::seconds const      mStale;
+    boost::asio::ip::tcp::resolver  mResolver;      // only used on mIoService
+    boost::asio::steady_timer       mSweepTimer;
+
+    // Resolve() is called from every worker thread
+    std::mutex                      mMutex;
+    std::map<Key, Entry>            mEntries;
+    bool                            mStopped;
+};
+
+
+#endif  //INCLUDED_DNS_CACHE_HEADER
@@ -0,0 +1,93 @@
+#ifndef INCLUDED_HANDLER_ALLOCATOR_HEADER
+#define INCLUDED_HANDLER_ALLOCATOR_HEADER
+
+
+#include <cstddef>
+#include <utility>
+#include <type_traits>
+#include <boost/noncopyable.hpp>
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Memory for one outstanding asynchronous operation.  asio allocates a block for every
+// operation that it starts (big enough to hold the handler), and frees it again before the
+// handler is called - so a chain of operations that starts the next one from each handler (like
+// a relay's reads, or its writes) can use the same block over and over, and never touch the heap.
+//
+// Anything that doesn't fit (or a second operation while the first is still outstanding) falls
+// back to the heap.
+//
+class HandlerMemory : private boost::noncopyable
+{
+public:
+    HandlerMemory() : mInUse(false) {}
+
+    auto Allocate(std::size_t size) -> void*
+    {
+        if (!mInUse && size <= sizeof(mStorage))
+        {
+            mInUse = true;
+            return &mStorage;
+        }
+        return ::operator new(size);
+    }
+
+    auto Deallocate(void* pointer) -> void
+    {
+        if (pointer == &mStorage)
+        {
+            mInUse = false;
+        }
+        else
+        {
+            ::operator delete(pointer);
+        }
+    }
+
+private:
+    std::aligned_storage<512>::type mStorage;
+    bool                            mInUse;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Wraps a completion handler so that asio allocates its operation from 'memory' (via asio's
+// allocation hooks, which it finds by argument dependent lookup).
+//
+template <typename Handler>
+class CustomAllocHandler
+{
+public:
+    CustomAllocHandler(HandlerMemory& memory, Handler handler) : mMemory(memory), mHandler(std::move(handler)) {}
+
+    template <typename... Args>
+    auto operator()(Args&&... args) -> void
+    {
+        mHandler(std::forward<Args>(args)...);
+    }
+
+    friend auto asio_handler_allocate(std::size_t size, CustomAllocHandler<Handler>* handler) -> void*
+    {
+        return handler->mMemory.Allocate(size);
+    }
+
+    friend auto asio_handler_deallocate(void* pointer, std::size_t /*size*/, CustomAllocHandler<Handler>* handler) -> void
+    {
+        handler->mMemory.Deallocate(pointer);
+    }
+
+private:
+    HandlerMemory&  mMemory;
+    Handler         mHandler;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename Handler>
+auto MakeCustomAllocHandler(HandlerMemory& memory, Handler handler) -> CustomAllocHandler<Handler>
+{
+    return CustomAllocHandler<Handler>(memory, std::move(handler));
+}
+
+
+#endif  //INCLUDED_HANDLER_ALLOCATOR_HEADER
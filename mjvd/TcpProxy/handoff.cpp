@@ -0,0 +1,337 @@
+#include "stdafx.h"
+#include "handoff.h"
+#include "utils.h"
+#include <iostream>
+#include <stdexcept>
+
+#include <boost/asio.hpp>
+namespace ba = boost::asio;
+
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+
+namespace
+{
+    // the most listening sockets that can be handed over (one per worker thread)
+    std::size_t const MAX_LISTENERS = 256;
+
+    auto LastError() -> boost::system::error_code
+    {
+        return boost::system::error_code(errno, boost::system::system_category());
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+struct HandoffServer::Impl : public std::enable_shared_from_this<Impl>
+{
+    Impl(ba::io_service& io_service, std::string const& path, std::vector<NativeHandle> const& listeners, HandedOffHandler onHandedOff)
+        : path          (path)
+        , listeners     (listeners)
+        , onHandedOff   (onHandedOff)
+        , acceptor      {io_service}
+        , socket        {io_service}
+        , ack           {0}
+        , handedOff     {false}
+        , stopped       {false}
+    {
+    }
+
+    auto StartAccept() -> void;
+    auto HandleAccept(boost::system::error_code const& error) -> void;
+    auto HandleAck   (boost::system::error_code const& error) -> void;
+    auto Send() -> boost::system::error_code;
+
+    std::string const                       path;
+    std::vector<NativeHandle> const         listeners;
+    HandedOffHandler const                  onHandedOff;
+    ba::local::stream_protocol::acceptor    acceptor;
+    ba::local::stream_protocol::socket      socket;     // the new process
+    char                                    ack;
+    bool                                    handedOff;
+    bool                                    stopped;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto HandoffServer::Impl::StartAccept() -> void
+{
+    if (stopped) { return; }
+
+    boost::system::error_code ignored;
+    socket.close(ignored);
+    acceptor.async_accept(socket, std::bind(&Impl::HandleAccept, shared_from_this(), std::placeholders::_1));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// A new process has connected:  send it the listening sockets, and wait for it to start using them
+//
+auto HandoffServer::Impl::HandleAccept(boost::system::error_code const& error) -> void
+{
+    if (stopped || error == ba::error::operation_aborted) { return; }
+
+    if (error)
+    {
+        std::cout << TimeStamp() << "WARNING:  HandoffServer::HandleAccept():  failed:  " << error.message() << std::endl;
+        StartAccept();
+        return;
+    }
+
+    std::cout << TimeStamp() << "a new process has connected at " << path << ", handing over " << listeners.size() << " listening socket(s)" << std::endl;
+    auto const sendError = Send();
+    if (sendError)
+    {
+        std::cout << TimeStamp() << "WARNING:  failed to hand over the listening sockets:  " << sendError.message() << std::endl;
+        StartAccept();
+        return;
+    }
+
+    ba::async_read(socket, ba::buffer(&ack, 1), std::bind(&Impl::HandleAck, shared_from_this(), std::placeholders::_1));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// One byte of data per socket, with the sockets themselves as the ancillary data.  The message is
+// tiny, so the send never blocks.
+//
+auto HandoffServer::Impl::Send() -> boost::system::error_code
+{
+    std::vector<char> data(listeners.size(), 'L');
+    std::vector<char> control(CMSG_SPACE(sizeof(NativeHandle) * listeners.size()));
+
+    iovec iov;
+    iov.iov_base = data.data();
+    iov.iov_len  = data.size();
+
+    msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov         = &iov;
+    msg.msg_iovlen      = 1;
+    msg.msg_control     = control.data();
+    msg.msg_controllen  = control.size();
+
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(NativeHandle) * listeners.size());
+    std::memcpy(CMSG_DATA(cmsg), listeners.data(), sizeof(NativeHandle) * listeners.size());
+
+    if (::sendmsg(socket.native_handle(), &msg, MSG_NOSIGNAL) < 0)
+    {
+        return LastError();
+    }
+    return boost::system::error_code();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto HandoffServer::Impl::HandleAck(boost::system::error_code const& error) -> void
+{
+    if (stopped) { return; }
+
+    if (error)
+    {
+        std::cout << TimeStamp() << "WARNING:  the new process went away without taking over the listening sockets:  " << error.message() << std::endl;
+        StartAccept();
+        return;
+    }
+
+    // the new process owns 'path' now
+    std::cout << TimeStamp() << "the new process has taken over the listening socket(s)" << std::endl;
+    handedOff = true;
+    stopped   = true;
+
+    boost::system::error_code ignored;
+    socket.close(ignored);
+    acceptor.close(ignored);
+
+    onHandedOff();
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+HandoffServer::HandoffServer(ba::io_service& io_service, std::string const& path, std::vector<NativeHandle> const& listeners, HandedOffHandler onHandedOff)
+    : mImpl(std::make_shared<Impl>(io_service, path, listeners, onHandedOff))
+{
+    if (listeners.size() > MAX_LISTENERS)
+    {
+        throw std::runtime_error("too many listening sockets to hand over");
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+HandoffServer::~HandoffServer()
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto HandoffServer::Start() -> void
+{
+    ::unlink(mImpl->path.c_str());
+
+    ba::local::stream_protocol::endpoint const endpoint(mImpl->path);
+    mImpl->acceptor.open(endpoint.protocol());
+    mImpl->acceptor.bind(endpoint);
+    mImpl->acceptor.listen();
+
+    std::cout << TimeStamp() << "waiting for a new process to take over the listening socket(s) at " << mImpl->path << std::endl;
+    mImpl->StartAccept();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto HandoffServer::Stop() -> void
+{
+    if (!mImpl->handedOff && mImpl->acceptor.is_open())
+    {
+        ::unlink(mImpl->path.c_str());
+    }
+    mImpl->stopped = true;
+
+    boost::system::error_code ignored;
+    mImpl->socket.close(ignored);
+    mImpl->acceptor.close(ignored);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+HandoffReceiver::HandoffReceiver()
+    : mSocket   {-1}
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+HandoffReceiver::~HandoffReceiver()
+{
+    if (mSocket != -1)
+    {
+        ::close(mSocket);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto HandoffReceiver::Receive(std::string const& path) -> bool
+{
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    if (path.size() >= sizeof(addr.sun_path))
+    {
+        throw std::runtime_error("the handoff path is too long:  " + path);
+    }
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+
+    mSocket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (mSocket == -1)
+    {
+        throw boost::system::system_error(LastError(), "socket");
+    }
+
+    // nobody there - we are the first process
+    if (::connect(mSocket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1)
+    {
+        ::close(mSocket);
+        mSocket = -1;
+        return false;
+    }
+
+    char data[MAX_LISTENERS];
+    std::vector<char> control(CMSG_SPACE(sizeof(NativeHandle) * MAX_LISTENERS));
+
+    iovec iov;
+    iov.iov_base = data;
+    iov.iov_len  = sizeof(data);
+
+    msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov         = &iov;
+    msg.msg_iovlen      = 1;
+    msg.msg_control     = control.data();
+    msg.msg_controllen  = control.size();
+
+    ssize_t received;
+    do
+    {
+        received = ::recvmsg(mSocket, &msg, 0);
+    }
+    while (received == -1 && errno == EINTR);
+
+    if (received == -1)
+    {
+        throw boost::system::system_error(LastError(), "recvmsg");
+    }
+
+    for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            auto const count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(NativeHandle);
+            auto const fds   = reinterpret_cast<NativeHandle const*>(CMSG_DATA(cmsg));
+            mListeners.insert(mListeners.end(), fds, fds + count);
+        }
+    }
+    return !mListeners.empty();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto HandoffReceiver::Acknowledge() -> void
+{
+    if (mSocket == -1) { return; }
+
+    char const ack = 'A';
+    if (::send(mSocket, &ack, 1, MSG_NOSIGNAL) != 1)
+    {
+        std::cout << TimeStamp() << "WARNING:  failed to acknowledge the handoff:  " << LastError().message() << std::endl;
+    }
+    ::close(mSocket);
+    mSocket = -1;
+}
+
+
+#else   // !BOOST_ASIO_HAS_LOCAL_SOCKETS
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+struct HandoffServer::Impl
+{
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+HandoffServer::HandoffServer(ba::io_service&, std::string const&, std::vector<NativeHandle> const&, HandedOffHandler)
+{
+    throw std::runtime_error("hot restart is not supported on this platform");
+}
+
+HandoffServer::~HandoffServer()         {}
+auto HandoffServer::Start() -> void     {}
+auto HandoffServer::Stop() -> void      {}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+HandoffReceiver::HandoffReceiver()
+    : mSocket   {-1}
+{
+}
+
+HandoffReceiver::~HandoffReceiver()     {}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto HandoffReceiver::Receive(std::string const&) -> bool
+{
+    throw std::runtime_error("hot restart is not supported on this platform");
+}
+
+auto HandoffReceiver::Acknowledge() -> void {}
+
+
+#endif  // BOOST_ASIO_HAS_LOCAL_SOCKETS
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto HandoffReceiver::Listeners() const -> std::vector<NativeHandle> const&
+{
+    return mListeners;
+}
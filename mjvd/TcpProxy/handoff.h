@@ -0,0 +1,76 @@
+#ifndef INCLUDED_HANDOFF_HEADER
+#define INCLUDED_HANDOFF_HEADER
+
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include <boost/noncopyable.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Hot restart:  a running proxy hands its listening sockets over to its replacement, through a
+// Unix domain socket (with SCM_RIGHTS), so there is never a moment where nobody is listening.
+// Connections that arrive during the handoff wait in the listen queue, which both processes share.
+//
+//  - the new process connects to the old one's HandoffServer, and is sent the listening sockets
+//  - once it is accepting on them, it sends an acknowledgement (a single byte)
+//  - the old process stops accepting, and drains its sessions
+//
+// If the new process goes away without acknowledging, the old one carries on as if nothing had
+// happened.  POSIX only - elsewhere, everything throws.
+//
+class HandoffServer : private boost::noncopyable
+{
+public:
+    typedef boost::asio::ip::tcp::acceptor::native_handle_type NativeHandle;
+
+    // called (on 'io_service', at most once) when the new process has taken the sockets over
+    typedef std::function<void()> HandedOffHandler;
+
+    // 'listeners' are the listening sockets to hand over.  They are only ever duplicated (never
+    // used) by the server.
+    HandoffServer(boost::asio::io_service& io_service, std::string const& path, std::vector<NativeHandle> const& listeners, HandedOffHandler onHandedOff);
+    ~HandoffServer();
+
+    // listen at 'path' (replacing whatever is there - the previous process has finished with it)
+    auto Start() -> void;
+
+    // stop listening, and remove 'path' unless the new process is now using it
+    auto Stop() -> void;
+
+private:
+    struct Impl;
+    std::shared_ptr<Impl> mImpl;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The new process's side of the handoff
+//
+class HandoffReceiver : private boost::noncopyable
+{
+public:
+    typedef HandoffServer::NativeHandle NativeHandle;
+
+    HandoffReceiver();
+    ~HandoffReceiver();
+
+    // take the listening sockets from the process at 'path'.  Returns false if there is no process
+    // there (or it isn't handing over).  The sockets are then owned by the caller.
+    auto Receive(std::string const& path) -> bool;
+    auto Listeners() const -> std::vector<NativeHandle> const&;
+
+    // we are accepting on the sockets, so the old process can stop
+    auto Acknowledge() -> void;
+
+private:
+    NativeHandle                mSocket;
+    std::vector<NativeHandle>   mListeners;
+};
+
+
+#endif  //INCLUDED_HANDOFF_HEADER
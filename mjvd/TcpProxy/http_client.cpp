@@ -0,0 +1,710 @@
+#include "stdafx.h"
+#include "http_client.h"
+#include "utils.h"
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <cstdlib>
+#include <vector>
+#include <chrono>
+#include <cctype>
+#include <algorithm>
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+namespace ba = boost::asio;
+
+typedef std::chrono::steady_clock Clock;
+
+
+namespace
+{
+    // how long to wait before reconnecting after a connection has failed
+    auto const RECONNECT_DELAY = std::chrono::milliseconds(100);
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // A fixed-size histogram of latencies (in micro-seconds), so that a long run doesn't keep every
+    // one of them.  The buckets are log-linear:  each power of 2 is split into SUB_BUCKETS equal
+    // buckets, so a percentile is within 1/SUB_BUCKETS (~3%) of the true value - and exact below
+    // 2 x SUB_BUCKETS.  Anything over 2^32us (over an hour) is counted in the last bucket, which
+    // reports the largest.
+    //
+    class LatencyHistogram
+    {
+    public:
+        LatencyHistogram() : mCounts(BUCKETS, 0), mCount(0), mMax(0) {}
+
+        auto Record(unsigned long long us) -> void
+        {
+            ++mCounts[Index(us)];
+            ++mCount;
+            mMax = std::max(mMax, us);
+        }
+
+        auto Reset() -> void
+        {
+            std::fill(mCounts.begin(), mCounts.end(), 0);
+            mCount = 0;
+            mMax   = 0;
+        }
+
+        auto Count() const -> unsigned long long { return mCount; }
+        auto Max()   const -> unsigned long long { return mMax; }
+
+        // the latency below which 'percentile' of them fall - the highest in its bucket
+        auto Percentile(double percentile) const -> unsigned long long
+        {
+            if (mCount == 0) { return 0; }
+
+            auto const rank = std::min(mCount, static_cast<unsigned long long>(percentile / 100.0 * mCount) + 1);
+            unsigned long long seen = 0;
+            for (std::size_t i = 0; i < BUCKETS; ++i)
+            {
+                seen += mCounts[i];
+                if (seen >= rank) { return i == BUCKETS - 1 ? mMax : std::min(Highest(i), mMax); }
+            }
+            return mMax;
+        }
+
+    private:
+        static unsigned const       SUB_BITS    = 5;
+        static std::size_t const    SUB_BUCKETS = std::size_t(1) << SUB_BITS;
+        static unsigned const       MAX_BITS    = 32;
+        static std::size_t const    BUCKETS     = (MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS;
+
+        // below 2 x SUB_BUCKETS, each value has its own bucket.  Above that, the top SUB_BITS + 1
+        // bits of the value pick the bucket within its power of 2.
+        static auto Index(unsigned long long us) -> std::size_t
+        {
+            if (us >= (1ull << MAX_BITS)) { return BUCKETS - 1; }
+            if (us < 2 * SUB_BUCKETS)     { return static_cast<std::size_t>(us); }
+
+            unsigned shift = 0;
+            while ((us >> shift) >= 2 * SUB_BUCKETS) { ++shift; }
+            return shift * SUB_BUCKETS + static_cast<std::size_t>(us >> shift);
+        }
+
+        static auto Highest(std::size_t index) -> unsigned long long
+        {
+            if (index < 2 * SUB_BUCKETS) { return index; }
+
+            auto const shift = static_cast<unsigned>(index / SUB_BUCKETS - 1);
+            auto const top   = static_cast<unsigned long long>(index % SUB_BUCKETS + SUB_BUCKETS);
+            return ((top + 1) << shift) - 1;
+        }
+
+        std::vector<unsigned long long>     mCounts;
+        unsigned long long                  mCount;
+        unsigned long long                  mMax;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // shared by all of the connections - which all run on the same thread
+    struct Stats
+    {
+        LatencyHistogram            latencies;              // every response
+        LatencyHistogram            interval_latencies;     // the responses since the last report
+        unsigned long long          bytes = 0;              // response bytes received
+        unsigned long long          errors = 0;
+        unsigned long long          reported_bytes = 0;
+        unsigned long long          reported_errors = 0;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto FormatLatency(unsigned long long us) -> std::string
+    {
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(3) << us / 1000.0 << "ms";
+        return oss.str();
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto IStartsWith(std::string const& s, std::size_t pos, char const* prefix) -> bool
+    {
+        for (; *prefix != '\0'; ++pos, ++prefix)
+        {
+            if (pos >= s.size() || std::tolower(static_cast<unsigned char>(s[pos])) != std::tolower(static_cast<unsigned char>(*prefix))) { return false; }
+        }
+        return true;
+    }
+
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // One keep-alive connection, which sends a request, reads the whole response, and then sends
+    // the next request (at the next scheduled time, if there is a target rate).  Reconnects
+    // whenever the server closes the connection.
+    //
+    class Connection : public std::enable_shared_from_this<Connection>, private boost::noncopyable
+    {
+    public:
+        Connection(ba::io_service& io_service, ba::ip::tcp::resolver::iterator endpoints, std::string const& request, Clock::duration interval, std::shared_ptr<Stats> const& stats);
+
+        auto Start() -> void;
+        auto Stop()  -> void;
+
+    private:
+        // where we are up to in the response
+        enum class State { Head, Body, ChunkSize, ChunkData, Trailers, UntilClose };
+
+        auto Connect() -> void;
+        auto Reconnect() -> void;
+        auto ScheduleRequest() -> void;
+        auto SendRequest() -> void;
+        auto ReadMore() -> void;
+        auto Continue() -> void;
+        auto ParseHead(std::string const& head) -> bool;
+        auto Complete() -> void;
+        auto Fail(char const* what, boost::system::error_code const& error) -> void;
+
+        auto HandleConnect(boost::system::error_code const& error) -> void;
+        auto HandleWrite  (boost::system::error_code const& error) -> void;
+        auto HandleRead   (boost::system::error_code const& error, std::size_t bytes_transferred) -> void;
+
+    private:
+        ba::ip::tcp::resolver::iterator const   mEndpoints;
+        std::string const                       mRequest;
+        Clock::duration const                   mInterval;          // zero when there's no target rate
+        std::shared_ptr<Stats> const            mStats;
+
+        ba::ip::tcp::socket                     mSocket;
+        ba::steady_timer                        mTimer;
+        ba::streambuf                           mResponse;
+
+        State                                   mState;
+        unsigned long long                      mRemaining;         // in the body or the current chunk
+        bool                                    mKeepAlive;
+        Clock::time_point                       mNextSend;
+        Clock::time_point                       mStart;             // when the current request was due
+        bool                                    mStopped;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    Connection::Connection(ba::io_service& io_service, ba::ip::tcp::resolver::iterator endpoints, std::string const& request, Clock::duration interval, std::shared_ptr<Stats> const& stats)
+        : mEndpoints{endpoints}
+        , mRequest  (request)
+        , mInterval {interval}
+        , mStats    (stats)
+        , mSocket   {io_service}
+        , mTimer    {io_service}
+        , mState    {State::Head}
+        , mRemaining{0}
+        , mKeepAlive{true}
+        , mStopped  {false}
+    {
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto Connection::Start() -> void
+    {
+        mNextSend = Clock::now();
+        Connect();
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto Connection::Stop() -> void
+    {
+        mStopped = true;
+
+        boost::system::error_code ignored;
+        mTimer.cancel(ignored);
+        mSocket.close(ignored);
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto Connection::Connect() -> void
+    {
+        if (mStopped) { return; }
+
+        mResponse.consume(mResponse.size());
+        ba::async_connect(
+            mSocket,
+            mEndpoints,
+            std::bind(&Connection::HandleConnect, shared_from_this(), std::placeholders::_1));
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto Connection::Reconnect() -> void
+    {
+        boost::system::error_code ignored;
+        mSocket.close(ignored);
+
+        mTimer.expires_from_now(RECONNECT_DELAY);
+        mTimer.async_wait(std::bind(&Connection::Connect, shared_from_this()));
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto Connection::HandleConnect(boost::system::error_code const& error) -> void
+    {
+        if (mStopped) { return; }
+
+        if (error)
+        {
+            Fail("failed to connect", error);
+            return;
+        }
+
+        boost::system::error_code ignored;
+        mSocket.set_option(ba::ip::tcp::no_delay(true), ignored);
+
+        ScheduleRequest();
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // With a target rate, each request is due 'mInterval' after the previous one was due -
+    // regardless of how long that one took.  If we have fallen behind, we send straight away.
+    //
+    auto Connection::ScheduleRequest() -> void
+    {
+        if (mStopped) { return; }
+
+        if (mInterval == Clock::duration::zero())
+        {
+            mStart = Clock::now();
+            SendRequest();
+            return;
+        }
+
+        mStart     = mNextSend;
+        mNextSend += mInterval;
+
+        if (mStart <= Clock::now())
+        {
+            SendRequest();
+        }
+        else
+        {
+            auto self = shared_from_this();
+            mTimer.expires_at(mStart);
+            mTimer.async_wait([self](boost::system::error_code const& error) { if (!error) { self->SendRequest(); } });
+        }
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto Connection::SendRequest() -> void
+    {
+        if (mStopped) { return; }
+
+        mState     = State::Head;
+        mKeepAlive = true;
+        ba::async_write(
+            mSocket,
+            ba::buffer(mRequest),
+            std::bind(&Connection::HandleWrite, shared_from_this(), std::placeholders::_1));
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto Connection::HandleWrite(boost::system::error_code const& error) -> void
+    {
+        if (mStopped) { return; }
+
+        if (error)
+        {
+            Fail("failed to send request", error);
+            return;
+        }
+
+        Continue();
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto Connection::ReadMore() -> void
+    {
+        mSocket.async_read_some(
+            mResponse.prepare(16*1024),
+            std::bind(&Connection::HandleRead, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto Connection::HandleRead(boost::system::error_code const& error, std::size_t bytes_transferred) -> void
+    {
+        if (mStopped) { return; }
+
+        if (error)
+        {
+            // without a Content-Length, the response ends when the server closes the connection
+            if (error == ba::error::eof && mState == State::UntilClose)
+            {
+                mKeepAlive = false;
+                Complete();
+            }
+            else
+            {
+                Fail("failed to read response", error);
+            }
+            return;
+        }
+
+        mResponse.commit(bytes_transferred);
+        mStats->bytes += bytes_transferred;
+        Continue();
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // Work through as much of the response as we have received, then either read some more, or
+    // (once the whole response has arrived) move on to the next request.
+    //
+    auto Connection::Continue() -> void
+    {
+        while (true)
+        {
+            auto const data = ba::buffer_cast<char const*>(mResponse.data());
+            auto const size = mResponse.size();
+
+            switch (mState)
+            {
+            case State::Head:
+                {
+                    static char const END[] = "\r\n\r\n";
+                    auto const end = std::search(data, data + size, END, END + 4);
+                    if (end == data + size) { return ReadMore(); }
+
+                    std::string const head(data, end + 4);
+                    mResponse.consume(head.size());
+
+                    if (!ParseHead(head))
+                    {
+                        Fail("invalid response", boost::system::error_code());
+                        return;
+                    }
+                    if (mState == State::Head) { return Complete(); }
+                    break;
+                }
+
+            case State::Body:
+            case State::ChunkData:
+            case State::UntilClose:
+                {
+                    auto const n = static_cast<std::size_t>(mState == State::UntilClose ? size : std::min<unsigned long long>(mRemaining, size));
+                    mResponse.consume(n);
+                    if (mState == State::UntilClose) { return ReadMore(); }
+
+                    mRemaining -= n;
+                    if (mRemaining > 0)         { return ReadMore(); }
+                    if (mState == State::Body)  { return Complete(); }
+                    mState = State::ChunkSize;
+                    break;
+                }
+
+            case State::ChunkSize:
+            case State::Trailers:
+                {
+                    auto const end = std::find(data, data + size, '\n');
+                    if (end == data + size) { return ReadMore(); }
+
+                    std::string const line(data, end + 1);
+                    mResponse.consume(line.size());
+
+                    if (mState == State::Trailers)
+                    {
+                        if (line == "\r\n" || line == "\n") { return Complete(); }
+                        break;
+                    }
+
+                    auto const chunkSize = std::strtoull(line.c_str(), nullptr, 16);
+                    if (chunkSize == 0)
+                    {
+                        mState = State::Trailers;
+                    }
+                    else
+                    {
+                        mState     = State::ChunkData;
+                        mRemaining = chunkSize + 2;     // the chunk's data, then a CRLF
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // Work out how the response body is framed, and whether the connection stays open afterwards
+    //
+    auto Connection::ParseHead(std::string const& head) -> bool
+    {
+        if (!IStartsWith(head, 0, "HTTP/1.")) { return false; }
+
+        auto const http10 = head[7] == '0';
+        auto const status = std::atoi(head.c_str() + 9);
+
+        bool chunked = false;
+        bool hasLength = false;
+        unsigned long long contentLength = 0;
+        mKeepAlive = !http10;
+
+        for (auto pos = head.find("\r\n") + 2; pos < head.size() - 2; pos = head.find("\r\n", pos) + 2)
+        {
+            auto const colon = head.find(':', pos);
+            auto const value = head.substr(colon + 1, head.find("\r\n", pos) - colon - 1);
+
+            if (IStartsWith(head, pos, "content-length:"))
+            {
+                hasLength     = true;
+                contentLength = std::strtoull(value.c_str(), nullptr, 10);
+            }
+            else if (IStartsWith(head, pos, "transfer-encoding:"))
+            {
+                std::string lower(value);
+                std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+                chunked = lower.find("chunked") != std::string::npos;
+            }
+            else if (IStartsWith(head, pos, "connection:"))
+            {
+                std::string lower(value);
+                std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+                if (lower.find("close")      != std::string::npos) { mKeepAlive = false; }
+                if (lower.find("keep-alive") != std::string::npos) { mKeepAlive = true; }
+            }
+        }
+
+        // responses to a GET with these status codes never have a body
+        if (status == 204 || status == 304 || (status >= 100 && status < 200))
+        {
+            mState = State::Head;
+        }
+        else if (chunked)
+        {
+            mState = State::ChunkSize;
+        }
+        else if (hasLength)
+        {
+            mState     = contentLength > 0 ? State::Body : State::Head;
+            mRemaining = contentLength;
+        }
+        else
+        {
+            mState = State::UntilClose;
+        }
+        return true;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto Connection::Complete() -> void
+    {
+        auto const latency = static_cast<unsigned long long>(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - mStart).count());
+        mStats->latencies.Record(latency);
+        mStats->interval_latencies.Record(latency);
+
+        if (mKeepAlive)
+        {
+            ScheduleRequest();
+        }
+        else
+        {
+            boost::system::error_code ignored;
+            mSocket.close(ignored);
+            Connect();
+        }
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto Connection::Fail(char const* what, boost::system::error_code const& error) -> void
+    {
+        // only report the first few - a dead server would otherwise flood the console
+        if (++mStats->errors <= 10)
+        {
+            std::cout << TimeStamp() << "WARNING:  " << what << (error ? ":  " + error.message() : std::string()) << std::endl;
+        }
+        Reconnect();
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+class HttpClient::Impl : public std::enable_shared_from_this<Impl>
+{
+public:
+    Impl(ba::io_service& io_service, HttpClientParameters const& params);
+    auto Start() -> void;
+    auto Stop()  -> void;
+
+private:
+    auto HandleStop() -> void;
+    auto HandleDuration(boost::system::error_code const& error) -> void;
+    auto HandleReport(boost::system::error_code const& error) -> void;
+    auto StartReportTimer() -> void;
+
+private:
+    HttpClientParameters const  mParams;
+
+    ba::io_service&             mIoService;
+    ba::signal_set              mSignals;
+    ba::steady_timer            mReportTimer;
+    ba::steady_timer            mDurationTimer;
+
+    std::vector<std::shared_ptr<Connection>>    mConnections;
+    std::shared_ptr<Stats>                      mStats;
+    Clock::time_point                           mStarted;
+    Clock::time_point                           mLastReport;
+    bool                                        mStopped;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+HttpClient::Impl::Impl(ba::io_service& io_service, HttpClientParameters const& params)
+    : mParams       (params)
+    , mIoService    (io_service)
+    , mSignals      {io_service}
+    , mReportTimer  {io_service}
+    , mDurationTimer{io_service}
+    , mStats        {std::make_shared<Stats>()}
+    , mStopped      {false}
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto HttpClient::Impl::Start() -> void
+{
+    // register to handle the stop/terminate/quit signals
+    mSignals.add(SIGINT);
+    mSignals.add(SIGTERM);
+#if defined (SIGQUIT)
+    mSignals.add(SIGQUIT);
+#endif
+    mSignals.async_wait(std::bind(&Impl::HandleStop, shared_from_this()));
+
+    // resolve the server address/port
+    std::cout << TimeStamp() << "resolving server address:  [" << mParams.listen_addr << "]:" << mParams.listen_port << std::endl;
+    ba::ip::tcp::resolver           resolver(mIoService);
+    ba::ip::tcp::resolver::query    query   (mParams.listen_addr, mParams.listen_port);
+    auto const                      endpoints = resolver.resolve(query);
+
+    std::string const request =
+        "GET " + mParams.path + " HTTP/1.1\r\n"
+        "Host: " + mParams.listen_addr + ":" + mParams.listen_port + "\r\n"
+        "User-Agent: TcpProxy\r\n"
+        "\r\n";
+
+    // each connection sends its share of the target rate
+    auto interval = Clock::duration::zero();
+    if (mParams.rate > 0)
+    {
+        interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(mParams.connections / mParams.rate));
+    }
+
+    std::cout << TimeStamp() << "sending requests on " << mParams.connections << " connection(s)";
+    if (mParams.rate > 0) { std::cout << " at " << mParams.rate << " requests/s"; }
+    std::cout << std::endl;
+
+    mStarted = mLastReport = Clock::now();
+    for (std::size_t i = 0; i < mParams.connections; ++i)
+    {
+        mConnections.push_back(std::make_shared<Connection>(mIoService, endpoints, request, interval, mStats));
+        mConnections.back()->Start();
+    }
+
+    if (mParams.duration_s > 0)
+    {
+        mDurationTimer.expires_from_now(std::chrono::seconds(mParams.duration_s));
+        mDurationTimer.async_wait(std::bind(&Impl::HandleDuration, shared_from_this(), std::placeholders::_1));
+    }
+
+    StartReportTimer();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto HttpClient::Impl::Stop() -> void
+{
+    mIoService.post(std::bind(&Impl::HandleStop, shared_from_this()));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto HttpClient::Impl::HandleDuration(boost::system::error_code const& error) -> void
+{
+    if (!error) { HandleStop(); }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto HttpClient::Impl::StartReportTimer() -> void
+{
+    mReportTimer.expires_from_now(std::chrono::seconds(1));
+    mReportTimer.async_wait(std::bind(&Impl::HandleReport, shared_from_this(), std::placeholders::_1));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Once a second:  the throughput and latency of the responses that arrived in the last second
+//
+auto HttpClient::Impl::HandleReport(boost::system::error_code const& error) -> void
+{
+    if (error || mStopped) { return; }
+
+    auto& stats = *mStats;
+    auto const now     = Clock::now();
+    auto const seconds = std::chrono::duration<double>(now - mLastReport).count();
+
+    auto const& latencies = stats.interval_latencies;
+
+    std::cout << TimeStamp()
+        << std::fixed << std::setprecision(0) << latencies.Count() / seconds << " requests/s,  "
+        << std::setprecision(2) << (stats.bytes - stats.reported_bytes) / seconds / (1024*1024) << " MB/s,  "
+        << "p50 " << FormatLatency(latencies.Percentile(50)) << ",  "
+        << "p99 " << FormatLatency(latencies.Percentile(99)) << ",  "
+        << (stats.errors - stats.reported_errors) << " error(s)"
+        << std::endl;
+
+    stats.interval_latencies.Reset();
+    stats.reported_bytes  = stats.bytes;
+    stats.reported_errors = stats.errors;
+    mLastReport = now;
+
+    StartReportTimer();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto HttpClient::Impl::HandleStop() -> void
+{
+    if (mStopped) { return; }
+    mStopped = true;
+
+    // once everything has been cancelled, the io_service runs out of work and we exit
+    boost::system::error_code ignored;
+    mSignals.cancel(ignored);
+    mReportTimer.cancel(ignored);
+    mDurationTimer.cancel(ignored);
+
+    for (auto& connection : mConnections)
+    {
+        connection->Stop();
+    }
+    mConnections.clear();
+
+    // and the summary
+    auto const& stats   = *mStats;
+    auto const  seconds = std::chrono::duration<double>(Clock::now() - mStarted).count();
+
+    auto const& latencies = stats.latencies;
+
+    std::cout
+        << TimeStamp() << "finished after " << std::fixed << std::setprecision(1) << seconds << "s\n"
+        << "    requests:       " << latencies.Count() << "  (" << std::setprecision(0) << latencies.Count() / seconds << " requests/s)\n"
+        << "    received:       " << stats.bytes << " bytes  (" << std::setprecision(2) << stats.bytes / seconds / (1024*1024) << " MB/s)\n"
+        << "    errors:         " << stats.errors << "\n"
+        << "    latency p50:    " << FormatLatency(latencies.Percentile(50))   << "\n"
+        << "    latency p90:    " << FormatLatency(latencies.Percentile(90))   << "\n"
+        << "    latency p99:    " << FormatLatency(latencies.Percentile(99))   << "\n"
+        << "    latency p99.9:  " << FormatLatency(latencies.Percentile(99.9)) << "\n"
+        << "    latency max:    " << FormatLatency(latencies.Max())
+        << std::endl;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+HttpClient::HttpClient(ba::io_service& io_service, HttpClientParameters const& params)
+    : mImpl(std::make_shared<Impl>(io_service, params))
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+HttpClient::~HttpClient()
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto HttpClient::Start() -> void
+{
+    mImpl->Start();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto HttpClient::Stop() -> void
+{
+    mImpl->Stop();
+}
@@ -0,0 +1,56 @@
+#ifndef INCLUDED_HTTP_CLIENT_HEADER
+#define INCLUDED_HTTP_CLIENT_HEADER
+
+
+#include <memory>
+#include <string>
+#include <boost/noncopyable.hpp>
+#include <boost/asio/io_service.hpp>
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+struct HttpClientParameters
+{
+    // the server (or proxy) that the requests are sent to
+    std::string listen_addr;
+    std::string listen_port;
+
+    // the number of concurrent keep-alive connections
+    std::size_t connections = 10;
+
+    // the target number of requests per second, spread evenly across all of the connections.  With
+    // 0, each connection sends its next request as soon as the previous response has arrived.
+    double      rate = 0;
+
+    // how long to run for (0 = until interrupted)
+    long        duration_s = 10;
+
+    // every request is a "GET <path>"
+    std::string path = "/";
+};
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// An HTTP/1.1 load generator.  Keeps 'connections' keep-alive connections busy with GET requests,
+// prints the throughput and latency once a second, and a summary (with latency percentiles) once
+// it has finished.  Everything runs on the io_service that it is given.
+//
+// With a target rate, each request's latency is measured from when it was *meant* to be sent, so
+// a slow server can't hide its stalls by holding up the requests that would have measured them.
+//
+class HttpClient : private boost::noncopyable
+{
+public:
+    HttpClient(boost::asio::io_service& io_service, HttpClientParameters const& params);
+    ~HttpClient();
+
+    auto Start() -> void;
+    auto Stop()  -> void;
+
+private:
+    class Impl;
+    std::shared_ptr<Impl> mImpl;
+};
+
+
+#endif  //INCLUDED_HTTP_CLIENT_HEADER
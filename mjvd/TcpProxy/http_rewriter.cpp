@@ -0,0 +1,360 @@
+#include "stdafx.h"
+#include "http_rewriter.h"
+#include <cctype>
+#include <algorithm>
+
+namespace ba = boost::asio;
+
+
+namespace
+{
+    // give up on rewriting (and just pass everything on) if a request head or a chunk line gets
+    // bigger than this - it probably isn't HTTP
+    std::size_t const MAX_HEAD = 64*1024;
+    std::size_t const MAX_LINE = 4*1024;
+
+    // longest method we expect to see, before the first space
+    std::size_t const MAX_METHOD = 32;
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto IEquals(std::string const& a, char const* b) -> bool
+    {
+        std::size_t i = 0;
+        for (; i < a.size() && b[i] != '\0'; ++i)
+        {
+            if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i]))) { return false; }
+        }
+        return i == a.size() && b[i] == '\0';
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto IContains(std::string const& haystack, char const* needle) -> bool
+    {
+        std::string lower(haystack);
+        std::transform(lower.begin(), lower.end(), lower.begin(), [](char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+        return lower.find(needle) != std::string::npos;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto Trim(std::string const& s) -> std::string
+    {
+        auto const first = s.find_first_not_of(" \t");
+        if (first == std::string::npos) { return std::string(); }
+        return s.substr(first, s.find_last_not_of(" \t") - first + 1);
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // a 'tchar' from RFC 7230 - the characters that may appear in a method or header name
+    auto IsTokenChar(char c) -> bool
+    {
+        return std::isalnum(static_cast<unsigned char>(c)) || std::string("!#$%&'*+-.^_`|~").find(c) != std::string::npos;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    template<typename Rules>
+    auto FindRule(Rules const& rules, std::string const& name) -> typename Rules::const_pointer
+    {
+        for (auto const& rule : rules)
+        {
+            if (IEquals(name, rule.first.c_str())) { return &rule; }
+        }
+        return nullptr;
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto HttpRewriteRules::Empty() const -> bool
+{
+    return add_headers.empty() && replace_headers.empty() && remove_headers.empty() && path_prefixes.empty();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+HttpRewriter::HttpRewriter(HttpRewriteRules const& rules)
+    : mRules    (rules)
+    , mState    {State::Head}
+    , mMatched  {0}
+    , mRemaining{0}
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto HttpRewriter::Process(char const* data, std::size_t size, std::string& scratch, std::vector<ba::const_buffer>& segments) -> void
+{
+    mPieces.clear();
+
+    std::size_t offset = 0;
+    while (offset < size)
+    {
+        switch (mState)
+        {
+        case State::Head:
+            offset = ProcessHead(data, offset, size, scratch);
+            break;
+
+        case State::Body:
+        case State::ChunkData:
+            {
+                auto const n = static_cast<std::size_t>(std::min<unsigned long long>(mRemaining, size - offset));
+                Emit(false, offset, n);
+                offset     += n;
+                mRemaining -= n;
+
+                if (mRemaining == 0) { mState = mState == State::Body ? State::Head : State::ChunkSize; }
+                break;
+            }
+
+        case State::ChunkSize:
+        case State::Trailers:
+            offset = ProcessLine(data, offset, size);
+            break;
+
+        case State::Passthrough:
+            Emit(false, offset, size - offset);
+            offset = size;
+            break;
+        }
+    }
+
+    // 'scratch' won't move again, so now we can point into it
+    for (auto const& piece : mPieces)
+    {
+        segments.push_back(ba::const_buffer((piece.scratch ? scratch.data() : data) + piece.offset, piece.size));
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Collect the request head until we have seen the blank line that ends it, then write the
+// rewritten head into 'scratch'.  Returns the offset of the first byte after what was used.
+//
+auto HttpRewriter::ProcessHead(char const* data, std::size_t begin, std::size_t size, std::string& scratch) -> std::size_t
+{
+    auto i = begin;
+
+    // empty lines between requests are passed straight on
+    if (mHead.empty())
+    {
+        while (i < size && (data[i] == '\r' || data[i] == '\n')) { ++i; }
+        Emit(false, begin, i - begin);
+        begin = i;
+    }
+
+    static char const END[] = "\r\n\r\n";
+    for (; i < size && mMatched < 4; ++i)
+    {
+        mMatched = data[i] == END[mMatched] ? mMatched + 1 : (data[i] == '\r' ? 1 : 0);
+    }
+
+    auto const checked = mHead.size();
+    mHead.append(data + begin, i - begin);
+
+    // bail out as soon as we can if this isn't HTTP, so that other protocols aren't held up
+    // waiting for a head that is never going to arrive
+    auto looksLikeHttp = mHead.size() <= MAX_HEAD;
+    if (checked < MAX_METHOD)
+    {
+        auto const method = mHead.find(' ');
+        auto const last   = std::min(method, mHead.size());
+        looksLikeHttp = looksLikeHttp && method != 0 && last <= MAX_METHOD && std::all_of(mHead.begin() + std::min(checked, last), mHead.begin() + last, IsTokenChar);
+    }
+
+    if (mMatched < 4 && looksLikeHttp) { return i; }
+
+    auto const start = scratch.size();
+    if (!looksLikeHttp || mMatched < 4 || !RewriteHead(scratch))
+    {
+        scratch.resize(start);
+        scratch.append(mHead);
+        mState = State::Passthrough;
+    }
+    Emit(true, start, scratch.size() - start);
+
+    mHead.clear();
+    mMatched = 0;
+    return i;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Chunk size and trailer lines are only looked at, never changed - so they are passed straight on
+// while we collect them.
+//
+auto HttpRewriter::ProcessLine(char const* data, std::size_t begin, std::size_t size) -> std::size_t
+{
+    auto const end = std::find(data + begin, data + size, '\n');
+    auto const complete = end != data + size;
+    auto const i = static_cast<std::size_t>(end - data) + (complete ? 1 : 0);
+
+    mLine.append(data + begin, i - begin);
+    Emit(false, begin, i - begin);
+
+    if (mLine.size() > MAX_LINE)
+    {
+        mState = State::Passthrough;
+    }
+    else if (complete)
+    {
+        EndLine();
+        mLine.clear();
+    }
+    return i;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto HttpRewriter::EndLine() -> void
+{
+    if (mState == State::Trailers)
+    {
+        // the trailers (if any) end with an empty line, and then the next request starts
+        if (mLine == "\r\n" || mLine == "\n") { mState = State::Head; }
+        return;
+    }
+
+    // chunk-size [; extensions] CRLF
+    unsigned long long chunkSize = 0;
+    std::size_t digits = 0;
+    for (; digits < mLine.size() && std::isxdigit(static_cast<unsigned char>(mLine[digits])); ++digits)
+    {
+        auto const c = std::tolower(static_cast<unsigned char>(mLine[digits]));
+        chunkSize = chunkSize * 16 + (c <= '9' ? c - '0' : c - 'a' + 10);
+    }
+
+    if (digits == 0 || digits > 15)
+    {
+        mState = State::Passthrough;
+    }
+    else if (chunkSize == 0)
+    {
+        mState = State::Trailers;
+    }
+    else
+    {
+        // the chunk's data is followed by a CRLF
+        mState     = State::ChunkData;
+        mRemaining = chunkSize + 2;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Append the rewritten version of 'mHead' to 'out', and work out how the body is framed.  Returns
+// false if the head can't be parsed.
+//
+auto HttpRewriter::RewriteHead(std::string& out) -> bool
+{
+    // request-line = method SP request-target SP HTTP-version CRLF
+    auto const lineEnd = mHead.find("\r\n");
+    auto const sp1     = mHead.find(' ');
+    auto const sp2     = mHead.rfind(' ', lineEnd);
+    if (sp1 == 0 || sp1 >= lineEnd || sp2 == sp1 || mHead.compare(sp2 + 1, 5, "HTTP/") != 0) { return false; }
+
+    auto const method = mHead.substr(0, sp1);
+    auto       target = mHead.substr(sp1 + 1, sp2 - sp1 - 1);
+
+    for (auto const& rule : mRules.path_prefixes)
+    {
+        if (target.compare(0, rule.first.size(), rule.first) == 0)
+        {
+            target.replace(0, rule.first.size(), rule.second);
+            break;
+        }
+    }
+
+    out.append(method).append(1, ' ').append(target).append(mHead, sp2, lineEnd + 2 - sp2);
+
+    // header-field = field-name ":" OWS field-value OWS CRLF
+    unsigned long long contentLength = 0;
+    bool chunked  = false;
+    bool upgrade  = false;
+    bool dropping = false;      // the previous header was removed or replaced
+
+    auto const headEnd = mHead.size() - 2;
+    for (auto pos = lineEnd + 2; pos < headEnd; )
+    {
+        auto const end = mHead.find("\r\n", pos);
+
+        // obsolete line folding - this continues the previous header
+        if (mHead[pos] == ' ' || mHead[pos] == '\t')
+        {
+            if (!dropping) { out.append(mHead, pos, end + 2 - pos); }
+            pos = end + 2;
+            continue;
+        }
+
+        auto const colon = mHead.find(':', pos);
+        if (colon == pos || colon > end) { return false; }
+
+        auto const name  = mHead.substr(pos, colon - pos);
+        auto const value = Trim(mHead.substr(colon + 1, end - colon - 1));
+
+        if (IEquals(name, "Content-Length"))
+        {
+            if (value.empty() || value.size() > 18 || value.find_first_not_of("0123456789") != std::string::npos) { return false; }
+            contentLength = std::stoull(value);
+        }
+        else if (IEquals(name, "Transfer-Encoding"))
+        {
+            chunked = IContains(value, "chunked");
+        }
+        else if (IEquals(name, "Upgrade"))
+        {
+            upgrade = true;
+        }
+
+        auto const removed  = std::any_of(mRules.remove_headers.begin(), mRules.remove_headers.end(), [&name](std::string const& r) { return IEquals(name, r.c_str()); });
+        auto const replaced = removed ? nullptr : FindRule(mRules.replace_headers, name);
+
+        if (replaced)      { out.append(name).append(": ").append(replaced->second).append("\r\n"); }
+        else if (!removed) { out.append(mHead, pos, end + 2 - pos); }
+
+        dropping = removed || replaced;
+        pos = end + 2;
+    }
+
+    for (auto const& header : mRules.add_headers)
+    {
+        out.append(header.first).append(": ").append(header.second).append("\r\n");
+    }
+    out.append("\r\n");
+
+    // after a CONNECT or an upgrade the stream is no longer HTTP.  Otherwise chunked takes
+    // precedence over Content-Length, and a request without either has no body.
+    if (method == "CONNECT" || upgrade)
+    {
+        mState = State::Passthrough;
+    }
+    else if (chunked)
+    {
+        mState = State::ChunkSize;
+    }
+    else if (contentLength > 0)
+    {
+        mState     = State::Body;
+        mRemaining = contentLength;
+    }
+    else
+    {
+        mState = State::Head;
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Neighbouring slices of the same buffer are merged, so a body normally ends up as a single
+// buffer however it was framed.
+//
+auto HttpRewriter::Emit(bool scratch, std::size_t offset, std::size_t size) -> void
+{
+    if (size == 0) { return; }
+
+    if (!mPieces.empty())
+    {
+        auto& last = mPieces.back();
+        if (last.scratch == scratch && last.offset + last.size == offset)
+        {
+            last.size += size;
+            return;
+        }
+    }
+
+    Piece const piece = {scratch, offset, size};
+    mPieces.push_back(piece);
+}
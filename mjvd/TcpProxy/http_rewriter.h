@@ -0,0 +1,80 @@
+#ifndef INCLUDED_HTTP_REWRITER_HEADER
+#define INCLUDED_HTTP_REWRITER_HEADER
+
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <boost/noncopyable.hpp>
+#include <boost/asio/buffer.hpp>
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// What to change in each HTTP/1.1 request that passes from the client to the server.  Header
+// names are matched case-insensitively.
+//
+struct HttpRewriteRules
+{
+    typedef std::pair<std::string, std::string> NameValue;
+
+    std::vector<NameValue>      add_headers;        // appended to every request
+    std::vector<NameValue>      replace_headers;    // value replaced, but only where the header is present
+    std::vector<std::string>    remove_headers;     // removed wherever present
+    std::vector<NameValue>      path_prefixes;      // the first matching prefix of the request path is replaced
+
+    auto Empty() const -> bool;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Rewrites the requests in a client --> server byte stream, as it streams through.  Only the
+// request heads are ever copied (and rewritten) - everything else, including request bodies and
+// chunk framing, is passed on as slices of the caller's read buffer.  Handles keep-alive,
+// pipelined requests, and both Content-Length and chunked bodies.
+//
+// Anything that doesn't look like HTTP, CONNECT requests, and requests that ask for an Upgrade
+// switch the rest of the stream to a plain pass-through.
+//
+class HttpRewriter : private boost::noncopyable
+{
+public:
+    explicit HttpRewriter(HttpRewriteRules const& rules);
+
+    // 'size' bytes of the stream have been read into 'data'.  Appends the buffers to be written in
+    // their place to 'segments':  these point into 'data', or into 'scratch' (which the caller
+    // must keep alive until they have been written).  Nothing is appended while a request head is
+    // still incomplete - the partial head is held in here until the rest of it arrives.
+    auto Process(char const* data, std::size_t size, std::string& scratch, std::vector<boost::asio::const_buffer>& segments) -> void;
+
+private:
+    enum class State { Head, Body, ChunkSize, ChunkData, Trailers, Passthrough };
+
+    // a piece of the output - either a slice of the read buffer, or a slice of 'scratch'.  We
+    // only turn these into buffers once we are done appending to 'scratch'.
+    struct Piece
+    {
+        bool            scratch;
+        std::size_t     offset;
+        std::size_t     size;
+    };
+
+    auto ProcessHead(char const* data, std::size_t begin, std::size_t size, std::string& scratch) -> std::size_t;
+    auto ProcessLine(char const* data, std::size_t begin, std::size_t size) -> std::size_t;
+    auto RewriteHead(std::string& out) -> bool;
+    auto EndLine() -> void;
+
+    auto Emit(bool scratch, std::size_t offset, std::size_t size) -> void;
+
+private:
+    HttpRewriteRules const      mRules;
+
+    State                       mState;
+    std::string                 mHead;          // the request head collected so far
+    std::size_t                 mMatched;       // how much of the blank line ending the head has been seen
+    std::string                 mLine;          // the chunk size or trailer line collected so far
+    unsigned long long          mRemaining;     // bytes left in the current body or chunk
+    std::vector<Piece>          mPieces;
+};
+
+
+#endif  //INCLUDED_HTTP_REWRITER_HEADER
@@ -0,0 +1,108 @@
+#include "stdafx.h"
+#include "io_service_pool.h"
+#include "utils.h"
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace ba = boost::asio;
+
+
+namespace
+{
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto PinToCore(std::thread& thread, std::size_t core) -> void
+    {
+#if defined(_WIN32)
+        if (SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << core) == 0)
+        {
+            std::cout << TimeStamp() << "WARNING:  failed to pin worker thread to core " << core << std::endl;
+        }
+#elif defined(__linux__)
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(core, &cpus);
+        if (pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus) != 0)
+        {
+            std::cout << TimeStamp() << "WARNING:  failed to pin worker thread to core " << core << std::endl;
+        }
+#else
+        (void)thread;
+        (void)core;
+#endif
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+IoServicePool::IoServicePool(std::size_t size, bool pinThreads)
+    : mNext         {0}
+    , mPinThreads   {pinThreads}
+{
+    if (size == 0) { throw std::runtime_error("IoServicePool:  size must be greater than zero"); }
+
+    // each io_service gets a 'work' object, so that run() doesn't return while it is idle
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        mIoServices.emplace_back(new ba::io_service(1));
+        mWork.emplace_back(new ba::io_service::work(*mIoServices.back()));
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+IoServicePool::~IoServicePool()
+{
+    Stop();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto IoServicePool::Start() -> void
+{
+    auto const cores = std::max(1u, std::thread::hardware_concurrency());
+    for (std::size_t i = 0; i < mIoServices.size(); ++i)
+    {
+        auto& io_service = *mIoServices[i];
+        mThreads.emplace_back([&io_service]() { io_service.run(); });
+
+        if (mPinThreads)
+        {
+            PinToCore(mThreads.back(), i % cores);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto IoServicePool::Stop() -> void
+{
+    mWork.clear();
+    for (auto& thread : mThreads)
+    {
+        if (thread.joinable()) { thread.join(); }
+    }
+    mThreads.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto IoServicePool::Size() const -> std::size_t
+{
+    return mIoServices.size();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto IoServicePool::GetIoService(std::size_t index) -> ba::io_service&
+{
+    return *mIoServices[index % mIoServices.size()];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto IoServicePool::GetIoService() -> ba::io_service&
+{
+    return GetIoService(mNext++);
+}
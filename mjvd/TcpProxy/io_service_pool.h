@@ -0,0 +1,45 @@
+#ifndef INCLUDED_IO_SERVICE_POOL_HEADER
+#define INCLUDED_IO_SERVICE_POOL_HEADER
+
+
+#include <memory>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <boost/noncopyable.hpp>
+#include <boost/asio/io_service.hpp>
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// A pool of io_service objects, each run by its own worker thread (optionally pinned to its own
+// core).  Sessions are handed out round-robin, so all of the handlers for any one session always
+// run on the same thread - which means that the sessions themselves need no locking.
+//
+class IoServicePool : private boost::noncopyable
+{
+public:
+    IoServicePool(std::size_t size, bool pinThreads);
+    ~IoServicePool();
+
+    // start the worker threads
+    auto Start() -> void;
+
+    // allow the worker threads to exit once they have run out of work, and wait for them
+    auto Stop() -> void;
+
+    auto Size() const -> std::size_t;
+    auto GetIoService(std::size_t index) -> boost::asio::io_service&;
+
+    // round-robin
+    auto GetIoService() -> boost::asio::io_service&;
+
+private:
+    std::vector<std::unique_ptr<boost::asio::io_service>>       mIoServices;
+    std::vector<std::unique_ptr<boost::asio::io_service::work>> mWork;
+    std::vector<std::thread>                                    mThreads;
+    std::atomic<std::size_t>                                    mNext;
+    bool const                                                  mPinThreads;
+};
+
+
+#endif  //INCLUDED_IO_SERVICE_POOL_HEADER
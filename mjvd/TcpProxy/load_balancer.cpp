@@ -0,0 +1,228 @@
+#include "stdafx.h"
+#include "load_balancer.h"
+#include "utils.h"
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+
+namespace ba = boost::asio;
+
+
+namespace
+{
+    // points on the hash ring for each destination - enough to spread the clients evenly
+    std::size_t const VIRTUAL_NODES = 160;
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // FNV-1a - the same on every platform, so a client maps to the same destination whichever
+    // build of the proxy it goes through
+    auto Hash(unsigned char const* data, std::size_t size) -> unsigned long long
+    {
+        unsigned long long hash = 14695981039346656037ull;
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            hash ^= data[i];
+            hash *= 1099511628211ull;
+        }
+
+        // FNV mixes the last few bytes poorly - finish with a 64-bit avalanche
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdull;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
+    auto Hash(std::string const& s) -> unsigned long long
+    {
+        return Hash(reinterpret_cast<unsigned char const*>(s.data()), s.size());
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto ParsePolicy(std::string const& policy) -> BalancePolicy
+    {
+        if (policy == "round-robin")        { return BalancePolicy::RoundRobin; }
+        if (policy == "least-connections")  { return BalancePolicy::LeastConnections; }
+        if (policy == "hash")               { return BalancePolicy::Hash; }
+        throw std::invalid_argument("LoadBalancer:  unknown policy:  " + policy);
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto AllDestinations(ProxyParameters const& params) -> std::vector<Destination>
+    {
+        Destination first;
+        first.addr = params.dest_addr;
+        first.port = params.dest_port;
+
+        std::vector<Destination> destinations(1, first);
+        destinations.insert(destinations.end(), params.more_destinations.begin(), params.more_destinations.end());
+        return destinations;
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+LoadBalancer::LoadBalancer(ProxyParameters const& params)
+    : mDestinations (AllDestinations(params))
+    , mPolicy       {ParsePolicy(params.balance)}
+    , mEjectFailures{std::max(1u, params.eject_failures)}
+    , mEjectTicks   {std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::seconds(params.eject_time_s)).count()}
+    , mBackends     {new Backend[mDestinations.size()]}
+    , mNext         {0}
+{
+    if (mPolicy == BalancePolicy::Hash)
+    {
+        for (std::size_t i = 0; i < mDestinations.size(); ++i)
+        {
+            auto const name = "[" + mDestinations[i].addr + "]:" + mDestinations[i].port + "#";
+            for (std::size_t node = 0; node < VIRTUAL_NODES; ++node)
+            {
+                mRing.push_back(std::make_pair(Hash(name + std::to_string(node)), i));
+            }
+        }
+        std::sort(mRing.begin(), mRing.end());
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto LoadBalancer::Size() const -> std::size_t
+{
+    return mDestinations.size();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto LoadBalancer::GetDestination(std::size_t index) const -> Destination const&
+{
+    return mDestinations[index];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto LoadBalancer::Now() const -> long long
+{
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto LoadBalancer::IsAvailable(std::size_t index, long long now) const -> bool
+{
+    return mBackends[index].ejected_until.load(std::memory_order_relaxed) <= now;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto LoadBalancer::Choose(ba::ip::address const& client) -> std::size_t
+{
+    auto const now = Now();
+
+    std::size_t index = 0;
+    switch (mPolicy)
+    {
+    case BalancePolicy::RoundRobin:         index = ChooseRoundRobin(now);          break;
+    case BalancePolicy::LeastConnections:   index = ChooseLeastConnections(now);    break;
+    case BalancePolicy::Hash:               index = ChooseHash(client, now);        break;
+    }
+
+    mBackends[index].active.fetch_add(1, std::memory_order_relaxed);
+    return index;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto LoadBalancer::Release(std::size_t index) -> void
+{
+    mBackends[index].active.fetch_sub(1, std::memory_order_relaxed);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The next available destination after the last one that we picked
+//
+auto LoadBalancer::ChooseRoundRobin(long long now) -> std::size_t
+{
+    auto const start = mNext++;
+    for (std::size_t i = 0; i < mDestinations.size(); ++i)
+    {
+        auto const index = (start + i) % mDestinations.size();
+        if (IsAvailable(index, now)) { return index; }
+    }
+    return start % mDestinations.size();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Ties go to whichever comes first after a rotating starting point, so that an idle tier isn't
+// all sent to the first destination
+//
+auto LoadBalancer::ChooseLeastConnections(long long now) -> std::size_t
+{
+    auto const start = mNext++;
+    auto       best  = start % mDestinations.size();
+    auto       fewest = -1L;
+
+    for (auto pass = 0; pass < 2 && fewest < 0; ++pass)
+    {
+        for (std::size_t i = 0; i < mDestinations.size(); ++i)
+        {
+            auto const index = (start + i) % mDestinations.size();
+
+            // the second pass only happens if every destination has been ejected
+            if (pass == 0 && !IsAvailable(index, now)) { continue; }
+
+            auto const active = mBackends[index].active.load(std::memory_order_relaxed);
+            if (fewest < 0 || active < fewest)
+            {
+                best   = index;
+                fewest = active;
+            }
+        }
+    }
+    return best;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The first available destination clockwise from the client's point on the ring.  Only the
+// clients of a destination that has been ejected move elsewhere (and they move back once it
+// returns).
+//
+auto LoadBalancer::ChooseHash(ba::ip::address const& client, long long now) -> std::size_t
+{
+    unsigned long long point;
+    if (client.is_v4())
+    {
+        auto const bytes = client.to_v4().to_bytes();
+        point = Hash(bytes.data(), bytes.size());
+    }
+    else
+    {
+        auto const bytes = client.to_v6().to_bytes();
+        point = Hash(bytes.data(), bytes.size());
+    }
+
+    auto const first = std::lower_bound(mRing.begin(), mRing.end(), std::make_pair(point, std::size_t(0))) - mRing.begin();
+    for (std::size_t i = 0; i < mRing.size(); ++i)
+    {
+        auto const index = mRing[(first + i) % mRing.size()].second;
+        if (IsAvailable(index, now)) { return index; }
+    }
+    return mRing[first % mRing.size()].second;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto LoadBalancer::Connected(std::size_t index) -> void
+{
+    mBackends[index].failures.store(0, std::memory_order_relaxed);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Only the session that takes the count to the threshold ejects the destination, so it is only
+// reported once
+//
+auto LoadBalancer::Failed(std::size_t index) -> void
+{
+    if (mDestinations.size() < 2) { return; }
+
+    auto& backend = mBackends[index];
+    if (backend.failures.fetch_add(1, std::memory_order_relaxed) + 1 != mEjectFailures) { return; }
+
+    backend.ejected_until.store(Now() + mEjectTicks, std::memory_order_relaxed);
+    backend.failures.store(0, std::memory_order_relaxed);
+
+    auto const& destination = mDestinations[index];
+    std::cout << TimeStamp() << "WARNING:  ejecting destination [" << destination.addr << "]:" << destination.port << " for " << std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::duration(mEjectTicks)).count() << "s after " << mEjectFailures << " failed connect(s)" << std::endl;
+}
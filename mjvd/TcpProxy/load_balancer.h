@@ -0,0 +1,81 @@
+#ifndef INCLUDED_LOAD_BALANCER_HEADER
+#define INCLUDED_LOAD_BALANCER_HEADER
+
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <utility>
+#include <boost/noncopyable.hpp>
+#include <boost/asio/ip/address.hpp>
+
+#include "proxy.h"
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+enum class BalancePolicy
+{
+    RoundRobin,
+    LeastConnections,
+    Hash,               // consistent hash of the client's address, so each client sticks to one destination
+};
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Picks the destination for each new session, from 'dest_addr:dest_port' plus any
+// 'more_destinations'.  Destinations are tracked passively:  after 'eject_failures' connects in a
+// row have failed, a destination is left out for 'eject_time_s' seconds.  If every destination
+// has been ejected, they are all used anyway - there's no point refusing every session.
+//
+// Sessions on every worker thread share the one balancer, so all of its state is atomic.
+//
+class LoadBalancer : private boost::noncopyable
+{
+public:
+    explicit LoadBalancer(ProxyParameters const& params);
+
+    auto Size() const -> std::size_t;
+    auto GetDestination(std::size_t index) const -> Destination const&;
+
+    // pick a destination for a new session from 'client'.  Every Choose() must be followed by a
+    // Release() once the session has finished with the destination.
+    auto Choose(boost::asio::ip::address const& client) -> std::size_t;
+    auto Release(std::size_t index) -> void;
+
+    // the outcome of each attempt to connect to a destination
+    auto Connected(std::size_t index) -> void;
+    auto Failed   (std::size_t index) -> void;
+
+private:
+    struct Backend
+    {
+        Backend() : active(0), failures(0), ejected_until(0) {}
+
+        std::atomic<long>           active;         // sessions using this destination
+        std::atomic<unsigned>       failures;       // failed connects in a row
+        std::atomic<long long>      ejected_until;  // steady clock ticks
+    };
+
+    auto Now() const -> long long;
+    auto IsAvailable(std::size_t index, long long now) const -> bool;
+    auto ChooseRoundRobin(long long now) -> std::size_t;
+    auto ChooseLeastConnections(long long now) -> std::size_t;
+    auto ChooseHash(boost::asio::ip::address const& client, long long now) -> std::size_t;
+
+private:
+    std::vector<Destination> const          mDestinations;
+    BalancePolicy const                     mPolicy;
+    unsigned const                          mEjectFailures;
+    long long const                         mEjectTicks;
+
+    std::unique_ptr<Backend[]>              mBackends;
+    std::atomic<std::size_t>                mNext;
+
+    // the consistent hash ring:  {point, destination index}, sorted by point.  Never changes after
+    // construction.
+    std::vector<std::pair<unsigned long long, std::size_t>> mRing;
+};
+
+
+#endif  //INCLUDED_LOAD_BALANCER_HEADER
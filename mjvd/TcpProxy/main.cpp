@@ -4,38 +4,103 @@
 #include <cstdlib>
 #include <stdexcept>
 #include <memory>
+#include <vector>
+#include <cassert>
+#include <thread>
+#include <algorithm>
+#include <utility>
 
 #include <boost/asio/io_service.hpp>
 namespace ba = boost::asio;
 
+#include <boost/program_options.hpp>
+namespace po = boost::program_options;
+
 #include "proxy.h"
+#include "udp_relay.h"
 #include "http_client.h"
+#include "alloc_bench.h"
+#include "relay_bench.h"
+#include "rate_check.h"
 
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-int DisplayUsage()
+int DisplayUsage(po::options_description const& desc)
 {
     std::cout
-        << "\nUsage:  TcpProxy <listen_addr> <listen_port> <dest_addr> <dest_port>"
+        << "\nUsage:  TcpProxy [options] <listen_addr> <listen_port> <dest_addr> <dest_port>"
+        << "\n        TcpProxy [options] <server_addr> <server_port>"
         << "\n"
         << "\n    This application listens on the specified TCP port.  When a connection is"
         << "\n    established on this port, it will connect to the specified destination."
         << "\n    All data is proxied in both directions.  When either side closes the "
-        << "\n    connection, then TcpProxy will forcibly close the remaining connection."
+        << "\n    connection, whatever has already been read from it is still passed on to"
+        << "\n    the other side, and then TcpProxy closes the remaining connection."
+        << "\n"
+        << "\n    By default, every incomming connection gets its own session (and its own"
+        << "\n    connection to the destination), and all sessions are proxied concurrently."
+        << "\n    Use --single to accept only a single incomming connection at any one time."
+        << "\n"
+        << "\n    With just a server address and port, TcpProxy instead acts as an HTTP load"
+        << "\n    generator:  it sends GET requests to the server over --connections keep-alive"
+        << "\n    connections (at up to --rate requests/s) and reports the latency percentiles."
+        << "\n"
+        << "\n    To upgrade without refusing any connections, run the new process with the"
+        << "\n    same --handoff path as the running one:  it takes over the listening socket,"
+        << "\n    and the old process drains its sessions (for up to --drain-timeout) and exits."
+        << "\n"
+        << "\n    With --udp, TcpProxy relays UDP datagrams instead.  Each client address gets"
+        << "\n    its own flow to a destination, which lasts until it is idle for"
+        << "\n    --udp-idle-timeout.  The TCP session options do not apply."
+        << "\n"
+        << "\n    With --alloc-bench (and no addresses), TcpProxy relays that many MB through"
+        << "\n    itself over the loopback interface, and reports the heap allocations made."
         << "\n"
-        << "\n    TcpProxy will only accept a single incomming connection at any one time - "
-        << "\n    i.e. it does not multiplex connections."
+        << "\n    With --bench (and no addresses), TcpProxy runs itself in front of an echo"
+        << "\n    server and a sink over the loopback interface, and reports the requests/s,"
+        << "\n    the latency it adds, the throughput and the CPU that it uses per GB - to"
+        << "\n    compare the relay options (buffers, threads, splice) one run against another."
+        << "\n"
+        << "\n    With --rate-check (and no addresses), TcpProxy streams through itself over the"
+        << "\n    loopback interface with each --session-rate in turn (10, 50, 200 and 1000"
+        << "\n    MB/s if none is given), and fails unless each is kept to within 5%."
         << "\n"
         << "\n    This app fully supports IPv6."
         << "\n"
         << "\n        TcpProxy ::0 81 ::1 80"
         << "\n"
+        << "\n" << desc
         << "\n"
         << std::endl;
 
     return EXIT_FAILURE;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Each value of 'option' is "name<separator>value" --> {name, value}, trimmed of whitespace
+//
+auto GetRules(po::variables_map const& vm, char const* option, char separator, std::vector<std::pair<std::string, std::string>>& rules) -> bool
+{
+    auto trim = [](std::string const& s) -> std::string
+    {
+        auto const first = s.find_first_not_of(" \t");
+        return first == std::string::npos ? std::string() : s.substr(first, s.find_last_not_of(" \t") - first + 1);
+    };
+
+    if (vm.count(option) == 0) { return true; }
+    for (auto const& rule : vm[option].as<std::vector<std::string>>())
+    {
+        auto const pos = rule.find(separator);
+        if (pos == std::string::npos || trim(rule.substr(0, pos)).empty())
+        {
+            std::cout << "ERROR:  invalid --" << option << ":  " << rule << std::endl;
+            return false;
+        }
+        rules.push_back(std::make_pair(trim(rule.substr(0, pos)), trim(rule.substr(pos + 1))));
+    }
+    return true;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 int main(int argc, char** argv)
 {
@@ -47,31 +112,289 @@ int main(int argc, char** argv)
         // our one and only io_service
         ba::io_service io_service;
 
+        std::vector<std::string> positional;
+
+        po::options_description desc("Allowed options");
+        desc.add_options()
+            ("help",                                                                            "produce help message")
+            ("single",                                                                          "only proxy a single connection at any one time")
+            ("connect-timeout",     po::value<long>()->default_value(10000),                    "how long to wait when connecting to the destination (in milli-seconds)")
+            ("idle-read-timeout",   po::value<long>()->default_value(0),                        "close a session when nothing has been read from either side for this long (in seconds, 0 = never)")
+            ("idle-write-timeout",  po::value<long>()->default_value(0),                        "close a session when a write has been blocked for this long (in seconds, 0 = never)")
+            ("max-lifetime",        po::value<long>()->default_value(0),                        "close a session once it has been open for this long (in seconds, 0 = never)")
+            ("drain-timeout",       po::value<long>()->default_value(0),                        "on shutdown, stop accepting and give the active sessions this long to finish (in seconds, 0 = close them immediately)")
+            ("handoff",             po::value<std::string>(),                                   "hot restart:  take over the listening socket from the process at this Unix socket path, then wait there for the next process (POSIX only)")
+            ("threads",             po::value<std::size_t>()->default_value(1),                 "number of worker threads to run the sessions on (0 = one per core)")
+            ("pin-threads",                                                                     "pin each worker thread to its own core")
+            ("reuse-port",                                                                      "give each worker thread its own SO_REUSEPORT acceptor (Linux only)")
+            ("buffer-size",         po::value<std::size_t>()->default_value(16*1024),           "size of each relay buffer (in bytes)")
+            ("buffer-count",        po::value<std::size_t>()->default_value(4),                 "number of relay buffers in each direction of a session")
+            ("session-pool",        po::value<std::size_t>()->default_value(64),                "number of closed sessions (and their buffers) to keep for reuse, per worker thread")
+            ("no-dump",                                                                         "do not write the proxied traffic to the console")
+            ("dump-file",           po::value<std::string>(),                                   "write the proxied traffic to this file, rather than the console")
+            ("dump-format",         po::value<std::string>()->default_value("text"),            "format of the proxied traffic:  text | hex | pcapng (requires --dump-file)")
+            ("dump-queue",          po::value<std::size_t>()->default_value(1024),              "number of chunks that may wait to be dumped (per worker thread) before chunks are dropped - also about the number of sessions that each worker thread can dump at once")
+            ("splice",                                                                          "zero-copy relay using splice(2) (Linux only, requires --no-dump)")
+            ("destination",         po::value<std::vector<std::string>>()->composing(),         "another destination to balance the sessions across (\"addr:port\", or \"[addr]:port\" for IPv6)")
+            ("balance",             po::value<std::string>()->default_value("round-robin"),     "how to pick each session's destination:  round-robin | least-connections | hash (of the client address)")
+            ("eject-failures",      po::value<unsigned>()->default_value(3),                    "leave a destination out after this many failed connects in a row")
+            ("eject-time",          po::value<long>()->default_value(30),                       "how long to leave a failing destination out for (in seconds)")
+            ("proxy-protocol-in",                                                               "expect each client connection to start with a PROXY protocol (v1 or v2) header")
+            ("proxy-protocol-out",                                                              "send a PROXY protocol v2 header ahead of the data on each destination connection")
+            ("udp",                                                                             "relay UDP datagrams rather than TCP connections")
+            ("udp-idle-timeout",    po::value<long>()->default_value(60),                       "UDP:  close a client's flow when nothing has been relayed for this long (in seconds)")
+            ("udp-max-flows",       po::value<std::size_t>()->default_value(65536),             "UDP:  drop the datagrams from new clients while there are this many flows")
+            ("udp-batch",           po::value<std::size_t>()->default_value(32),                "UDP:  the most datagrams to receive or send with each system call")
+            ("session-rate",        po::value<double>()->default_value(0),                      "limit each session to this many bytes/s in each direction (0 = no limit)")
+            ("client-rate",         po::value<double>()->default_value(0),                      "limit all of the sessions from each client address to this many bytes/s in each direction (0 = no limit)")
+            ("total-rate",          po::value<double>()->default_value(0),                      "limit all of the sessions together to this many bytes/s in each direction (0 = no limit)")
+            ("rate-burst",          po::value<std::size_t>()->default_value(64*1024),           "the number of bytes that may be relayed at once before the rate limits apply")
+            ("dns-ttl",             po::value<long>()->default_value(30),                       "reuse each resolved destination address for this long (in seconds)")
+            ("dns-stale",           po::value<long>()->default_value(300),                      "keep using an expired address for up to this long, while it is resolved again (in seconds)")
+            ("dns-negative-ttl",    po::value<long>()->default_value(5),                        "wait this long before resolving a destination again after a failure (in seconds)")
+            ("upstream-pool",       po::value<std::size_t>()->default_value(0),                 "number of idle destination connections to keep open, per worker thread (0 = none)")
+            ("upstream-idle-timeout", po::value<long>()->default_value(60),                     "replace idle destination connections after this long (in seconds)")
+            ("metrics-port",        po::value<std::string>(),                                   "serve metrics for Prometheus on http://<metrics-addr>:<metrics-port>/metrics")
+            ("metrics-addr",        po::value<std::string>()->default_value("127.0.0.1"),       "address to serve the metrics on")
+            ("http-add-header",     po::value<std::vector<std::string>>()->composing(),         "rewrite HTTP requests:  add this header to every request (\"Name: value\")")
+            ("http-replace-header", po::value<std::vector<std::string>>()->composing(),         "rewrite HTTP requests:  replace the value of this header where present (\"Name: value\")")
+            ("http-remove-header",  po::value<std::vector<std::string>>()->composing(),         "rewrite HTTP requests:  remove this header where present")
+            ("http-rewrite-path",   po::value<std::vector<std::string>>()->composing(),         "rewrite HTTP requests:  replace this request path prefix (\"/old=/new\")")
+            ("connections",         po::value<std::size_t>()->default_value(10),                "HTTP client:  number of concurrent keep-alive connections")
+            ("rate",                po::value<double>()->default_value(0),                      "HTTP client:  target requests/s across all connections (0 = as fast as possible)")
+            ("duration",            po::value<long>()->default_value(10),                       "HTTP client:  how long to run for (in seconds, 0 = until interrupted)")
+            ("path",                po::value<std::string>()->default_value("/"),               "HTTP client:  the path to GET")
+            ("alloc-bench",         po::value<std::size_t>(),                                   "relay this many MB through the proxy over loopback, and report the heap allocations per MB")
+            ("bench",                                                                           "benchmark the proxy over loopback, with the other options as given")
+            ("bench-connections",   po::value<std::size_t>()->default_value(8),                 "benchmark:  number of concurrent connections")
+            ("bench-size",          po::value<std::vector<std::size_t>>()->composing(),         "benchmark:  message size (in bytes, up to 1 MB) - may be given more than once (default 64 and 16384)")
+            ("bench-duration",      po::value<long>()->default_value(5),                        "benchmark:  how long to measure for, for each message size (in seconds)")
+            ("rate-check",                                                                      "check over loopback that the session rate is kept to, for --session-rate (or a range of rates)")
+            ("args",                po::value<std::vector<std::string>>(&positional),           "<listen_addr> <listen_port> [<dest_addr> <dest_port>]")
+            ;
+
+        po::positional_options_description pd;
+        pd.add("args", -1);
+
+        // process the command line
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(pd).run(), vm);
+        po::notify(vm);
+
+        if (vm.count("help"))
+        {
+            return DisplayUsage(desc);
+        }
+
         // get the command-line params
-        if (argc == 3)
+        if (positional.size() == 2)
         {
             HttpClientParameters params;
-            params.listen_addr = argv[1];
-            params.listen_port = argv[2];
+            params.listen_addr = positional[0];
+            params.listen_port = positional[1];
+            params.connections = vm["connections"].as<std::size_t>();
+            params.rate        = vm["rate"].as<double>();
+            params.duration_s  = vm["duration"].as<long>();
+            params.path        = vm["path"].as<std::string>();
+
+            if (params.connections == 0 || params.rate < 0 || params.duration_s < 0)
+            {
+                std::cout << "ERROR:  connections must be greater than zero, and rate and duration must not be negative" << std::endl;
+                return EXIT_FAILURE;
+            }
 
             auto httpClient = std::make_shared<HttpClient>(io_service, params);
             httpClient->Start();
         }
-        else if (argc == 5)
+        else if (positional.size() == 4 || (positional.empty() && (vm.count("alloc-bench") || vm.count("bench") || vm.count("rate-check"))))
         {
             ProxyParameters params;
-            params.listen_addr = argv[1];
-            params.listen_port = argv[2];
-            params.dest_addr   = argv[3];
-            params.dest_port   = argv[4];
-
-            // create our proxy object
-            auto proxy = std::make_shared<Proxy>(io_service, params);
-            proxy->Start();
+            if (!positional.empty())
+            {
+                params.listen_addr      = positional[0];
+                params.listen_port      = positional[1];
+                params.dest_addr        = positional[2];
+                params.dest_port        = positional[3];
+            }
+            params.single_connection    = vm.count("single") == 1;
+            params.connect_timeout_ms   = vm["connect-timeout"].as<long>();
+            params.idle_read_timeout_s  = vm["idle-read-timeout"].as<long>();
+            params.idle_write_timeout_s = vm["idle-write-timeout"].as<long>();
+            params.max_lifetime_s       = vm["max-lifetime"].as<long>();
+            params.drain_timeout_s      = vm["drain-timeout"].as<long>();
+            params.handoff_path         = vm.count("handoff") ? vm["handoff"].as<std::string>() : "";
+            params.threads              = vm["threads"].as<std::size_t>();
+            params.pin_threads          = vm.count("pin-threads") == 1;
+            params.reuse_port           = vm.count("reuse-port") == 1;
+            params.buffer_size          = vm["buffer-size"].as<std::size_t>();
+            params.buffer_count         = vm["buffer-count"].as<std::size_t>();
+            params.session_pool_size    = vm["session-pool"].as<std::size_t>();
+            params.dump_traffic         = vm.count("no-dump") == 0;
+            params.dump_file            = vm.count("dump-file") ? vm["dump-file"].as<std::string>() : "";
+            params.dump_format          = vm["dump-format"].as<std::string>();
+            params.dump_queue_size      = vm["dump-queue"].as<std::size_t>();
+            params.splice               = vm.count("splice") == 1;
+            params.balance              = vm["balance"].as<std::string>();
+            params.eject_failures       = vm["eject-failures"].as<unsigned>();
+            params.eject_time_s         = vm["eject-time"].as<long>();
+            params.proxy_protocol_in    = vm.count("proxy-protocol-in") == 1;
+            params.proxy_protocol_out   = vm.count("proxy-protocol-out") == 1;
+            params.udp                  = vm.count("udp") == 1;
+            params.udp_idle_timeout_s   = vm["udp-idle-timeout"].as<long>();
+            params.udp_max_flows        = vm["udp-max-flows"].as<std::size_t>();
+            params.udp_batch            = vm["udp-batch"].as<std::size_t>();
+            params.session_rate         = vm["session-rate"].as<double>();
+            params.client_rate          = vm["client-rate"].as<double>();
+            params.total_rate           = vm["total-rate"].as<double>();
+            params.rate_burst           = vm["rate-burst"].as<std::size_t>();
+            params.dns_ttl_s            = vm["dns-ttl"].as<long>();
+            params.dns_stale_s          = vm["dns-stale"].as<long>();
+            params.dns_negative_ttl_s   = vm["dns-negative-ttl"].as<long>();
+            params.upstream_pool_size   = vm["upstream-pool"].as<std::size_t>();
+            params.upstream_idle_timeout_s = vm["upstream-idle-timeout"].as<long>();
+            params.metrics_addr         = vm["metrics-addr"].as<std::string>();
+            params.metrics_port         = vm.count("metrics-port") ? vm["metrics-port"].as<std::string>() : "";
+
+            if (vm.count("http-remove-header"))
+            {
+                params.http_rules.remove_headers = vm["http-remove-header"].as<std::vector<std::string>>();
+            }
+
+            if (params.buffer_size == 0 || params.buffer_count == 0 || params.dump_queue_size == 0)
+            {
+                std::cout << "ERROR:  buffer-size, buffer-count and dump-queue must be greater than zero" << std::endl;
+                return EXIT_FAILURE;
+            }
+
+            if (params.connect_timeout_ms <= 0 || params.idle_read_timeout_s < 0 || params.idle_write_timeout_s < 0 || params.max_lifetime_s < 0 || params.drain_timeout_s < 0 ||
+                params.dns_ttl_s < 0 || params.dns_stale_s < 0 || params.dns_negative_ttl_s < 0)
+            {
+                std::cout << "ERROR:  connect-timeout must be greater than zero, and the other timeouts (and dns-ttl, dns-stale and dns-negative-ttl) must not be negative" << std::endl;
+                return EXIT_FAILURE;
+            }
+
+            if (params.session_rate < 0 || params.client_rate < 0 || params.total_rate < 0)
+            {
+                std::cout << "ERROR:  the rate limits must not be negative" << std::endl;
+                return EXIT_FAILURE;
+            }
+
+            if (params.udp_idle_timeout_s <= 0 || params.udp_max_flows == 0 || params.udp_batch == 0)
+            {
+                std::cout << "ERROR:  udp-idle-timeout, udp-max-flows and udp-batch must be greater than zero" << std::endl;
+                return EXIT_FAILURE;
+            }
+
+            if (params.dump_format != "text" && params.dump_format != "hex" && params.dump_format != "pcapng")
+            {
+                std::cout << "ERROR:  dump-format must be one of {text, hex, pcapng}" << std::endl;
+                return EXIT_FAILURE;
+            }
+
+            if (params.dump_format == "pcapng" && params.dump_file.empty())
+            {
+                std::cout << "ERROR:  dump-format pcapng requires a dump-file" << std::endl;
+                return EXIT_FAILURE;
+            }
+
+            if (params.balance != "round-robin" && params.balance != "least-connections" && params.balance != "hash")
+            {
+                std::cout << "ERROR:  balance must be one of {round-robin, least-connections, hash}" << std::endl;
+                return EXIT_FAILURE;
+            }
+
+            if (vm.count("destination"))
+            {
+                for (auto const& destination : vm["destination"].as<std::vector<std::string>>())
+                {
+                    // the port follows the last ':', and an IPv6 address may be wrapped in []
+                    auto const colon = destination.rfind(':');
+                    if (colon == std::string::npos || colon == 0 || colon + 1 == destination.size())
+                    {
+                        std::cout << "ERROR:  invalid --destination:  " << destination << std::endl;
+                        return EXIT_FAILURE;
+                    }
+
+                    Destination d;
+                    d.addr = destination.substr(0, colon);
+                    d.port = destination.substr(colon + 1);
+                    if (d.addr.size() > 2 && d.addr.front() == '[' && d.addr.back() == ']')
+                    {
+                        d.addr = d.addr.substr(1, d.addr.size() - 2);
+                    }
+                    params.more_destinations.push_back(d);
+                }
+            }
+
+            if (!GetRules(vm, "http-add-header",     ':', params.http_rules.add_headers)     ||
+                !GetRules(vm, "http-replace-header", ':', params.http_rules.replace_headers) ||
+                !GetRules(vm, "http-rewrite-path",   '=', params.http_rules.path_prefixes))
+            {
+                return EXIT_FAILURE;
+            }
+
+            if (params.splice && params.dump_traffic)
+            {
+                std::cout << "WARNING:  --splice has no effect unless --no-dump is also given" << std::endl;
+            }
+
+            if (params.threads == 0)
+            {
+                params.threads = std::max(1u, std::thread::hardware_concurrency());
+            }
+
+            if (vm.count("alloc-bench"))
+            {
+                return RunAllocBenchmark(params, vm["alloc-bench"].as<std::size_t>());
+            }
+
+            if (vm.count("bench"))
+            {
+                RelayBenchParameters bench;
+                bench.sizes       = vm.count("bench-size") ? vm["bench-size"].as<std::vector<std::size_t>>() : std::vector<std::size_t>{64, 16384};
+                bench.connections = vm["bench-connections"].as<std::size_t>();
+                bench.duration_s  = vm["bench-duration"].as<long>();
+
+                // an echo is written in full before it is read back, so it must fit in the socket
+                // buffers along the way
+                auto const tooBig = [](std::size_t size) { return size == 0 || size > 1024 * 1024; };
+                if (bench.connections == 0 || bench.duration_s <= 0 || std::any_of(bench.sizes.begin(), bench.sizes.end(), tooBig))
+                {
+                    std::cout << "ERROR:  bench-connections and bench-duration must be greater than zero, and each bench-size from 1 byte to 1 MB" << std::endl;
+                    return EXIT_FAILURE;
+                }
+
+                return RunRelayBenchmark(params, bench);
+            }
+
+            if (vm.count("rate-check"))
+            {
+                auto const rates    = params.session_rate > 0 ? std::vector<double>{params.session_rate} : std::vector<double>{10e6, 50e6, 200e6, 1000e6};
+                auto const duration = vm["bench-duration"].as<long>();
+                if (duration <= 0)
+                {
+                    std::cout << "ERROR:  bench-duration must be greater than zero" << std::endl;
+                    return EXIT_FAILURE;
+                }
+
+                return RunRateCheck(params, rates, duration);
+            }
+
+            if (params.udp)
+            {
+                auto relay = std::make_shared<UdpRelay>(io_service, params);
+                relay->Start();
+            }
+            else
+            {
+                // create our proxy object
+                auto proxy = std::make_shared<Proxy>(io_service, params);
+                proxy->Start();
+            }
         }
         else
         {
-            return DisplayUsage();
+            return DisplayUsage(desc);
         }
 
         // run to completion
@@ -0,0 +1,171 @@
+#include "stdafx.h"
+#include "metrics.h"
+#include "alloc_counter.h"
+#include <sstream>
+#include <stdexcept>
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+unsigned long long const WorkerMetrics::CONNECT_BUCKET_US[WorkerMetrics::CONNECT_BUCKETS] =
+{
+    500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 5000000
+};
+
+
+namespace
+{
+    typedef Counter DirectionMetrics::*DirectionCounter;
+
+    char const* const DIRECTIONS[] = { "client_to_server", "server_to_client" };
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto Header(std::ostringstream& os, char const* name, char const* type, char const* help) -> void
+    {
+        os << "# HELP " << name << " " << help << "\n";
+        os << "# TYPE " << name << " " << type << "\n";
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto Seconds(unsigned long long us) -> double
+    {
+        return us / 1000000.0;
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto WorkerMetrics::RecordConnect(unsigned long long us) -> void
+{
+    connects.Add(1);
+    connect_us.Add(us);
+
+    std::size_t bucket = 0;
+    while (bucket < CONNECT_BUCKETS && us > CONNECT_BUCKET_US[bucket]) { ++bucket; }
+    connect_buckets[bucket].Add(1);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+ProxyMetrics::ProxyMetrics(std::size_t workers)
+{
+    if (workers == 0) { throw std::invalid_argument("ProxyMetrics:  there must be at least one worker"); }
+
+    for (std::size_t i = 0; i < workers; ++i)
+    {
+        mWorkers.emplace_back(new WorkerMetrics);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto ProxyMetrics::GetWorker(std::size_t index) -> WorkerMetrics&
+{
+    return *mWorkers[index % mWorkers.size()];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Every sample of a metric must be written together, so each one loops over all of the workers
+// (or sessions).  The workers carry on updating their counters while we read them, so the totals
+// are not a consistent snapshot - but each counter is.
+//
+auto ProxyMetrics::Render(Sessions const& sessions) const -> std::string
+{
+    std::ostringstream os;
+
+    auto sum = [this](Counter WorkerMetrics::*counter) -> unsigned long long
+    {
+        unsigned long long total = 0;
+        for (auto& worker : mWorkers) { total += ((*worker).*counter).Get(); }
+        return total;
+    };
+
+    auto sumDirection = [this](bool clientToServer, DirectionCounter counter) -> unsigned long long
+    {
+        unsigned long long total = 0;
+        for (auto& worker : mWorkers) { total += ((clientToServer ? worker->client_to_server : worker->server_to_client).*counter).Get(); }
+        return total;
+    };
+
+    struct Family { char const* name; char const* help; DirectionCounter counter; bool seconds; };
+    Family const families[] =
+    {
+        { "bytes_total",                "Bytes relayed.",                                           &DirectionMetrics::bytes,               false },
+        { "reads_total",                "Reads from the sending side.",                             &DirectionMetrics::reads,               false },
+        { "writes_total",               "Writes to the receiving side.",                            &DirectionMetrics::writes,              false },
+        { "write_blocked_seconds_total","Time that writes to the receiving side were outstanding.", &DirectionMetrics::write_blocked_us,    true  },
+    };
+
+    // totals across all sessions
+    for (auto const& family : families)
+    {
+        auto const name = std::string("tcpproxy_") + family.name;
+        Header(os, name.c_str(), "counter", family.help);
+        for (int d = 0; d < 2; ++d)
+        {
+            auto const value = sumDirection(d == 0, family.counter);
+            os << name << "{direction=\"" << DIRECTIONS[d] << "\"} ";
+            if (family.seconds) { os << Seconds(value); } else { os << value; }
+            os << "\n";
+        }
+    }
+
+    Header(os, "tcpproxy_sessions_opened_total", "counter", "Sessions accepted.");
+    os << "tcpproxy_sessions_opened_total " << sum(&WorkerMetrics::sessions_opened) << "\n";
+
+    Header(os, "tcpproxy_sessions_closed_total", "counter", "Sessions closed.");
+    os << "tcpproxy_sessions_closed_total " << sum(&WorkerMetrics::sessions_closed) << "\n";
+
+    Header(os, "tcpproxy_sessions_active", "gauge", "Sessions currently open.");
+    os << "tcpproxy_sessions_active " << sessions.size() << "\n";
+
+    Header(os, "tcpproxy_connect_failures_total", "counter", "Failed attempts to resolve or connect to the destination.");
+    os << "tcpproxy_connect_failures_total " << sum(&WorkerMetrics::connect_failures) << "\n";
+
+    Header(os, "tcpproxy_session_timeouts_total", "counter", "Sessions closed because they were idle, blocked or had reached their maximum lifetime.");
+    os << "tcpproxy_session_timeouts_total{reason=\"idle_read\"} "  << sum(&WorkerMetrics::idle_read_timeouts)  << "\n";
+    os << "tcpproxy_session_timeouts_total{reason=\"idle_write\"} " << sum(&WorkerMetrics::idle_write_timeouts) << "\n";
+    os << "tcpproxy_session_timeouts_total{reason=\"lifetime\"} "   << sum(&WorkerMetrics::lifetime_timeouts)   << "\n";
+
+    Header(os, "tcpproxy_proxy_header_errors_total", "counter", "Sessions closed because the client's PROXY protocol header was missing or invalid.");
+    os << "tcpproxy_proxy_header_errors_total " << sum(&WorkerMetrics::proxy_header_errors) << "\n";
+
+    Header(os, "tcpproxy_heap_allocations_total", "counter", "Heap allocations made by the whole process.");
+    os << "tcpproxy_heap_allocations_total " << HeapAllocations() << "\n";
+
+    // the histogram buckets are cumulative
+    Header(os, "tcpproxy_connect_seconds", "histogram", "Time taken to resolve and connect to the destination.");
+    unsigned long long cumulative = 0;
+    for (std::size_t i = 0; i <= WorkerMetrics::CONNECT_BUCKETS; ++i)
+    {
+        for (auto& worker : mWorkers) { cumulative += worker->connect_buckets[i].Get(); }
+
+        os << "tcpproxy_connect_seconds_bucket{le=\"";
+        if (i < WorkerMetrics::CONNECT_BUCKETS) { os << Seconds(WorkerMetrics::CONNECT_BUCKET_US[i]); } else { os << "+Inf"; }
+        os << "\"} " << cumulative << "\n";
+    }
+    os << "tcpproxy_connect_seconds_sum "   << Seconds(sum(&WorkerMetrics::connect_us)) << "\n";
+    os << "tcpproxy_connect_seconds_count " << sum(&WorkerMetrics::connects) << "\n";
+
+    // and each active session
+    for (auto const& family : families)
+    {
+        auto const name = std::string("tcpproxy_session_") + family.name;
+        Header(os, name.c_str(), "counter", family.help);
+        for (auto const& session : sessions)
+        {
+            for (int d = 0; d < 2; ++d)
+            {
+                auto const value = ((d == 0 ? session.second->client_to_server : session.second->server_to_client).*family.counter).Get();
+                os << name << "{session=\"" << session.first << "\",direction=\"" << DIRECTIONS[d] << "\"} ";
+                if (family.seconds) { os << Seconds(value); } else { os << value; }
+                os << "\n";
+            }
+        }
+    }
+
+    Header(os, "tcpproxy_session_connect_seconds", "gauge", "Time taken to resolve and connect to the destination.");
+    for (auto const& session : sessions)
+    {
+        os << "tcpproxy_session_connect_seconds{session=\"" << session.first << "\"} " << Seconds(session.second->connect_us.Get()) << "\n";
+    }
+
+    return os.str();
+}
@@ -0,0 +1,96 @@
+#ifndef INCLUDED_METRICS_HEADER
+#define INCLUDED_METRICS_HEADER
+
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <utility>
+#include <boost/noncopyable.hpp>
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// A counter that only ever has a single writer (the thread that runs the session or worker that
+// it belongs to), but may be read from any thread.  With only one writer, an increment doesn't
+// need a locked read-modify-write - a relaxed load and store is enough.
+//
+class Counter : private boost::noncopyable
+{
+public:
+    Counter() : mValue(0) {}
+
+    auto Add(unsigned long long n) -> void  { mValue.store(mValue.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+    auto Get() const -> unsigned long long  { return mValue.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<unsigned long long> mValue;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// one direction of the relay
+struct DirectionMetrics
+{
+    Counter     bytes;
+    Counter     reads;
+    Counter     writes;
+    Counter     write_blocked_us;   // time that writes to the receiving side were outstanding
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+struct SessionMetrics
+{
+    DirectionMetrics    client_to_server;
+    DirectionMetrics    server_to_client;
+    Counter             connect_us;     // how long it took to resolve and connect to the destination
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// the totals for every session (past and present) that has run on one worker thread
+struct WorkerMetrics
+{
+    // upper bounds of the connect latency histogram buckets, in micro-seconds
+    static std::size_t const CONNECT_BUCKETS = 12;
+    static unsigned long long const CONNECT_BUCKET_US[CONNECT_BUCKETS];
+
+    auto RecordConnect(unsigned long long us) -> void;
+
+    DirectionMetrics    client_to_server;
+    DirectionMetrics    server_to_client;
+    Counter             sessions_opened;
+    Counter             sessions_closed;
+    Counter             connect_failures;
+    Counter             idle_read_timeouts;
+    Counter             idle_write_timeouts;
+    Counter             lifetime_timeouts;
+    Counter             proxy_header_errors;
+    Counter             connects;
+    Counter             connect_us;
+    Counter             connect_buckets[CONNECT_BUCKETS + 1];   // the last one is +Inf
+};
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// All of the proxy's metrics:  one WorkerMetrics per worker thread, each of which is only updated
+// from its own thread.  Render() may be called from any thread.
+//
+class ProxyMetrics : private boost::noncopyable
+{
+public:
+    typedef std::vector<std::pair<unsigned long long, std::shared_ptr<SessionMetrics const>>> Sessions;
+
+    explicit ProxyMetrics(std::size_t workers);
+
+    auto GetWorker(std::size_t index) -> WorkerMetrics&;
+
+    // the totals, plus the counters for each of the active 'sessions', in the Prometheus text
+    // exposition format
+    auto Render(Sessions const& sessions) const -> std::string;
+
+private:
+    std::vector<std::unique_ptr<WorkerMetrics>> mWorkers;
+};
+
+
+#endif  //INCLUDED_METRICS_HEADER
@@ -0,0 +1,203 @@
+#include "stdafx.h"
+#include "metrics_server.h"
+#include "utils.h"
+#include <set>
+#include <iostream>
+#include <sstream>
+
+#include <boost/asio.hpp>
+namespace ba = boost::asio;
+
+
+namespace
+{
+    // a scrape request is just a request line and a few headers
+    std::size_t const MAX_REQUEST = 8*1024;
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    struct Connection
+    {
+        explicit Connection(ba::io_service& io_service) : socket(io_service), request(MAX_REQUEST) {}
+
+        ba::ip::tcp::socket     socket;
+        ba::streambuf           request;
+        std::string             response;
+    };
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+class MetricsServer::Impl : public std::enable_shared_from_this<Impl>
+{
+public:
+    Impl(ba::io_service& io_service, ba::ip::tcp::endpoint const& endpoint, RenderHandler render);
+    auto Start() -> void;
+    auto Stop()  -> void;
+
+private:
+    auto StartAccept() -> void;
+    auto HandleAccept (std::shared_ptr<Connection> const& connection, boost::system::error_code const& error) -> void;
+    auto HandleRequest(std::shared_ptr<Connection> const& connection, boost::system::error_code const& error) -> void;
+    auto HandleWrite  (std::shared_ptr<Connection> const& connection) -> void;
+
+private:
+    ba::io_service&                         mIoService;
+    ba::ip::tcp::endpoint const             mEndpoint;
+    RenderHandler const                     mRender;
+    ba::ip::tcp::acceptor                   mAcceptor;
+    std::set<std::shared_ptr<Connection>>   mConnections;
+    bool                                    mStopped;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+MetricsServer::Impl::Impl(ba::io_service& io_service, ba::ip::tcp::endpoint const& endpoint, RenderHandler render)
+    : mIoService(io_service)
+    , mEndpoint (endpoint)
+    , mRender   (render)
+    , mAcceptor {io_service}
+    , mStopped  {false}
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto MetricsServer::Impl::Start() -> void
+{
+    std::cout << TimeStamp() << "serving metrics on:  http://[" << mEndpoint.address().to_string() << "]:" << mEndpoint.port() << "/metrics" << std::endl;
+
+    mAcceptor.open(mEndpoint.protocol());
+    mAcceptor.set_option(ba::ip::tcp::acceptor::reuse_address(true));
+    mAcceptor.bind(mEndpoint);
+    mAcceptor.listen();
+
+    StartAccept();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Closes the acceptor and any scrapes still in progress, so that the io_service can run out of
+// work.  Must be called on the io_service's thread.
+//
+auto MetricsServer::Impl::Stop() -> void
+{
+    mStopped = true;
+
+    boost::system::error_code ignored;
+    mAcceptor.close(ignored);
+    for (auto& connection : mConnections)
+    {
+        connection->socket.close(ignored);
+    }
+    mConnections.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto MetricsServer::Impl::StartAccept() -> void
+{
+    auto connection = std::make_shared<Connection>(mIoService);
+    mAcceptor.async_accept(
+        connection->socket,
+        std::bind(&Impl::HandleAccept, shared_from_this(), connection, std::placeholders::_1));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto MetricsServer::Impl::HandleAccept(std::shared_ptr<Connection> const& connection, boost::system::error_code const& error) -> void
+{
+    if (mStopped) { return; }
+
+    if (!error)
+    {
+        mConnections.insert(connection);
+        ba::async_read_until(
+            connection->socket,
+            connection->request,
+            "\r\n\r\n",
+            std::bind(&Impl::HandleRequest, shared_from_this(), connection, std::placeholders::_1));
+    }
+    else
+    {
+        std::cout << TimeStamp() << "WARNING:  MetricsServer::HandleAccept():  failed:  " << error.message() << std::endl;
+    }
+
+    StartAccept();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto MetricsServer::Impl::HandleRequest(std::shared_ptr<Connection> const& connection, boost::system::error_code const& error) -> void
+{
+    if (mStopped) { return; }
+
+    if (error)
+    {
+        // including requests that are bigger than MAX_REQUEST
+        boost::system::error_code ignored;
+        connection->socket.close(ignored);
+        mConnections.erase(connection);
+        return;
+    }
+
+    std::istream is(&connection->request);
+    std::string method, target;
+    is >> method >> target;
+
+    std::string status = "200 OK";
+    std::string body;
+    if (method != "GET")
+    {
+        status = "405 Method Not Allowed";
+    }
+    else if (target != "/metrics" && target.compare(0, 9, "/metrics?") != 0)
+    {
+        status = "404 Not Found";
+    }
+    else
+    {
+        body = mRender();
+    }
+
+    std::ostringstream response;
+    response
+        << "HTTP/1.1 " << status << "\r\n"
+        << "Content-Type: text/plain; version=0.0.4\r\n"
+        << "Content-Length: " << body.size() << "\r\n"
+        << "Connection: close\r\n"
+        << "\r\n"
+        << body;
+    connection->response = response.str();
+
+    ba::async_write(
+        connection->socket,
+        ba::buffer(connection->response),
+        std::bind(&Impl::HandleWrite, shared_from_this(), connection));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto MetricsServer::Impl::HandleWrite(std::shared_ptr<Connection> const& connection) -> void
+{
+    boost::system::error_code ignored;
+    connection->socket.shutdown(ba::ip::tcp::socket::shutdown_both, ignored);
+    connection->socket.close(ignored);
+    mConnections.erase(connection);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+MetricsServer::MetricsServer(ba::io_service& io_service, ba::ip::tcp::endpoint const& endpoint, RenderHandler render)
+    : mImpl(std::make_shared<Impl>(io_service, endpoint, render))
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+MetricsServer::~MetricsServer()
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto MetricsServer::Start() -> void
+{
+    mImpl->Start();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto MetricsServer::Stop() -> void
+{
+    mImpl->Stop();
+}
@@ -0,0 +1,35 @@
+#ifndef INCLUDED_METRICS_SERVER_HEADER
+#define INCLUDED_METRICS_SERVER_HEADER
+
+
+#include <memory>
+#include <string>
+#include <functional>
+#include <boost/noncopyable.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// A tiny HTTP server for Prometheus to scrape.  Every GET of /metrics is answered with whatever
+// 'render' returns, and the connection is then closed.  Runs entirely on the io_service that it is
+// given - so it never touches the relay threads.
+//
+class MetricsServer : private boost::noncopyable
+{
+public:
+    typedef std::function<std::string()> RenderHandler;
+
+    MetricsServer(boost::asio::io_service& io_service, boost::asio::ip::tcp::endpoint const& endpoint, RenderHandler render);
+    ~MetricsServer();
+
+    auto Start() -> void;
+    auto Stop()  -> void;
+
+private:
+    class Impl;
+    std::shared_ptr<Impl> mImpl;
+};
+
+
+#endif  //INCLUDED_METRICS_SERVER_HEADER
@@ -0,0 +1,286 @@
+#include "stdafx.h"
+#include "pcapng_writer.h"
+#include <ostream>
+#include <cstring>
+#include <algorithm>
+
+namespace ba = boost::asio;
+
+
+namespace
+{
+    // pcapng block types
+    std::uint32_t const SECTION_HEADER_BLOCK        = 0x0A0D0D0A;
+    std::uint32_t const INTERFACE_DESCRIPTION_BLOCK = 0x00000001;
+    std::uint32_t const ENHANCED_PACKET_BLOCK       = 0x00000006;
+    std::uint32_t const BYTE_ORDER_MAGIC            = 0x1A2B3C4D;
+    std::uint16_t const LINKTYPE_RAW                = 101;
+
+    // TCP flags
+    std::uint8_t const TCP_FIN = 0x01;
+    std::uint8_t const TCP_SYN = 0x02;
+    std::uint8_t const TCP_PSH = 0x08;
+    std::uint8_t const TCP_ACK = 0x10;
+
+    // keep each synthesized packet comfortably inside the 64 KB limit of an IPv4 datagram
+    std::size_t const MAX_SEGMENT = 60*1024;
+
+    // write the buffered blocks out once we have collected this much
+    std::size_t const FLUSH_THRESHOLD = 1024*1024;
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // block fields are written in host byte order (the reader uses BYTE_ORDER_MAGIC to work out
+    // which that is).  Packet headers are always big-endian.
+    //
+    auto PutHost16(std::vector<char>& v, std::uint16_t x) -> void { char b[2]; std::memcpy(b, &x, 2); v.insert(v.end(), b, b + 2); }
+    auto PutHost32(std::vector<char>& v, std::uint32_t x) -> void { char b[4]; std::memcpy(b, &x, 4); v.insert(v.end(), b, b + 4); }
+    auto PutHost64(std::vector<char>& v, std::uint64_t x) -> void { char b[8]; std::memcpy(b, &x, 8); v.insert(v.end(), b, b + 8); }
+
+    auto PutBig16(std::vector<char>& v, std::uint16_t x) -> void
+    {
+        v.push_back(static_cast<char>(x >> 8));
+        v.push_back(static_cast<char>(x));
+    }
+
+    auto PutBig32(std::vector<char>& v, std::uint32_t x) -> void
+    {
+        PutBig16(v, static_cast<std::uint16_t>(x >> 16));
+        PutBig16(v, static_cast<std::uint16_t>(x));
+    }
+
+    auto Pad(std::vector<char>& v) -> void
+    {
+        while (v.size() % 4 != 0) { v.push_back(0); }
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto Ipv4Checksum(char const* header, std::size_t size) -> std::uint16_t
+    {
+        std::uint32_t sum = 0;
+        for (std::size_t i = 0; i + 1 < size; i += 2)
+        {
+            sum += (static_cast<std::uint8_t>(header[i]) << 8) | static_cast<std::uint8_t>(header[i + 1]);
+        }
+        while (sum >> 16) { sum = (sum & 0xffff) + (sum >> 16); }
+        return static_cast<std::uint16_t>(~sum);
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // both ends of a synthesized packet must be from the same address family
+    auto ToV6(ba::ip::address const& address) -> ba::ip::address
+    {
+        return address.is_v6() ? address : ba::ip::address(ba::ip::address_v6::v4_mapped(address.to_v4()));
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+PcapngWriter::PcapngWriter(std::ostream& os)
+    : mOut(os)
+{
+    mBlocks.reserve(FLUSH_THRESHOLD + 2*MAX_SEGMENT);
+
+    // section header:  byte order magic, version 1.0, unknown section length
+    std::vector<char> shb;
+    PutHost32(shb, BYTE_ORDER_MAGIC);
+    PutHost16(shb, 1);
+    PutHost16(shb, 0);
+    PutHost64(shb, static_cast<std::uint64_t>(-1));
+    WriteBlock(SECTION_HEADER_BLOCK, shb);
+
+    // one interface, carrying raw IP packets.  The default timestamp resolution is micro-seconds.
+    std::vector<char> idb;
+    PutHost16(idb, LINKTYPE_RAW);
+    PutHost16(idb, 0);
+    PutHost32(idb, 0);
+    WriteBlock(INTERFACE_DESCRIPTION_BLOCK, idb);
+
+    Flush();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+PcapngWriter::~PcapngWriter()
+{
+    Flush();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto PcapngWriter::Open(long long timestamp_us, unsigned long long session, ba::ip::tcp::endpoint const& client, ba::ip::tcp::endpoint const& server) -> void
+{
+    Flow flow;
+    flow.client_addr = client.address();
+    flow.server_addr = server.address();
+    flow.client_port = client.port();
+    flow.server_port = server.port();
+    flow.client_seq  = 0;
+    flow.server_seq  = 0;
+
+    if (flow.client_addr.is_v6() != flow.server_addr.is_v6())
+    {
+        flow.client_addr = ToV6(flow.client_addr);
+        flow.server_addr = ToV6(flow.server_addr);
+    }
+
+    auto& f = mFlows[session] = flow;
+
+    // SYN, SYN/ACK, ACK - each SYN uses up one sequence number
+    WritePacket(timestamp_us, f, true,  TCP_SYN, nullptr, 0);
+    ++f.client_seq;
+    WritePacket(timestamp_us, f, false, TCP_SYN | TCP_ACK, nullptr, 0);
+    ++f.server_seq;
+    WritePacket(timestamp_us, f, true,  TCP_ACK, nullptr, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Every session's open record is written (see TrafficDump), so there is always a flow
+//
+auto PcapngWriter::Data(long long timestamp_us, unsigned long long session, bool clientToServer, char const* data, std::size_t size) -> void
+{
+    auto itr = mFlows.find(session);
+    if (itr == mFlows.end()) { return; }
+
+    auto& flow = itr->second;
+    while (size > 0)
+    {
+        auto const n = std::min(size, MAX_SEGMENT);
+        WritePacket(timestamp_us, flow, clientToServer, TCP_PSH | TCP_ACK, data, n);
+        (clientToServer ? flow.client_seq : flow.server_seq) += static_cast<std::uint32_t>(n);
+
+        data += n;
+        size -= n;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto PcapngWriter::Close(long long timestamp_us, unsigned long long session) -> void
+{
+    auto itr = mFlows.find(session);
+    if (itr == mFlows.end()) { return; }
+
+    // FIN/ACK from each side, then the final ACK
+    auto& flow = itr->second;
+    WritePacket(timestamp_us, flow, true,  TCP_FIN | TCP_ACK, nullptr, 0);
+    ++flow.client_seq;
+    WritePacket(timestamp_us, flow, false, TCP_FIN | TCP_ACK, nullptr, 0);
+    ++flow.server_seq;
+    WritePacket(timestamp_us, flow, true,  TCP_ACK, nullptr, 0);
+
+    mFlows.erase(itr);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto PcapngWriter::Flush() -> void
+{
+    if (!mBlocks.empty())
+    {
+        mOut.write(mBlocks.data(), mBlocks.size());
+        mBlocks.clear();
+    }
+    mOut.flush();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Sequence numbers wrap around, just as they do on the wire
+//
+auto PcapngWriter::Skip(unsigned long long session, bool clientToServer, unsigned long long size) -> void
+{
+    if (size == 0) { return; }
+
+    auto itr = mFlows.find(session);
+    if (itr == mFlows.end()) { return; }
+
+    auto& flow = itr->second;
+    (clientToServer ? flow.client_seq : flow.server_seq) += static_cast<std::uint32_t>(size);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto PcapngWriter::WritePacket(long long timestamp_us, Flow const& flow, bool clientToServer, std::uint8_t flags, char const* payload, std::size_t size) -> void
+{
+    auto const& src      = clientToServer ? flow.client_addr : flow.server_addr;
+    auto const& dst      = clientToServer ? flow.server_addr : flow.client_addr;
+    auto const  src_port = clientToServer ? flow.client_port : flow.server_port;
+    auto const  dst_port = clientToServer ? flow.server_port : flow.client_port;
+    auto const  seq      = clientToServer ? flow.client_seq  : flow.server_seq;
+    auto const  ack      = clientToServer ? flow.server_seq  : flow.client_seq;
+
+    std::size_t const TCP_HEADER = 20;
+    mPacket.clear();
+
+    // IP header
+    if (src.is_v4())
+    {
+        auto const s = src.to_v4().to_bytes();
+        auto const d = dst.to_v4().to_bytes();
+
+        PutBig16(mPacket, 0x4500);                                          // version 4, 20 byte header
+        PutBig16(mPacket, static_cast<std::uint16_t>(20 + TCP_HEADER + size));
+        PutBig32(mPacket, 0x00004000);                                      // id 0, don't fragment
+        PutBig16(mPacket, 0x4006);                                          // TTL 64, TCP
+        PutBig16(mPacket, 0);                                               // checksum (below)
+        mPacket.insert(mPacket.end(), s.begin(), s.end());
+        mPacket.insert(mPacket.end(), d.begin(), d.end());
+
+        auto const checksum = Ipv4Checksum(mPacket.data(), 20);
+        mPacket[10] = static_cast<char>(checksum >> 8);
+        mPacket[11] = static_cast<char>(checksum);
+    }
+    else
+    {
+        auto const s = src.to_v6().to_bytes();
+        auto const d = dst.to_v6().to_bytes();
+
+        PutBig32(mPacket, 0x60000000);                                      // version 6
+        PutBig16(mPacket, static_cast<std::uint16_t>(TCP_HEADER + size));
+        PutBig16(mPacket, 0x0640);                                          // TCP, hop limit 64
+        mPacket.insert(mPacket.end(), s.begin(), s.end());
+        mPacket.insert(mPacket.end(), d.begin(), d.end());
+    }
+
+    // TCP header
+    PutBig16(mPacket, src_port);
+    PutBig16(mPacket, dst_port);
+    PutBig32(mPacket, seq);
+    PutBig32(mPacket, (flags & TCP_ACK) ? ack : 0);
+    mPacket.push_back(0x50);                                                // 20 byte header
+    mPacket.push_back(static_cast<char>(flags));
+    PutBig16(mPacket, 0xffff);                                              // window
+    PutBig16(mPacket, 0);                                                   // checksum (not calculated)
+    PutBig16(mPacket, 0);                                                   // urgent pointer
+
+    // enhanced packet block - written straight into the output buffer
+    auto const captured = static_cast<std::uint32_t>(mPacket.size() + size);
+    auto const padded   = (captured + 3) & ~3u;
+    auto const total    = 32 + padded;
+    auto const ts       = static_cast<std::uint64_t>(timestamp_us);
+
+    PutHost32(mBlocks, ENHANCED_PACKET_BLOCK);
+    PutHost32(mBlocks, total);
+    PutHost32(mBlocks, 0);                                                  // interface id
+    PutHost32(mBlocks, static_cast<std::uint32_t>(ts >> 32));
+    PutHost32(mBlocks, static_cast<std::uint32_t>(ts));
+    PutHost32(mBlocks, captured);
+    PutHost32(mBlocks, captured);
+    mBlocks.insert(mBlocks.end(), mPacket.begin(), mPacket.end());
+    if (size > 0) { mBlocks.insert(mBlocks.end(), payload, payload + size); }
+    Pad(mBlocks);
+    PutHost32(mBlocks, total);
+
+    if (mBlocks.size() >= FLUSH_THRESHOLD)
+    {
+        mOut.write(mBlocks.data(), mBlocks.size());
+        mBlocks.clear();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto PcapngWriter::WriteBlock(std::uint32_t type, std::vector<char> const& body) -> void
+{
+    auto const padded = (body.size() + 3) & ~std::size_t(3);
+    auto const total  = static_cast<std::uint32_t>(12 + padded);
+
+    PutHost32(mBlocks, type);
+    PutHost32(mBlocks, total);
+    mBlocks.insert(mBlocks.end(), body.begin(), body.end());
+    Pad(mBlocks);
+    PutHost32(mBlocks, total);
+}
@@ -0,0 +1,65 @@
+#ifndef INCLUDED_PCAPNG_WRITER_HEADER
+#define INCLUDED_PCAPNG_WRITER_HEADER
+
+
+#include <map>
+#include <vector>
+#include <iosfwd>
+#include <cstdint>
+#include <boost/noncopyable.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Writes proxied streams as a pcapng file that Wireshark can open.  We only ever see the payload,
+// so each session is written as a synthesized TCP connection between the client and the
+// destination:  a 3-way handshake when the session opens, one PSH/ACK segment per chunk (with
+// proper sequence and acknowledgement numbers), and a FIN exchange when it closes.
+//
+// Packets are written as raw IPv4/IPv6 (LINKTYPE_RAW) with micro-second timestamps.  TCP
+// checksums are left as zero - Wireshark does not validate them by default.
+//
+// Bytes that weren't captured are skipped over in the sequence numbers, so that Wireshark shows
+// the gap ("previous segment not captured") rather than stitching the stream together.
+//
+// Blocks are collected in memory and written out in large pieces - call Flush() when idle.
+//
+class PcapngWriter : private boost::noncopyable
+{
+public:
+    // writes the section header and interface description blocks
+    explicit PcapngWriter(std::ostream& os);
+    ~PcapngWriter();
+
+    auto Open (long long timestamp_us, unsigned long long session, boost::asio::ip::tcp::endpoint const& client, boost::asio::ip::tcp::endpoint const& server) -> void;
+    auto Data (long long timestamp_us, unsigned long long session, bool clientToServer, char const* data, std::size_t size) -> void;
+    auto Close(long long timestamp_us, unsigned long long session) -> void;
+
+    // 'size' bytes from the client (or from the server) weren't captured
+    auto Skip(unsigned long long session, bool clientToServer, unsigned long long size) -> void;
+
+    auto Flush() -> void;
+
+private:
+    struct Flow
+    {
+        boost::asio::ip::address    client_addr;
+        boost::asio::ip::address    server_addr;
+        std::uint16_t               client_port;
+        std::uint16_t               server_port;
+        std::uint32_t               client_seq;     // next sequence number to be sent by the client
+        std::uint32_t               server_seq;     // next sequence number to be sent by the server
+    };
+
+    auto WritePacket(long long timestamp_us, Flow const& flow, bool clientToServer, std::uint8_t flags, char const* payload, std::size_t size) -> void;
+    auto WriteBlock(std::uint32_t type, std::vector<char> const& body) -> void;
+
+private:
+    std::ostream&                           mOut;
+    std::vector<char>                       mBlocks;
+    std::vector<char>                       mPacket;
+    std::map<unsigned long long, Flow>      mFlows;
+};
+
+
+#endif  //INCLUDED_PCAPNG_WRITER_HEADER
@@ -1,25 +1,45 @@
 #include "stdafx.h"
 #include "proxy.h"
+#include "session.h"
+#include "io_service_pool.h"
+#include "traffic_dump.h"
+#include "metrics.h"
+#include "metrics_server.h"
+#include "upstream_pool.h"
+#include "load_balancer.h"
+#include "dns_cache.h"
+#include "block_pool.h"
+#include "timer_wheel.h"
+#include "rate_limiter.h"
+#include "handoff.h"
+#include "utils.h"
 #include <memory>
+#include <set>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <iostream>
+#include <algorithm>
 
 #include <boost/asio.hpp>
 namespace ba = boost::asio;
 
-#include <boost/date_time/posix_time/posix_time.hpp>
-namespace pt = boost::posix_time;
-
-#include <boost/algorithm/string/replace.hpp>
-
 
 namespace
 {
+    // the resolution of the sessions' timeouts
+    auto const TIMER_TICK = std::chrono::milliseconds(10);
+
     ///////////////////////////////////////////////////////////////////////////////////////////////
-    auto TimeStamp() -> std::string
+    // an acceptor, along with the io_service that runs its handlers
+    struct Listener
     {
-        std::string t = pt::to_simple_string(pt::microsec_clock::local_time().time_of_day());
-        t.resize(12, '0');
-        return t.append(1, ' ');
-    }
+        Listener(ba::io_service& io_service, std::size_t worker) : io_service(io_service), worker(worker), acceptor(io_service) {}
+
+        ba::io_service&         io_service;
+        std::size_t const       worker;     // when each pool thread has its own listener
+        ba::ip::tcp::acceptor   acceptor;
+    };
 }
 
 
@@ -32,16 +52,19 @@ public:
     auto Stop()  -> void;
 
 private:
+    auto HandleSignal(boost::system::error_code const& error) -> void;
     auto HandleStop() -> void;
-    auto EstablishNewConnections() -> void;
-
-    auto HandleDestRead     (boost::system::error_code const& error, std::size_t bytes_transferred) -> void;
-    auto HandleListenRead   (boost::system::error_code const& error, std::size_t bytes_transferred) -> void;
-    auto HandleDestWrite    (boost::system::error_code const& error)                                -> void;
-    auto HandleListenWrite  (boost::system::error_code const& error)                                -> void;
-
-    //auto StartAccept() -> void;
-    //auto HandleAccept(boost::system::error_code const& error) -> void;
+    auto HandleDrainTimeout(boost::system::error_code const& error) -> void;
+    auto CloseSessions() -> void;
+    auto Finish() -> void;
+    auto StopPool() -> void;
+
+    auto OpenListener(ba::io_service& io_service, std::size_t worker, ba::ip::tcp::endpoint const& endpoint, bool reusePort) -> void;
+    auto AdoptListeners(std::vector<HandoffReceiver::NativeHandle> const& handles, ba::ip::tcp::endpoint const& endpoint, bool perWorker) -> void;
+    auto StartAccept(Listener& listener) -> void;
+    auto HandleAccept(Listener& listener, std::shared_ptr<Session> const& session, boost::system::error_code const& error) -> void;
+    auto HandleSessionClosed(std::shared_ptr<Session> const& session) -> void;
+    auto RenderMetrics() -> std::string;
 
 private:
     Proxy*          const   mSelf;
@@ -49,29 +72,71 @@ private:
 
     ba::io_service&         mIoService;
     ba::signal_set          mSignals;
-    ba::ip::tcp::acceptor   mAcceptor;
-    ba::ip::tcp::socket     mListenSocket;
-    ba::ip::tcp::socket     mDestSocket;
+    ba::steady_timer        mDrainTimer;
+
+    // with a single listener, sessions are handed out round-robin across the pool.  With one
+    // SO_REUSEPORT listener per pool thread, each session stays on the thread that accepted it.
+    std::vector<std::unique_ptr<Listener>>  mListeners;
+    std::unique_ptr<IoServicePool>          mPool;
+    std::atomic<std::size_t>                mNextWorker;
+    bool                                    mRoundRobin;
+
+    // hands the listeners over to the next process (if enabled)
+    std::unique_ptr<HandoffServer>          mHandoff;
+
+    // one dump producer per worker thread
+    std::shared_ptr<TrafficDump>            mDump;
+
+    // one set of totals per worker thread, and (optionally) a server to scrape them from
+    std::shared_ptr<ProxyMetrics>           mMetrics;
+    std::unique_ptr<MetricsServer>          mMetricsServer;
 
-    bool                    mClosingListenSocket;
-    bool                    mClosingDestSocket;
-    bool                    mShuttingDown;
+    // shared by every session
+    std::shared_ptr<LoadBalancer>           mBalancer;
+    std::shared_ptr<DnsCache>               mDns;
+    std::shared_ptr<RateLimiter>            mRateLimiter;
 
-    static int const        LENGTH_ = 16*1024;
-    char                    mListenData[LENGTH_];
-    char                    mDestData[LENGTH_];
+    // the recycled memory for each worker thread's sessions, and for their relay buffers
+    struct MemoryPools
+    {
+        explicit MemoryPools(std::size_t maxFree) : sessions(std::make_shared<BlockPool>(maxFree)), buffers(std::make_shared<BlockPool>(maxFree * 2)) {}
+
+        std::shared_ptr<BlockPool>  sessions;
+        std::shared_ptr<BlockPool>  buffers;        // two rings per session
+    };
+    std::vector<MemoryPools>                mMemoryPools;
+
+    // the sessions' timeouts, for each worker thread
+    std::vector<std::shared_ptr<TimerWheel>> mWheels;
+
+    // the pools of warm destination connections for each worker thread (if enabled)
+    std::vector<std::shared_ptr<UpstreamPools>> mUpstreamPools;
+
+    // sessions may be accepted and closed on any of the pool threads
+    std::mutex                              mMutex;
+    std::set<std::shared_ptr<Session>>      mSessions;
+    std::atomic<unsigned long long>         mNextSessionId;
+
+    // once shutting down, nothing more is accepted (though the sessions may be left to drain).
+    // Once closing, no more sessions are started at all.
+    std::atomic<bool>                       mShuttingDown;
+    bool                                    mClosingSessions;
+    bool                                    mFinished;
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 Proxy::Impl::Impl(Proxy* self,  ba::io_service& io_service, ProxyParameters const& params)
     : mSelf         {self}
-    , mIoService    {io_service}
-    , mParams       {params}
+    , mIoService    (io_service)
+    , mParams       (params)
     , mSignals      {io_service}
-    , mAcceptor     {io_service}
-    , mListenSocket {io_service}
-    , mDestSocket   {io_service}
+    , mDrainTimer   {io_service}
+    , mNextWorker   {0}
+    , mRoundRobin   {false}
+    , mNextSessionId{0}
     , mShuttingDown {false}
+    , mClosingSessions{false}
+    , mFinished     {false}
 {
 }
 
@@ -84,9 +149,162 @@ auto Proxy::Impl::Start() -> void
 #if defined (SIGQUIT)
     mSignals.add(SIGQUIT);
 #endif
-    mSignals.async_wait(std::bind(&Impl::HandleStop, shared_from_this()));
+    mSignals.async_wait(std::bind(&Impl::HandleSignal, shared_from_this(), std::placeholders::_1));
+
+    // resolve our listening address/port
+    std::cout << TimeStamp() << "resolving listening address:  [" << mParams.listen_addr << "]:" << mParams.listen_port << std::endl;
+    ba::ip::tcp::resolver           resolver(mIoService);
+    ba::ip::tcp::resolver::query    query   (mParams.listen_addr, mParams.listen_port);
+    ba::ip::tcp::endpoint           endpoint = *resolver.resolve(query);
+
+    // with more than one thread, the sessions are run on a pool of io_services.  The acceptor(s)
+    // stay open for the lifetime of the proxy.
+    if (mParams.threads > 1)
+    {
+        std::cout << TimeStamp() << "starting " << mParams.threads << " worker threads" << std::endl;
+        mPool.reset(new IoServicePool(mParams.threads, mParams.pin_threads));
+    }
+
+    // a running proxy may hand us its listeners, so that there is never a moment where nobody is
+    // listening
+    auto const perWorker = mPool && mParams.reuse_port && !mParams.single_connection;
+    HandoffReceiver receiver;
+    if (!mParams.handoff_path.empty() && receiver.Receive(mParams.handoff_path))
+    {
+        std::cout << TimeStamp() << "taking over " << receiver.Listeners().size() << " listening socket(s) from the running process" << std::endl;
+        AdoptListeners(receiver.Listeners(), endpoint, perWorker);
+    }
+    else if (perWorker)
+    {
+        for (std::size_t i = 0; i < mPool->Size(); ++i)
+        {
+            OpenListener(mPool->GetIoService(i), i, endpoint, true);
+        }
+    }
+    else
+    {
+        OpenListener(mIoService, 0, endpoint, false);
+    }
+    mRoundRobin = mPool && !perWorker;
+
+    if (mParams.dump_traffic)
+    {
+        auto const format = mParams.dump_format == "hex"    ? DumpFormat::Hex
+                          : mParams.dump_format == "pcapng" ? DumpFormat::Pcapng
+                          :                                   DumpFormat::Text;
+        mDump = std::make_shared<TrafficDump>(mParams.dump_file, format, mPool ? mPool->Size() : 1, mParams.buffer_size, mParams.dump_queue_size);
+    }
+
+    mMetrics = std::make_shared<ProxyMetrics>(mPool ? mPool->Size() : 1);
+    for (std::size_t i = 0; i < (mPool ? mPool->Size() : 1); ++i)
+    {
+        mMemoryPools.push_back(MemoryPools(mParams.session_pool_size));
+        mWheels.push_back(std::make_shared<TimerWheel>(mPool ? mPool->GetIoService(i) : mIoService, TIMER_TICK));
+    }
+
+    if (!mParams.metrics_port.empty())
+    {
+        ba::ip::tcp::resolver::query metricsQuery(mParams.metrics_addr, mParams.metrics_port);
+        mMetricsServer.reset(new MetricsServer(mIoService, *resolver.resolve(metricsQuery), std::bind(&Impl::RenderMetrics, this)));
+        mMetricsServer->Start();
+    }
+
+    mBalancer = std::make_shared<LoadBalancer>(mParams);
+    if (mBalancer->Size() > 1)
+    {
+        std::cout << TimeStamp() << "balancing sessions across " << mBalancer->Size() << " destinations (" << mParams.balance << ")" << std::endl;
+    }
+
+    // the destinations are resolved on the main io_service
+    mDns = std::make_shared<DnsCache>(mIoService, mParams);
+    mDns->Start();
 
-    EstablishNewConnections();
+    mRateLimiter = std::make_shared<RateLimiter>(mParams);
+
+    if (mParams.upstream_pool_size > 0)
+    {
+        auto const workers = mPool ? mPool->Size() : 1;
+        std::cout << TimeStamp() << "keeping " << mParams.upstream_pool_size << " idle connection(s) open to each destination, per worker thread" << std::endl;
+        for (std::size_t i = 0; i < workers; ++i)
+        {
+            auto pools = std::make_shared<UpstreamPools>();
+            for (std::size_t d = 0; d < mBalancer->Size(); ++d)
+            {
+                pools->push_back(std::make_shared<UpstreamPool>(mPool ? mPool->GetIoService(i) : mIoService, mParams, mBalancer->GetDestination(d), mDns));
+                pools->back()->Start();
+            }
+            mUpstreamPools.push_back(pools);
+        }
+    }
+
+    for (auto& listener : mListeners)
+    {
+        StartAccept(*listener);
+    }
+
+    if (mPool)
+    {
+        mPool->Start();
+    }
+
+    // we are accepting, so the previous process can stop - and wait to do the same for the next one
+    receiver.Acknowledge();
+    if (!mParams.handoff_path.empty())
+    {
+        std::vector<HandoffServer::NativeHandle> handles;
+        for (auto& listener : mListeners)
+        {
+            handles.push_back(listener->acceptor.native_handle());
+        }
+
+        mHandoff.reset(new HandoffServer(mIoService, mParams.handoff_path, handles, std::bind(&Impl::HandleStop, this)));
+        mHandoff->Start();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto Proxy::Impl::OpenListener(ba::io_service& io_service, std::size_t worker, ba::ip::tcp::endpoint const& endpoint, bool reusePort) -> void
+{
+    std::unique_ptr<Listener> listener(new Listener(io_service, worker));
+
+    // open the acceptor with SO_REUSEADDR (and SO_REUSEPORT, so that the kernel spreads the incomming
+    // connections across all of the listeners)
+    listener->acceptor.open(endpoint.protocol());
+    listener->acceptor.set_option(ba::ip::tcp::acceptor::reuse_address(true));
+    if (reusePort)
+    {
+#if defined(SO_REUSEPORT)
+        typedef ba::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+        listener->acceptor.set_option(reuse_port(true));
+#else
+        throw std::runtime_error("SO_REUSEPORT is not supported on this platform");
+#endif
+    }
+    listener->acceptor.bind(endpoint);
+    listener->acceptor.listen();
+
+    mListeners.push_back(std::move(listener));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Accept on the listening sockets that were handed over by the previous process.  It must have
+// been run with the same listening options - but not necessarily with the same number of threads,
+// so with a listener per worker thread, any missing ones are opened here.
+//
+auto Proxy::Impl::AdoptListeners(std::vector<HandoffReceiver::NativeHandle> const& handles, ba::ip::tcp::endpoint const& endpoint, bool perWorker) -> void
+{
+    for (std::size_t i = 0; i < handles.size(); ++i)
+    {
+        auto const worker = perWorker ? i % mPool->Size() : 0;
+        std::unique_ptr<Listener> listener(new Listener(perWorker ? mPool->GetIoService(worker) : mIoService, worker));
+        listener->acceptor.assign(endpoint.protocol(), handles[i]);
+        mListeners.push_back(std::move(listener));
+    }
+
+    for (auto i = mListeners.size(); perWorker && i < mPool->Size(); ++i)
+    {
+        OpenListener(mPool->GetIoService(i), i, endpoint, true);
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -96,204 +314,256 @@ auto Proxy::Impl::Stop() -> void
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-auto Proxy::Impl::HandleStop() -> void
+auto Proxy::Impl::HandleSignal(boost::system::error_code const& error) -> void
 {
-    std::cout << TimeStamp() << "shutting down TcpProxy" << std::endl;
-    mShuttingDown = true;
+    // cancelled by Finish()
+    if (error == ba::error::operation_aborted) { return; }
 
-    std::cout << TimeStamp() << "closing acceptor" << std::endl;
-    mAcceptor.close();
-
-    std::cout << TimeStamp() << "closing listening connection (if any)" << std::endl;
-    mListenSocket.cancel();
+    // a second signal doesn't wait for the sessions to drain
+    if (mShuttingDown)
+    {
+        std::cout << TimeStamp() << "no longer waiting for the sessions to drain" << std::endl;
+        CloseSessions();
+        return;
+    }
 
-    std::cout << TimeStamp() << "closing destination connection (if any)" << std::endl;
-    mDestSocket.cancel();
+    HandleStop();
+    if (!mFinished)
+    {
+        mSignals.async_wait(std::bind(&Impl::HandleSignal, shared_from_this(), std::placeholders::_1));
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-// This method synchronously waits for a new incomming connection, then resolves and connects to the 
-// destination connection.
-//
-auto Proxy::Impl::EstablishNewConnections() -> void
+auto Proxy::Impl::HandleStop() -> void
 {
-    try
+    if (mShuttingDown) { return; }
+    std::cout << TimeStamp() << "shutting down TcpProxy" << std::endl;
+
+    std::size_t active;
     {
-        mShuttingDown        = false;
-        mClosingDestSocket   = false;
-        mClosingListenSocket = false;
+        std::lock_guard<std::mutex> lock(mMutex);
+        mShuttingDown = true;
+        active = mSessions.size();
+    }
 
+    // each acceptor must be closed on the thread that runs its handlers
+    std::cout << TimeStamp() << "closing acceptor" << std::endl;
+    for (auto& listener : mListeners)
+    {
+        auto& acceptor = listener->acceptor;
+        listener->io_service.post([&acceptor]() { boost::system::error_code ignored; acceptor.close(ignored); });
+    }
+
+    if (mHandoff)
+    {
+        mHandoff->Stop();
+    }
 
+    for (auto& pools : mUpstreamPools)
+    {
+        for (auto& upstream : *pools)
         {
-            // resolve our listening address/port
-            std::cout << TimeStamp() << "resolving listening address:  [" << mParams.listen_addr << "]:" << mParams.listen_port << std::endl;
-            ba::ip::tcp::resolver           resolver(mIoService);
-            ba::ip::tcp::resolver::query    query   (mParams.listen_addr, mParams.listen_port);
-            ba::ip::tcp::endpoint           endpoint = *resolver.resolve(query);
-
-            // open the acceptor with SO_REUSEADDR
-            std::cout << TimeStamp() << "waiting for new incomming connection" << std::endl;
-            ba::ip::tcp::acceptor acceptor(mIoService);
-            acceptor.open(endpoint.protocol());
-            acceptor.set_option(ba::ip::tcp::acceptor::reuse_address(true));
-            acceptor.bind(endpoint);
-            acceptor.listen();
-            acceptor.accept(mListenSocket);
-
-            // we have a new connection
-            ba::ip::tcp::endpoint const& ep_local  = mListenSocket.local_endpoint();
-            ba::ip::tcp::endpoint const& ep_remote = mListenSocket.remote_endpoint();
-            std::cout << TimeStamp() << "new listening connection:    [" << ep_remote.address().to_string() << "]:" << ep_remote.port() << "  --->  [" << ep_local.address().to_string() << "]:" << ep_local.port() << std::endl;
+            upstream->Stop();
         }
+    }
 
+    // let the sessions finish by themselves, for a while
+    if (mParams.drain_timeout_s > 0 && active > 0)
+    {
+        std::cout << TimeStamp() << "draining " << active << " active session(s), for up to " << mParams.drain_timeout_s << "s" << std::endl;
+        mDrainTimer.expires_from_now(std::chrono::seconds(mParams.drain_timeout_s));
+        mDrainTimer.async_wait(std::bind(&Impl::HandleDrainTimeout, shared_from_this(), std::placeholders::_1));
+        return;
+    }
 
+    CloseSessions();
+}
 
-        {
-            // resolve destination address/port
-            std::cout << TimeStamp() << "resolving destination address:  [" << mParams.dest_addr << "]:" << mParams.dest_port << std::endl;
-            ba::ip::tcp::resolver           resolver(mIoService);
-            ba::ip::tcp::resolver::query    query   (mParams.dest_addr, mParams.dest_port);
-            ba::ip::tcp::resolver::iterator iterator = resolver.resolve(query);
-
-            std::ostringstream oss;
-            oss << std::hex << 1234;
-            // establish connection
-            ba::connect(mDestSocket, iterator);
-
-            // we have a new connection
-            ba::ip::tcp::endpoint const& ep_local  = mDestSocket.local_endpoint();
-            ba::ip::tcp::endpoint const& ep_remote = mDestSocket.remote_endpoint();
-            std::cout << TimeStamp() << "new destination connection:    [" << ep_local.address().to_string() << "]:" << ep_local.port() << "  --->  [" << ep_remote.address().to_string() << "]:" << ep_remote.port() << std::endl;
-        }
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto Proxy::Impl::HandleDrainTimeout(boost::system::error_code const& error) -> void
+{
+    // cancelled once every session has finished
+    if (error == ba::error::operation_aborted) { return; }
 
+    std::cout << TimeStamp() << "the sessions did not drain within " << mParams.drain_timeout_s << "s" << std::endl;
+    CloseSessions();
+}
 
-        // finally kick off an async 'read' operation on both the listen and dest connections
-        mListenSocket.async_read_some(
-            ba::buffer(mListenData, LENGTH_),
-            std::bind(&Impl::HandleListenRead, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto Proxy::Impl::CloseSessions() -> void
+{
+    std::set<std::shared_ptr<Session>> sessions;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mClosingSessions) { return; }
+        mClosingSessions = true;
+        sessions = mSessions;
+    }
 
-        mDestSocket.async_read_some(
-            ba::buffer(mDestData, LENGTH_),
-            std::bind(&Impl::HandleDestRead, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+    std::cout << TimeStamp() << "closing " << sessions.size() << " active session(s)" << std::endl;
+    for (auto& session : sessions)
+    {
+        session->Stop();
     }
-    catch (std::exception& e)
+
+    if (sessions.empty())
     {
-        std::cout << TimeStamp() << "ERROR:  EstablishNewConnection():  " << e.what() << std::endl;
+        Finish();
     }
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-auto Proxy::Impl::HandleListenRead(boost::system::error_code const& error, std::size_t bytes_transferred) -> void
+// Called on the main io_service once the last session has closed.  Stop everything that the
+// sessions needed, and let the worker threads finish.
+//
+auto Proxy::Impl::Finish() -> void
 {
-    if (!error)
     {
-        std::string request{mListenData, bytes_transferred};
+        // a session may have been accepted just before the acceptors closed
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (!mSessions.empty() || mFinished) { return; }
+        mClosingSessions = true;
+        mFinished        = true;
+    }
 
-        /*
-        std::string const HOST_SRC = "Host: 192.168.100.142:12345\r\n";
-        std::string const HOST_DST = "Host: 192.168.100.142:80\r\n";
-        if (request.find(HOST_SRC) != std::string::npos)
-        {
-            boost::replace_first(request, HOST_SRC, HOST_DST);
-            std::copy(begin(request), end(request), mListenData);
-            bytes_transferred = request.size();
-        }
-        */
+    // when stopped by Stop() rather than a signal, stop waiting for the signals
+    boost::system::error_code ignored;
+    mSignals.cancel(ignored);
+    mDrainTimer.cancel(ignored);
 
-        std::cout << TimeStamp() << "client --> server:\n    |" << boost::replace_all_copy(request, "\n", "\n    |") << "\n" << std::endl;
-        ba::async_write(
-            mDestSocket, 
-            ba::buffer(mListenData, bytes_transferred),
-            std::bind(&Impl::HandleDestWrite, shared_from_this(), std::placeholders::_1));
+    if (mMetricsServer)
+    {
+        mMetricsServer->Stop();
     }
-    else
+
+    mDns->Stop();
+
+    for (auto& wheel : mWheels)
     {
-        if (mShuttingDown)
-        {
-            std::cout << TimeStamp() << "client socket successfully shut down:  " << error.message() << std::endl;
-        }
-        else if (mClosingListenSocket)
-        {
-            std::cout << TimeStamp() << "client socket successfully shut down:  " << error.message() << std::endl;
-            EstablishNewConnections();
-        }
-        else
-        {
-            std::cout << TimeStamp() << "client has closed the connection:  " << error.message() << std::endl;
-            mClosingDestSocket = true;
-            mDestSocket.close();
-        }
+        wheel->Stop();
     }
+
+    StopPool();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-auto Proxy::Impl::HandleDestRead(boost::system::error_code const& error, std::size_t bytes_transferred) -> void
+// Once every session has closed, the worker threads are allowed to finish.  Always called on the
+// main io_service.
+//
+auto Proxy::Impl::StopPool() -> void
 {
-    if (!error)
+    if (mPool)
     {
-        std::string const request(mDestData, bytes_transferred);
-        std::cout << TimeStamp() << "client <-- server:\n    |" << boost::replace_all_copy(request, "\n", "\n    |") << "\n" << std::endl;
-        ba::async_write(
-            mListenSocket, 
-            ba::buffer(mDestData, bytes_transferred),
-            std::bind(&Impl::HandleListenWrite, shared_from_this(), std::placeholders::_1));
+        mPool->Stop();
     }
-    else
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Asynchronously wait for the next incomming connection.  Each accepted connection gets its own
+// session (and therefore its own connection to the destination).
+//
+auto Proxy::Impl::StartAccept(Listener& listener) -> void
+{
+    // pick the worker thread that this session will run on
+    auto const worker     = mRoundRobin ? mNextWorker++ % mPool->Size() : listener.worker;
+    auto&      io_service = mRoundRobin ? mPool->GetIoService(worker) : listener.io_service;
+
+    // the dump producer is shared with (and kept alive by) the dump itself
+    std::shared_ptr<TrafficDump::Producer> dump;
+    if (mDump)
     {
-        if (mShuttingDown)
-        {
-            std::cout << TimeStamp() << "server socket successfully shut down:  " << error.message() << std::endl;
-        }
-        else if (mClosingDestSocket)
-        {
-            std::cout << TimeStamp() << "server socket successfully shut down:  " << error.message() << std::endl;
-            EstablishNewConnections();
-        }
-        else
-        {
-            std::cout << TimeStamp() << "server has closed the connection:  " << error.message() << std::endl;
-            mClosingListenSocket = true;
-            mListenSocket.close();
-        }
+        dump = std::shared_ptr<TrafficDump::Producer>(mDump, &mDump->GetProducer(worker));
     }
+
+    // as are the worker's metrics
+    std::shared_ptr<WorkerMetrics> const metrics(mMetrics, &mMetrics->GetWorker(worker));
+
+    std::shared_ptr<UpstreamPools const> upstream;
+    if (!mUpstreamPools.empty())
+    {
+        upstream = mUpstreamPools[worker % mUpstreamPools.size()];
+    }
+
+    // the session's memory (and its buffers) are recycled from the worker's last closed sessions
+    auto const& pools   = mMemoryPools[worker];
+    auto        session = std::allocate_shared<Session>(PoolAllocator<Session>(pools.sessions), io_service, mParams, ++mNextSessionId, dump, metrics, mBalancer, mDns, upstream, pools.buffers, mWheels[worker], mRateLimiter);
+    listener.acceptor.async_accept(
+        session->ListenSocket(),
+        std::bind(&Impl::HandleAccept, shared_from_this(), std::ref(listener), session, std::placeholders::_1));
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-auto Proxy::Impl::HandleListenWrite(boost::system::error_code const& error) -> void
+auto Proxy::Impl::HandleAccept(Listener& listener, std::shared_ptr<Session> const& session, boost::system::error_code const& error) -> void
 {
     if (!error)
     {
-        // and kick off another read
-        mDestSocket.async_read_some(
-            ba::buffer(mDestData, LENGTH_), 
-            std::bind(&Impl::HandleDestRead, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+        {
+            // while draining, a connection that was accepted just as the acceptor closed is still
+            // served
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (mClosingSessions) { return; }
+            mSessions.insert(session);
+        }
+        session->Start(std::bind(&Impl::HandleSessionClosed, shared_from_this(), std::placeholders::_1));
     }
     else
     {
-        if (!mShuttingDown)
-        {
-            std::cout << TimeStamp() << "WARNING:  HandleListenWrite():  failed:  " << error.message() << std::endl;
-        }
+        if (mShuttingDown) { return; }
+        std::cout << TimeStamp() << "WARNING:  HandleAccept():  failed:  " << error.message() << std::endl;
+    }
+
+    // in single-connection mode, the next connection is not accepted until this session closes
+    if (!mParams.single_connection || error)
+    {
+        StartAccept(listener);
     }
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-auto Proxy::Impl::HandleDestWrite(boost::system::error_code const& error) -> void
+// Called on the thread that runs the session.
+//
+auto Proxy::Impl::HandleSessionClosed(std::shared_ptr<Session> const& session) -> void
 {
-    if (!error)
+    bool empty;
     {
-        // and kick off another read
-        mListenSocket.async_read_some(
-            ba::buffer(mListenData, LENGTH_), 
-            std::bind(&Impl::HandleListenRead, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+        std::lock_guard<std::mutex> lock(mMutex);
+        mSessions.erase(session);
+        empty = mSessions.empty();
     }
-    else
+
+    if (mShuttingDown)
     {
-        if (!mShuttingDown)
+        if (empty)
         {
-            std::cout << TimeStamp() << "ERROR:  HandleDestWrite():  failed:  " << error.message() << std::endl;
+            mIoService.post(std::bind(&Impl::Finish, shared_from_this()));
         }
     }
+    else if (mParams.single_connection)
+    {
+        auto& listener = *mListeners.front();
+        listener.io_service.post(std::bind(&Impl::StartAccept, shared_from_this(), std::ref(listener)));
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Called on the main io_service whenever the metrics are scraped.  The sessions are only locked
+// for long enough to take a copy of the set - their counters are read without any locking.
+//
+auto Proxy::Impl::RenderMetrics() -> std::string
+{
+    ProxyMetrics::Sessions sessions;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        sessions.reserve(mSessions.size());
+        for (auto& session : mSessions)
+        {
+            sessions.push_back(std::make_pair(session->Id(), std::shared_ptr<SessionMetrics const>(session, &session->Metrics())));
+        }
+    }
+
+    std::sort(sessions.begin(), sessions.end(), [](ProxyMetrics::Sessions::value_type const& a, ProxyMetrics::Sessions::value_type const& b) { return a.first < b.first; });
+    return mMetrics->Render(sessions);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
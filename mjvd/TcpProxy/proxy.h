@@ -3,9 +3,21 @@
 
 
 #include <memory>
+#include <string>
+#include <vector>
 #include <boost/noncopyable.hpp>
 #include <boost/asio/io_service.hpp>
 
+#include "http_rewriter.h"
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+struct Destination
+{
+    std::string addr;
+    std::string port;
+};
+
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 struct ProxyParameters
@@ -14,6 +26,122 @@ struct ProxyParameters
     std::string listen_port;
     std::string dest_addr;
     std::string dest_port;
+
+    // further destinations.  Each session is sent to one of 'dest_addr:dest_port' or these,
+    // picked by the 'balance' policy:  "round-robin", "least-connections" or "hash" (of the
+    // client's address).  A destination is left out for 'eject_time_s' seconds after
+    // 'eject_failures' connects to it in a row have failed.
+    std::vector<Destination> more_destinations;
+    std::string balance = "round-robin";
+    unsigned    eject_failures = 3;
+    long        eject_time_s = 30;
+
+    // the destinations are resolved once and cached (between every session) for 'dns_ttl_s'
+    // seconds.  After that an answer is still used for up to 'dns_stale_s' seconds while it is
+    // being resolved again, and a failure is remembered for 'dns_negative_ttl_s' seconds.
+    long        dns_ttl_s = 30;
+    long        dns_stale_s = 300;
+    long        dns_negative_ttl_s = 5;
+
+    // token bucket limits on the bytes relayed in each direction (in bytes/s, 0 = no limit):  for
+    // each session, for all of the sessions from one client address, and for every session
+    // together.  Each bucket holds up to 'rate_burst' bytes.  A session that is over a limit
+    // doesn't read again until it is back under it - though it keeps reading while it is less
+    // than one tick of the timer wheel (10ms) over.  Sessions that are shaped are never spliced.
+    double      session_rate = 0;
+    double      client_rate = 0;
+    double      total_rate = 0;
+    std::size_t rate_burst = 64*1024;
+
+    // PROXY protocol:  expect every client connection to start with a v1 or v2 header (from a load
+    // balancer in front of us), and send a v2 header ahead of the data on every destination
+    // connection - so that the client's real address is passed along a chain of proxies.  The
+    // client's address from the header is used for balancing and rate limiting, too.
+    bool        proxy_protocol_in = false;
+    bool        proxy_protocol_out = false;
+
+    // when set, only a single connection is proxied at any one time.  Otherwise every incomming
+    // connection gets its own session, and all sessions are proxied concurrently.
+    bool        single_connection = false;
+
+    // how long to wait for the connection to the destination to be established (including the
+    // resolve)
+    long        connect_timeout_ms = 10000;
+
+    // close a session once nothing has been read from either side for 'idle_read_timeout_s'
+    // seconds, once a write has been blocked (by a side that isn't reading) for
+    // 'idle_write_timeout_s' seconds, or once it has been open for 'max_lifetime_s' seconds.
+    // 0 disables each of them.
+    long        idle_read_timeout_s = 0;
+    long        idle_write_timeout_s = 0;
+    long        max_lifetime_s = 0;
+
+    // on a stop signal (or once a new process has taken over the listeners), stop accepting but
+    // give the active sessions up to 'drain_timeout_s' seconds to finish by themselves before they
+    // are closed.  A second signal closes them straight away.  0 closes them immediately.
+    long        drain_timeout_s = 0;
+
+    // hot restart (POSIX only):  a new process started with the same 'handoff_path' takes over
+    // the listening sockets of the process that is running, over a Unix domain socket at that
+    // path, and the old process then drains.  Both must have the same listening options.
+    std::string handoff_path;
+
+    // relay UDP rather than TCP (see UdpRelay).  Each client gets its own flow to a destination,
+    // closed once nothing has been relayed for 'udp_idle_timeout_s' seconds; datagrams from new
+    // clients are dropped while there are 'udp_max_flows' flows.  Up to 'udp_batch' datagrams are
+    // moved with each system call.
+    bool        udp = false;
+    long        udp_idle_timeout_s = 60;
+    std::size_t udp_max_flows = 65536;
+    std::size_t udp_batch = 32;
+
+    // the number of worker threads (each with its own io_service) to run the sessions on.  With a
+    // single thread, everything runs on the io_service passed to the Proxy.
+    std::size_t threads = 1;
+
+    // pin each worker thread to its own core
+    bool        pin_threads = false;
+
+    // give each worker thread its own SO_REUSEPORT acceptor, rather than handing out the sessions
+    // from a single acceptor (not available in single-connection mode)
+    bool        reuse_port = false;
+
+    // each direction of a session reads into a ring of 'buffer_count' buffers of 'buffer_size'
+    // bytes, so reads continue while earlier writes are still in flight.  A direction stops
+    // reading once all of its buffers are waiting to be written.
+    std::size_t buffer_size  = 16*1024;
+    std::size_t buffer_count = 4;
+
+    // the memory for up to 'session_pool_size' closed sessions (and their buffers) is kept, per
+    // worker thread, for the next sessions to reuse
+    std::size_t session_pool_size = 64;
+
+    // write everything that is proxied to the console (or to 'dump_file').  The dump is written by
+    // a background thread, and chunks are dropped if it can't keep up with 'dump_queue_size'
+    // chunks per worker thread.
+    bool        dump_traffic = true;
+    std::string dump_file;
+    std::string dump_format = "text";   // "text", "hex" or "pcapng" (which requires a 'dump_file')
+    std::size_t dump_queue_size = 1024;
+
+    // relay with splice(2), so that the data never leaves the kernel.  Linux only, and only used
+    // for sessions whose traffic is not being dumped.
+    bool        splice = false;
+
+    // treat the client --> server stream as HTTP/1.1 requests, and rewrite each request head.
+    // Sessions that rewrite are never spliced.
+    HttpRewriteRules http_rules;
+
+    // keep this many idle connections to the destination open (per worker thread), so that new
+    // sessions don't have to wait for a connection to be established.  0 disables the pool.
+    // Connections that have been idle for 'upstream_idle_timeout_s' are replaced.
+    std::size_t upstream_pool_size = 0;
+    long        upstream_idle_timeout_s = 60;
+
+    // serve the proxy's metrics (in the Prometheus text format) on http://metrics_addr:metrics_port/metrics.
+    // Disabled when 'metrics_port' is empty.
+    std::string metrics_addr = "127.0.0.1";
+    std::string metrics_port;
 };
 
 
@@ -0,0 +1,198 @@
+#include "stdafx.h"
+#include "proxy_protocol.h"
+#include <string>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+namespace ba = boost::asio;
+
+
+namespace
+{
+    char const          V2_SIGNATURE[12] = { '\x0D', '\x0A', '\x0D', '\x0A', '\x00', '\x0D', '\x0A', '\x51', '\x55', '\x49', '\x54', '\x0A' };
+    std::size_t const   V2_FIXED_SIZE    = 16;
+    char const          V1_PREFIX[]      = "PROXY ";
+    std::size_t const   V1_MAX_SIZE      = 107;     // including the CRLF
+
+    // the v2 address families that we understand
+    unsigned char const V2_TCP4 = 0x11;
+    unsigned char const V2_TCP6 = 0x21;
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // does what we have so far match the start of 'prefix'?
+    auto StartsWith(char const* data, std::size_t size, char const* prefix, std::size_t prefixSize) -> bool
+    {
+        return std::memcmp(data, prefix, std::min(size, prefixSize)) == 0;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto ParsePort(std::string const& text, unsigned short& port) -> bool
+    {
+        if (text.empty() || text.size() > 5 || text.find_first_not_of("0123456789") != std::string::npos) { return false; }
+
+        auto const value = std::stoul(text);
+        if (value > 65535) { return false; }
+        port = static_cast<unsigned short>(value);
+        return true;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // "PROXY TCP4 <src> <dst> <sport> <dport>\r\n", "PROXY TCP6 ..." or "PROXY UNKNOWN ...\r\n"
+    auto ParseV1(char const* data, std::size_t size, ProxyHeader& header, std::size_t& headerSize) -> ProxyHeaderStatus
+    {
+        auto const end = static_cast<char const*>(std::memchr(data, '\n', std::min(size, V1_MAX_SIZE)));
+        if (!end)
+        {
+            return size < V1_MAX_SIZE ? ProxyHeaderStatus::Incomplete : ProxyHeaderStatus::Invalid;
+        }
+        if (end == data || end[-1] != '\r') { return ProxyHeaderStatus::Invalid; }
+
+        std::vector<std::string> fields;
+        auto field = data;
+        for (auto p = data; p < end - 1; ++p)
+        {
+            if (*p == ' ')
+            {
+                fields.push_back(std::string(field, p));
+                field = p + 1;
+            }
+        }
+        fields.push_back(std::string(field, end - 1));
+        headerSize = end + 1 - data;
+
+        if (fields.size() >= 2 && fields[1] == "UNKNOWN")
+        {
+            header.local = true;
+            return ProxyHeaderStatus::Complete;
+        }
+        if (fields.size() != 6 || (fields[1] != "TCP4" && fields[1] != "TCP6")) { return ProxyHeaderStatus::Invalid; }
+
+        boost::system::error_code ec1, ec2;
+        auto const source      = ba::ip::address::from_string(fields[2], ec1);
+        auto const destination = ba::ip::address::from_string(fields[3], ec2);
+        unsigned short sourcePort, destinationPort;
+        if (ec1 || ec2 || !ParsePort(fields[4], sourcePort) || !ParsePort(fields[5], destinationPort)) { return ProxyHeaderStatus::Invalid; }
+        if (source.is_v4() != (fields[1] == "TCP4") || destination.is_v4() != (fields[1] == "TCP4")) { return ProxyHeaderStatus::Invalid; }
+
+        header.local       = false;
+        header.source      = ba::ip::tcp::endpoint(source, sourcePort);
+        header.destination = ba::ip::tcp::endpoint(destination, destinationPort);
+        return ProxyHeaderStatus::Complete;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // the 12 byte signature, version and command, address family, the length of what follows,
+    // then the addresses (and any TLVs, which we skip)
+    auto ParseV2(unsigned char const* data, std::size_t size, ProxyHeader& header, std::size_t& headerSize) -> ProxyHeaderStatus
+    {
+        if (size < V2_FIXED_SIZE) { return ProxyHeaderStatus::Incomplete; }
+
+        auto const version = data[12] >> 4;
+        auto const command = data[12] & 0x0F;
+        auto const family  = data[13];
+        auto const length  = (std::size_t(data[14]) << 8) | data[15];
+        if (version != 2 || command > 1) { return ProxyHeaderStatus::Invalid; }
+        if (size < V2_FIXED_SIZE + length) { return ProxyHeaderStatus::Incomplete; }
+        headerSize = V2_FIXED_SIZE + length;
+
+        auto const addresses = data + V2_FIXED_SIZE;
+        auto const port      = [](unsigned char const* p) { return static_cast<unsigned short>((p[0] << 8) | p[1]); };
+
+        header.local = true;
+        if (command == 0) { return ProxyHeaderStatus::Complete; }
+
+        if (family == V2_TCP4)
+        {
+            if (length < 12) { return ProxyHeaderStatus::Invalid; }
+
+            ba::ip::address_v4::bytes_type source, destination;
+            std::copy(addresses,     addresses + 4, source.begin());
+            std::copy(addresses + 4, addresses + 8, destination.begin());
+            header.local       = false;
+            header.source      = ba::ip::tcp::endpoint(ba::ip::address_v4(source),      port(addresses + 8));
+            header.destination = ba::ip::tcp::endpoint(ba::ip::address_v4(destination), port(addresses + 10));
+        }
+        else if (family == V2_TCP6)
+        {
+            if (length < 36) { return ProxyHeaderStatus::Invalid; }
+
+            ba::ip::address_v6::bytes_type source, destination;
+            std::copy(addresses,      addresses + 16, source.begin());
+            std::copy(addresses + 16, addresses + 32, destination.begin());
+            header.local       = false;
+            header.source      = ba::ip::tcp::endpoint(ba::ip::address_v6(source),      port(addresses + 32));
+            header.destination = ba::ip::tcp::endpoint(ba::ip::address_v6(destination), port(addresses + 34));
+        }
+        return ProxyHeaderStatus::Complete;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto WriteV6(ba::ip::address const& address, char* out) -> void
+    {
+        auto const bytes = address.is_v6() ? address.to_v6().to_bytes() : ba::ip::address_v6::v4_mapped(address.to_v4()).to_bytes();
+        std::copy(bytes.begin(), bytes.end(), out);
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto WritePort(unsigned short port, char* out) -> void
+    {
+        out[0] = static_cast<char>(port >> 8);
+        out[1] = static_cast<char>(port & 0xFF);
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// We can tell which version it is from the first byte, and give up as soon as what we have
+// doesn't match
+//
+auto ParseProxyHeader(char const* data, std::size_t size, ProxyHeader& header, std::size_t& headerSize) -> ProxyHeaderStatus
+{
+    if (size == 0) { return ProxyHeaderStatus::Incomplete; }
+
+    if (data[0] == V2_SIGNATURE[0])
+    {
+        if (!StartsWith(data, size, V2_SIGNATURE, sizeof(V2_SIGNATURE))) { return ProxyHeaderStatus::Invalid; }
+        return ParseV2(reinterpret_cast<unsigned char const*>(data), size, header, headerSize);
+    }
+
+    if (!StartsWith(data, size, V1_PREFIX, sizeof(V1_PREFIX) - 1)) { return ProxyHeaderStatus::Invalid; }
+    return ParseV1(data, size, header, headerSize);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// A PROXY command, for TCP over IPv4 when both ends are IPv4 - otherwise over IPv6, with any IPv4
+// address mapped into it
+//
+auto WriteProxyHeaderV2(ba::ip::tcp::endpoint const& source, ba::ip::tcp::endpoint const& destination, char* out) -> std::size_t
+{
+    auto const v4 = source.address().is_v4() && destination.address().is_v4();
+    auto const length = v4 ? 12 : 36;
+
+    std::copy(V2_SIGNATURE, V2_SIGNATURE + sizeof(V2_SIGNATURE), out);
+    out[12] = '\x21';   // version 2, PROXY
+    out[13] = static_cast<char>(v4 ? V2_TCP4 : V2_TCP6);
+    out[14] = 0;
+    out[15] = static_cast<char>(length);
+
+    auto const addresses = out + V2_FIXED_SIZE;
+    if (v4)
+    {
+        auto const sourceBytes      = source.address().to_v4().to_bytes();
+        auto const destinationBytes = destination.address().to_v4().to_bytes();
+        std::copy(sourceBytes.begin(),      sourceBytes.end(),      addresses);
+        std::copy(destinationBytes.begin(), destinationBytes.end(), addresses + 4);
+        WritePort(source.port(),      addresses + 8);
+        WritePort(destination.port(), addresses + 10);
+    }
+    else
+    {
+        WriteV6(source.address(),      addresses);
+        WriteV6(destination.address(), addresses + 16);
+        WritePort(source.port(),      addresses + 32);
+        WritePort(destination.port(), addresses + 34);
+    }
+
+    return V2_FIXED_SIZE + length;
+}
@@ -0,0 +1,49 @@
+#ifndef INCLUDED_PROXY_PROTOCOL_HEADER
+#define INCLUDED_PROXY_PROTOCOL_HEADER
+
+
+#include <cstddef>
+#include <boost/asio/ip/tcp.hpp>
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The PROXY protocol (versions 1 and 2), with which a proxy tells the next hop who the client
+// really is, in a header sent ahead of the client's data.  A v2 header for a TCP connection is
+// never longer than this.
+//
+std::size_t const PROXY_HEADER_V2_MAX = 16 + 36;
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The addresses from a header.  'local' means that the header didn't carry any (a v2 LOCAL
+// command, a v1 UNKNOWN, or an address family other than TCP), and the connection's own addresses
+// should be used.
+//
+struct ProxyHeader
+{
+    bool                            local = true;
+    boost::asio::ip::tcp::endpoint  source;
+    boost::asio::ip::tcp::endpoint  destination;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+enum class ProxyHeaderStatus
+{
+    Complete,
+    Incomplete,     // so far so good, but more data is needed
+    Invalid,
+};
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// parse the header at the start of the first 'size' bytes received.  When it is Complete,
+// 'headerSize' is its length - anything after it is the client's data.
+auto ParseProxyHeader(char const* data, std::size_t size, ProxyHeader& header, std::size_t& headerSize) -> ProxyHeaderStatus;
+
+// write a v2 PROXY header for a connection from 'source' to 'destination' into 'out' (which must
+// hold at least PROXY_HEADER_V2_MAX bytes).  Returns its length.
+auto WriteProxyHeaderV2(boost::asio::ip::tcp::endpoint const& source, boost::asio::ip::tcp::endpoint const& destination, char* out) -> std::size_t;
+
+
+#endif  //INCLUDED_PROXY_PROTOCOL_HEADER
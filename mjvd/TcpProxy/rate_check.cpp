@@ -0,0 +1,167 @@
+#include "stdafx.h"
+#include "rate_check.h"
+#include "utils.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+
+#include <boost/asio.hpp>
+namespace ba = boost::asio;
+
+
+namespace
+{
+    // the client writes in chunks of this size.  Each measurement starts once the session has
+    // been running for WARM_UP, by when the first burst has long gone.
+    std::size_t const CHUNK_SIZE = 64 * 1024;
+    auto const        WARM_UP    = std::chrono::seconds(1);
+
+    // how far the rate that was measured may be from the rate that was set
+    double const      TOLERANCE  = 0.05;
+
+    // rates above this fraction of what loopback can carry without a limit are not checked
+    double const      HEADROOM   = 0.8;
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // a free port on the loopback interface, for the proxy to listen on
+    auto FreePort(ba::io_service& io_service) -> unsigned short
+    {
+        ba::ip::tcp::acceptor acceptor(io_service, ba::ip::tcp::endpoint(ba::ip::address_v4::loopback(), 0));
+        return acceptor.local_endpoint().port();
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // Runs a proxy with 'params' in front of the sink, streams through it over a single session,
+    // and returns the rate (in bytes/s) at which the sink received after the warm-up
+    //
+    auto Measure(ba::io_service& io_service, ba::ip::tcp::acceptor& sinkAcceptor, ProxyParameters const& params, long duration_s) -> double
+    {
+        ba::io_service proxyService;
+        auto proxy = std::make_shared<Proxy>(proxyService, params);
+        proxy->Start();
+        std::thread runner([&proxyService]() { proxyService.run(); });
+
+        ba::ip::tcp::socket client(io_service);
+        client.connect(ba::ip::tcp::endpoint(ba::ip::address_v4::loopback(), static_cast<unsigned short>(std::stoi(params.listen_port))));
+
+        ba::ip::tcp::socket sinkSocket(io_service);
+        sinkAcceptor.accept(sinkSocket);
+
+        // the sink:  reads (and throws away) everything, until the client closes
+        std::atomic<unsigned long long> received(0);
+        std::thread sink([&sinkSocket, &received]()
+        {
+            std::vector<char> buffer(CHUNK_SIZE);
+            boost::system::error_code ec;
+            for (;;)
+            {
+                auto const n = sinkSocket.read_some(ba::buffer(buffer), ec);
+                if (ec) { break; }
+                received += n;
+            }
+        });
+
+        // the client:  writes as fast as the proxy will take it
+        std::atomic<bool> stopping(false);
+        std::thread writer([&client, &stopping]()
+        {
+            std::vector<char> const chunk(CHUNK_SIZE, 'x');
+            boost::system::error_code ec;
+            while (!stopping.load())
+            {
+                ba::write(client, ba::buffer(chunk), ec);
+                if (ec) { break; }
+            }
+        });
+
+        std::this_thread::sleep_for(WARM_UP);
+        auto const started        = std::chrono::steady_clock::now();
+        auto const receivedBefore = received.load();
+        std::this_thread::sleep_for(std::chrono::seconds(duration_s));
+        auto const bytes          = received.load() - receivedBefore;
+        auto const seconds        = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count() / 1e6;
+
+        stopping = true;
+        writer.join();
+
+        boost::system::error_code ignored;
+        client.shutdown(ba::ip::tcp::socket::shutdown_both, ignored);
+        client.close(ignored);
+        sink.join();
+        sinkSocket.close(ignored);
+
+        proxy->Stop();
+        runner.join();
+
+        return seconds > 0 ? bytes / seconds : 0;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto FormatRate(double bytesPerSecond) -> std::string
+    {
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(1) << bytesPerSecond / 1e6 << " MB/s";
+        return oss.str();
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto RunRateCheck(ProxyParameters params, std::vector<double> const& rates, long duration_s) -> int
+{
+    ba::io_service checkService;
+    ba::ip::tcp::acceptor sinkAcceptor(checkService, ba::ip::tcp::endpoint(ba::ip::address_v4::loopback(), 0));
+
+    // the proxy, in front of the sink.  Only the session's own limit is set.
+    params.dest_addr            = "127.0.0.1";
+    params.dest_port            = std::to_string(sinkAcceptor.local_endpoint().port());
+    params.more_destinations.clear();
+    params.single_connection    = false;
+    params.dump_traffic         = false;
+    params.proxy_protocol_in    = false;
+    params.proxy_protocol_out   = false;
+    params.upstream_pool_size   = 0;
+    params.metrics_port.clear();
+    params.handoff_path.clear();
+    params.drain_timeout_s      = 0;
+    params.client_rate          = 0;
+    params.total_rate           = 0;
+
+    params.session_rate = 0;
+    params.listen_addr  = "127.0.0.1";
+    params.listen_port  = std::to_string(FreePort(checkService));
+    auto const unlimited = Measure(checkService, sinkAcceptor, params, duration_s);
+    std::cout << TimeStamp() << "rate check:  " << FormatRate(unlimited) << " without a limit, " << params.rate_burst << " byte burst" << std::endl;
+
+    auto failed = false;
+    for (auto const rate : rates)
+    {
+        if (rate > unlimited * HEADROOM)
+        {
+            std::cout << TimeStamp() << "session rate " << std::setw(12) << FormatRate(rate) << ":  skipped (too close to what loopback can carry)" << std::endl;
+            continue;
+        }
+
+        params.session_rate = rate;
+        params.listen_port  = std::to_string(FreePort(checkService));
+        auto const measured = Measure(checkService, sinkAcceptor, params, duration_s);
+        auto const error    = measured / rate - 1;
+        auto const ok       = std::abs(error) <= TOLERANCE;
+        failed = failed || !ok;
+
+        std::cout
+            << TimeStamp() << "session rate " << std::setw(12) << FormatRate(rate) << ":  relayed " << std::setw(12) << FormatRate(measured)
+            << "  (" << std::showpos << std::fixed << std::setprecision(1) << error * 100 << std::noshowpos << "%)  " << (ok ? "ok" : "FAILED")
+            << std::endl;
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,25 @@
+#ifndef INCLUDED_RATE_CHECK_HEADER
+#define INCLUDED_RATE_CHECK_HEADER
+
+
+#include <vector>
+
+#include "proxy.h"
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Checks that a session is shaped to the rate that was set.  Runs a proxy (with 'params', apart
+// from the addresses and the rate limits) in front of a sink on the loopback interface, and for
+// each of 'rates' (in bytes/s) in turn, sets it as the session rate and streams through a single
+// session as fast as the proxy lets it.  After a warm-up, the rate at which the sink receives is
+// measured for 'duration_s' seconds, and compared with the rate that was set.
+//
+// The rate that loopback can carry without a limit is measured first - any rate that is close to
+// it can't be told apart from the machine's own limit, so it is skipped.
+//
+// Returns the process exit code:  a failure if any rate was missed by more than 5%.
+//
+auto RunRateCheck(ProxyParameters params, std::vector<double> const& rates, long duration_s) -> int;
+
+
+#endif  //INCLUDED_RATE_CHECK_HEADER
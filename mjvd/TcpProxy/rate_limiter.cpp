@@ -0,0 +1,129 @@
+#include "stdafx.h"
+#include "rate_limiter.h"
+#include <algorithm>
+
+namespace ba = boost::asio;
+
+
+namespace
+{
+    // the client buckets are first pruned once there are this many of them
+    std::size_t const MIN_PRUNE = 1024;
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto Nanos(TokenBucket::Clock::time_point t) -> long long
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+TokenBucket::TokenBucket(double bytesPerSecond, std::size_t burst)
+    : mNanosPerByte {1e9 / bytesPerSecond}
+    , mBurstNanos   {static_cast<long long>(burst * mNanosPerByte)}
+    , mFullAt       {0}
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// An empty bucket is full again 'burst' from now, so the bucket is over its limit (and the caller
+// must wait) for as long as it would be full more than 'burst' from now
+//
+auto TokenBucket::Take(std::size_t bytes, Clock::time_point now) -> Clock::duration
+{
+    auto const nanos = Nanos(now);
+    auto const cost  = static_cast<long long>(bytes * mNanosPerByte);
+
+    auto fullAt = mFullAt.load(std::memory_order_relaxed);
+    long long next;
+    do
+    {
+        next = std::max(fullAt, nanos) + cost;
+    }
+    while (!mFullAt.compare_exchange_weak(fullAt, next, std::memory_order_relaxed));
+
+    auto const wait = next - nanos - mBurstNanos;
+    return wait > 0 ? std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(wait)) : Clock::duration::zero();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto TokenBucket::Full(Clock::time_point now) const -> bool
+{
+    return mFullAt.load(std::memory_order_relaxed) <= Nanos(now);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+RateLimiter::RateLimiter(ProxyParameters const& params)
+    : mSessionRate  {params.session_rate}
+    , mClientRate   {params.client_rate}
+    , mBurst        {params.rate_burst}
+    , mPruneAt      {MIN_PRUNE}
+{
+    if (params.total_rate > 0)
+    {
+        mTotal[0] = std::make_shared<TokenBucket>(params.total_rate, mBurst);
+        mTotal[1] = std::make_shared<TokenBucket>(params.total_rate, mBurst);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto RateLimiter::Enabled() const -> bool
+{
+    return mSessionRate > 0 || mClientRate > 0 || mTotal[0];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto RateLimiter::ForSession(bool /*clientToServer*/) -> std::shared_ptr<TokenBucket>
+{
+    return mSessionRate > 0 ? std::make_shared<TokenBucket>(mSessionRate, mBurst) : nullptr;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto RateLimiter::ForAll(bool clientToServer) -> std::shared_ptr<TokenBucket>
+{
+    return mTotal[clientToServer ? 1 : 0];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto RateLimiter::ForClient(bool clientToServer, ba::ip::address const& client) -> std::shared_ptr<TokenBucket>
+{
+    if (mClientRate <= 0) { return nullptr; }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto& buckets = mClients[clientToServer ? 1 : 0];
+
+    auto bucket = buckets[client];
+    if (!bucket)
+    {
+        bucket = std::make_shared<TokenBucket>(mClientRate, mBurst);
+        buckets[client] = bucket;
+        if (buckets.size() >= mPruneAt)
+        {
+            Prune(buckets);
+        }
+    }
+    return bucket;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Forget the buckets that no session is using, and that have refilled.  The next prune waits
+// until the map has doubled, so the cost of pruning is spread over the insertions.
+//
+auto RateLimiter::Prune(ClientBuckets& buckets) -> void
+{
+    auto const now = TokenBucket::Clock::now();
+    for (auto it = buckets.begin(); it != buckets.end(); )
+    {
+        if (it->second.use_count() == 1 && it->second->Full(now))
+        {
+            it = buckets.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    mPruneAt = std::max(MIN_PRUNE, buckets.size() * 2);
+}
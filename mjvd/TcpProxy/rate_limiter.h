@@ -0,0 +1,82 @@
+#ifndef INCLUDED_RATE_LIMITER_HEADER
+#define INCLUDED_RATE_LIMITER_HEADER
+
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <boost/noncopyable.hpp>
+#include <boost/asio/ip/address.hpp>
+
+#include "proxy.h"
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// A token bucket that holds up to 'burst' bytes, and refills at 'bytesPerSecond'.  It is kept as
+// the time at which the bucket will next be full (the generic cell rate algorithm), so taking
+// from it is a single compare-and-swap - it may be shared by sessions on any number of threads.
+//
+// The data has always been read by the time that we know how much there was, so Take() never
+// refuses.  Instead the bucket goes into debt, and the caller must wait until it has been paid
+// off before reading again.
+//
+class TokenBucket : private boost::noncopyable
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    TokenBucket(double bytesPerSecond, std::size_t burst);
+
+    // take 'bytes' from the bucket, and return how long to wait before taking any more
+    auto Take(std::size_t bytes, Clock::time_point now) -> Clock::duration;
+
+    // the bucket is full, so forgetting it would make no difference
+    auto Full(Clock::time_point now) const -> bool;
+
+private:
+    double const                    mNanosPerByte;
+    long long const                 mBurstNanos;
+    std::atomic<long long>          mFullAt;        // nanoseconds on the steady clock
+};
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Hands out the token buckets that shape each session's traffic:  one of its own, one shared by
+// every session from the same client address, and one shared by every session - depending on
+// which of 'session_rate', 'client_rate' and 'total_rate' are set.  Each limit applies to each
+// direction separately.  Shared by every worker thread.
+//
+class RateLimiter : private boost::noncopyable
+{
+public:
+    explicit RateLimiter(ProxyParameters const& params);
+
+    auto Enabled() const -> bool;
+
+    // any of these may be null, when that limit is not set.  A client's buckets are kept for as
+    // long as any of its sessions are using them (and until they have refilled), so a client
+    // can't get a fresh bucket by reconnecting.
+    auto ForSession(bool clientToServer) -> std::shared_ptr<TokenBucket>;
+    auto ForClient (bool clientToServer, boost::asio::ip::address const& client) -> std::shared_ptr<TokenBucket>;
+    auto ForAll    (bool clientToServer) -> std::shared_ptr<TokenBucket>;
+
+private:
+    typedef std::map<boost::asio::ip::address, std::shared_ptr<TokenBucket>> ClientBuckets;
+
+    auto Prune(ClientBuckets& buckets) -> void;
+
+private:
+    double const                    mSessionRate;
+    double const                    mClientRate;
+    std::size_t const               mBurst;
+    std::shared_ptr<TokenBucket>    mTotal[2];      // indexed by clientToServer
+
+    std::mutex                      mMutex;
+    ClientBuckets                   mClients[2];
+    std::size_t                     mPruneAt;       // prune the client buckets once there are this many
+};
+
+
+#endif  //INCLUDED_RATE_LIMITER_HEADER
@@ -0,0 +1,329 @@
+#include "stdafx.h"
+#include "relay_bench.h"
+#include "utils.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#include <boost/asio.hpp>
+namespace ba = boost::asio;
+
+
+namespace
+{
+    // each measurement starts once the connections have been running for this long
+    auto const WARM_UP = std::chrono::milliseconds(500);
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // the CPU time used by the whole process so far (all threads, user and kernel), in seconds
+    auto ProcessCpuSeconds() -> double
+    {
+#if defined(_WIN32)
+        FILETIME created, exited, kernel, user;
+        if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) { return 0; }
+
+        auto const ticks = [](FILETIME const& t) { return (static_cast<unsigned long long>(t.dwHighDateTime) << 32) | t.dwLowDateTime; };
+        return (ticks(kernel) + ticks(user)) / 1e7;
+#else
+        rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0) { return 0; }
+
+        return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+#endif
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // the CPU time used by 'thread' so far (user and kernel), in seconds.  It must still be running.
+    auto ThreadCpuSeconds(std::thread& thread) -> double
+    {
+#if defined(_WIN32)
+        FILETIME created, exited, kernel, user;
+        if (!GetThreadTimes(thread.native_handle(), &created, &exited, &kernel, &user)) { return 0; }
+
+        auto const ticks = [](FILETIME const& t) { return (static_cast<unsigned long long>(t.dwHighDateTime) << 32) | t.dwLowDateTime; };
+        return (ticks(kernel) + ticks(user)) / 1e7;
+#else
+        clockid_t clock;
+        timespec  ts;
+        if (pthread_getcpuclockid(thread.native_handle(), &clock) != 0 || clock_gettime(clock, &ts) != 0) { return 0; }
+
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // the CPU time used by the proxy so far:  everything but the benchmark's own clients and
+    // servers ('threads'), which would otherwise swamp it - the direct runs make a system call
+    // for every message too.  This thread only sleeps while it is measuring.
+    //
+    auto ProxyCpuSeconds(std::vector<std::thread>& threads) -> double
+    {
+        auto cpu = ProcessCpuSeconds();
+        for (auto& thread : threads)
+        {
+            cpu -= ThreadCpuSeconds(thread);
+        }
+        return cpu;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // what was measured, over the measurement (not the warm-up)
+    struct Result
+    {
+        double                          seconds = 0;
+        double                          cpu_seconds = 0;    // used by the proxy (see ProxyCpuSeconds())
+        unsigned long long              bytes = 0;          // received by the sink
+        std::vector<unsigned long long> latencies_ns;       // one per echo, sorted
+    };
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // the latency below which 'percentile' of 'sorted' fall
+    auto Percentile(std::vector<unsigned long long> const& sorted, double percentile) -> double
+    {
+        if (sorted.empty()) { return 0; }
+        auto const index = static_cast<std::size_t>(percentile / 100.0 * sorted.size());
+        return static_cast<double>(sorted[std::min(index, sorted.size() - 1)]);
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto FormatLatency(double ns, bool sign = false) -> std::string
+    {
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(1) << (sign && ns >= 0 ? "+" : "") << ns / 1000.0 << "us";
+        return oss.str();
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // Runs 'connections' connections to 'target' (the server, or the proxy in front of it) for a
+    // warm-up and then the measurement.  The server's side of each connection is accepted here
+    // too, so that a failure to connect is reported from this thread rather than hanging one of
+    // the others.
+    //
+    auto Run(ba::io_service& io_service, ba::ip::tcp::acceptor& acceptor, ba::ip::tcp::endpoint const& target, RelayBenchParameters const& bench, std::size_t size, bool echo) -> Result
+    {
+        std::vector<std::unique_ptr<ba::ip::tcp::socket>> clients, servers;
+        for (std::size_t c = 0; c < bench.connections; ++c)
+        {
+            clients.emplace_back(new ba::ip::tcp::socket(io_service));
+            clients.back()->connect(target);
+            clients.back()->set_option(ba::ip::tcp::no_delay(true));
+
+            servers.emplace_back(new ba::ip::tcp::socket(io_service));
+            acceptor.accept(*servers.back());
+            servers.back()->set_option(ba::ip::tcp::no_delay(true));
+        }
+
+        std::atomic<bool>                               measuring(false);
+        std::atomic<bool>                               stopping(false);
+        std::atomic<unsigned long long>                 received(0);
+        std::vector<std::vector<unsigned long long>>    latencies(bench.connections);
+        std::vector<std::thread>                        threads;
+
+        // the server:  echoes (or reads and throws away) everything, until the client closes
+        for (auto& server : servers)
+        {
+            auto const socket = server.get();
+            threads.emplace_back([socket, size, echo, &received]()
+            {
+                std::vector<char> buffer(std::max<std::size_t>(size, 64 * 1024));
+                boost::system::error_code ec;
+                for (;;)
+                {
+                    auto const n = socket->read_some(ba::buffer(buffer), ec);
+                    if (ec) { break; }
+
+                    if (echo)
+                    {
+                        ba::write(*socket, ba::buffer(buffer.data(), n), ec);
+                        if (ec) { break; }
+                    }
+                    else
+                    {
+                        received += n;
+                    }
+                }
+            });
+        }
+
+        // the clients:  send a message and time how long it takes to come back, or just stream
+        for (std::size_t c = 0; c < bench.connections; ++c)
+        {
+            auto const socket = clients[c].get();
+            auto const samples = &latencies[c];
+            threads.emplace_back([socket, samples, size, echo, &measuring, &stopping]()
+            {
+                std::vector<char> const message(size, 'x');
+                std::vector<char>       reply(size);
+                boost::system::error_code ec;
+                while (!stopping.load())
+                {
+                    auto const sent = std::chrono::steady_clock::now();
+                    ba::write(*socket, ba::buffer(message), ec);
+                    if (ec) { break; }
+                    if (!echo) { continue; }
+
+                    ba::read(*socket, ba::buffer(reply), ec);
+                    if (ec) { break; }
+                    if (measuring.load())
+                    {
+                        samples->push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - sent).count());
+                    }
+                }
+
+                boost::system::error_code ignored;
+                socket->shutdown(ba::ip::tcp::socket::shutdown_both, ignored);
+                socket->close(ignored);
+            });
+        }
+
+        std::this_thread::sleep_for(WARM_UP);
+        measuring = true;
+        auto const started        = std::chrono::steady_clock::now();
+        auto const cpuBefore      = ProxyCpuSeconds(threads);
+        auto const receivedBefore = received.load();
+
+        std::this_thread::sleep_for(std::chrono::seconds(bench.duration_s));
+
+        Result result;
+        measuring = false;
+        result.bytes       = received.load() - receivedBefore;
+        result.cpu_seconds = ProxyCpuSeconds(threads) - cpuBefore;
+        result.seconds     = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count() / 1e6;
+
+        stopping = true;
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        for (auto const& samples : latencies)
+        {
+            result.latencies_ns.insert(result.latencies_ns.end(), samples.begin(), samples.end());
+        }
+        std::sort(result.latencies_ns.begin(), result.latencies_ns.end());
+        return result;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto ReportEcho(char const* name, Result const& result) -> void
+    {
+        std::cout
+            << "    echo " << std::left << std::setw(10) << name << std::right << std::fixed
+            << std::setw(12) << std::setprecision(0) << (result.seconds > 0 ? result.latencies_ns.size() / result.seconds : 0) << " requests/s"
+            << "    p50 "   << std::setw(9) << FormatLatency(Percentile(result.latencies_ns, 50))
+            << "    p99 "   << std::setw(9) << FormatLatency(Percentile(result.latencies_ns, 99))
+            << "    p99.9 " << std::setw(9) << FormatLatency(Percentile(result.latencies_ns, 99.9))
+            << "\n";
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto Gbits(Result const& result) -> double
+    {
+        return result.seconds > 0 ? result.bytes * 8 / result.seconds / 1e9 : 0;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto CpuPerGB(Result const& result) -> double
+    {
+        return result.bytes > 0 ? result.cpu_seconds / (result.bytes / 1e9) : 0;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto ReportSink(char const* name, Result const& result) -> void
+    {
+        std::cout
+            << "    sink " << std::left << std::setw(10) << name << std::right << std::fixed
+            << std::setw(12) << std::setprecision(3) << Gbits(result) << " Gbit/s    "
+            << std::setprecision(3) << CpuPerGB(result) << " CPU-s/GB"
+            << "\n";
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto RunRelayBenchmark(ProxyParameters params, RelayBenchParameters const& bench) -> int
+{
+    ba::io_service benchService;
+
+    // the echo server and the sink share the one listening socket - each run decides which it is
+    ba::ip::tcp::acceptor serverAcceptor(benchService, ba::ip::tcp::endpoint(ba::ip::address_v4::loopback(), 0));
+    auto const server = serverAcceptor.local_endpoint();
+
+    unsigned short proxyPort;
+    {
+        ba::ip::tcp::acceptor acceptor(benchService, ba::ip::tcp::endpoint(ba::ip::address_v4::loopback(), 0));
+        proxyPort = acceptor.local_endpoint().port();
+    }
+    ba::ip::tcp::endpoint const proxied(ba::ip::address_v4::loopback(), proxyPort);
+
+    // the proxy, in front of the server.  Anything that would change the data (or open
+    // connections of its own) is turned off, so that every byte comes straight back.
+    params.listen_addr          = "127.0.0.1";
+    params.listen_port          = std::to_string(proxyPort);
+    params.dest_addr            = "127.0.0.1";
+    params.dest_port            = std::to_string(server.port());
+    params.more_destinations.clear();
+    params.single_connection    = false;
+    params.dump_traffic         = false;
+    params.proxy_protocol_in    = false;
+    params.proxy_protocol_out   = false;
+    params.http_rules           = HttpRewriteRules();
+    params.upstream_pool_size   = 0;
+    params.metrics_port.clear();
+    params.handoff_path.clear();
+    params.drain_timeout_s      = 0;
+
+    ba::io_service proxyService;
+    auto proxy = std::make_shared<Proxy>(proxyService, params);
+    proxy->Start();
+    std::thread runner([&proxyService]() { proxyService.run(); });
+
+    std::cout
+        << TimeStamp() << "benchmarking:  " << bench.connections << " connection(s), " << params.threads << " thread(s), "
+        << params.buffer_count << " x " << params.buffer_size << " byte buffers" << (params.splice ? ", splice" : "")
+        << ", " << bench.duration_s << "s per measurement" << std::endl;
+
+    for (auto const size : bench.sizes)
+    {
+        auto const echoDirect  = Run(benchService, serverAcceptor, server,  bench, size, true);
+        auto const echoProxied = Run(benchService, serverAcceptor, proxied, bench, size, true);
+        auto const sinkDirect  = Run(benchService, serverAcceptor, server,  bench, size, false);
+        auto const sinkProxied = Run(benchService, serverAcceptor, proxied, bench, size, false);
+
+        std::cout << TimeStamp() << size << " byte messages:\n";
+        ReportEcho("direct",  echoDirect);
+        ReportEcho("proxied", echoProxied);
+        std::cout
+            << "    added latency                            "
+            << "    p50 "   << std::setw(9) << FormatLatency(Percentile(echoProxied.latencies_ns, 50)   - Percentile(echoDirect.latencies_ns, 50),   true)
+            << "    p99 "   << std::setw(9) << FormatLatency(Percentile(echoProxied.latencies_ns, 99)   - Percentile(echoDirect.latencies_ns, 99),   true)
+            << "    p99.9 " << std::setw(9) << FormatLatency(Percentile(echoProxied.latencies_ns, 99.9) - Percentile(echoDirect.latencies_ns, 99.9), true)
+            << "\n";
+        ReportSink("direct",  sinkDirect);
+        ReportSink("proxied", sinkProxied);
+        std::cout
+            << "    added CPU                            "
+            << std::setprecision(3) << CpuPerGB(sinkProxied) - CpuPerGB(sinkDirect) << " CPU-s/GB"
+            << std::endl;
+    }
+
+    proxy->Stop();
+    runner.join();
+    return EXIT_SUCCESS;
+}
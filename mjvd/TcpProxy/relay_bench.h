@@ -0,0 +1,41 @@
+#ifndef INCLUDED_RELAY_BENCH_HEADER
+#define INCLUDED_RELAY_BENCH_HEADER
+
+
+#include <cstddef>
+#include <vector>
+
+#include "proxy.h"
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+struct RelayBenchParameters
+{
+    // a run for each message size, each with 'connections' concurrent connections
+    std::vector<std::size_t>    sizes;
+    std::size_t                 connections = 8;
+
+    // how long each measurement lasts, after a short warm-up
+    long                        duration_s = 5;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Measures the proxy itself.  Runs a proxy (with 'params', apart from the addresses and anything
+// that would change the data) in front of an echo server and a sink on the loopback interface,
+// then for each message size:
+//
+//  - echo:  each connection sends a message and waits for it to come back, as fast as it can -
+//    giving the requests/s and the round trip latency percentiles.
+//  - sink:  each connection streams messages to the sink - giving the throughput, and the CPU
+//    time used by the proxy's own threads per GB relayed (the clients and servers aren't counted).
+//
+// Each is measured straight to the server too, and the difference is reported as what the proxy
+// adds.  The clients and the servers use blocking sockets, a thread each.
+//
+// Returns the process exit code.
+//
+auto RunRelayBenchmark(ProxyParameters params, RelayBenchParameters const& bench) -> int;
+
+
+#endif  //INCLUDED_RELAY_BENCH_HEADER
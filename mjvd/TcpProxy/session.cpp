@@ -0,0 +1,725 @@
+#include "stdafx.h"
+#include "session.h"
+#include "utils.h"
+#include <iostream>
+#include <limits>
+#include <algorithm>
+
+#include <boost/asio.hpp>
+namespace ba = boost::asio;
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+Session::Session(ba::io_service& io_service, ProxyParameters const& params, unsigned long long id, std::shared_ptr<TrafficDump::Producer> const& dump, std::shared_ptr<WorkerMetrics> const& totals, std::shared_ptr<LoadBalancer> const& balancer, std::shared_ptr<DnsCache> const& dns, std::shared_ptr<UpstreamPools const> const& upstream, std::shared_ptr<BlockPool> const& buffers, std::shared_ptr<TimerWheel> const& wheel, std::shared_ptr<RateLimiter> const& limiter)
+    : mId           {id}
+    , mParams       (params)
+    , mIoService    (io_service)
+    , mListenSocket {io_service}
+    , mDestSocket   {io_service}
+    , mDump         (dump)
+    , mDumping      {false}
+    , mBalancer     (balancer)
+    , mDns          (dns)
+    , mUpstream     (upstream)
+    , mProxyHeaderRead{0}
+    , mDestination  {0}
+    , mHaveDestination{false}
+    , mSpliceRelay  (mListenSocket, mDestSocket)
+    , mSplicePending{false}
+    , mTotals       (totals)
+    , mWheel        (wheel)
+    , mTimeoutAt    {0}
+    , mIdleReadTicks {params.idle_read_timeout_s  > 0 ? wheel->Ticks(std::chrono::seconds(params.idle_read_timeout_s))  : 0}
+    , mIdleWriteTicks{params.idle_write_timeout_s > 0 ? wheel->Ticks(std::chrono::seconds(params.idle_write_timeout_s)) : 0}
+    , mHandshakeDeadline{0}
+    , mLifetimeDeadline{0}
+    , mLastRead     {0}
+    , mConnected    {false}
+    , mLimiter      (limiter)
+    , mBuffers      (buffers)
+    , mClientToServer(mListenSocket, mDestSocket, "client", "server", DumpDirection::ClientToServer, mParams, *buffers, mMetrics.client_to_server, totals->client_to_server)
+    , mServerToClient(mDestSocket, mListenSocket, "server", "client", DumpDirection::ServerToClient, mParams, *buffers, mMetrics.server_to_client, totals->server_to_client)
+    , mClosing      {false}
+{
+    if (!mParams.http_rules.Empty())
+    {
+        mClientToServer.rewriter.reset(new HttpRewriter(mParams.http_rules));
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+Session::Direction::Direction(ba::ip::tcp::socket& from, ba::ip::tcp::socket& to, char const* fromName, char const* toName, DumpDirection dumpDirection, ProxyParameters const& params, BlockPool& buffers, DirectionMetrics& metrics, DirectionMetrics& totals)
+    : from      (from)
+    , to        (to)
+    , fromName  {fromName}
+    , toName    {toName}
+    , dumpDirection{dumpDirection}
+    , dumpSkipped {0}
+    , ring      (buffers, params.buffer_size, params.buffer_count)
+    , reading   {false}
+    , writing   {false}
+    , eof       {false}
+    , metrics   (metrics)
+    , totals    (totals)
+    , writeStartedTick{0}
+    , throttled {false}
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto Session::Id() const -> unsigned long long
+{
+    return mId;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto Session::Metrics() const -> SessionMetrics const&
+{
+    return mMetrics;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto Session::ListenSocket() -> ba::ip::tcp::socket&
+{
+    return mListenSocket;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The listening connection must already have been accepted.  Nothing in here blocks - we look the
+// destination up in the DNS cache (which usually answers straight away), and relaying starts once
+// the connect has completed.
+//
+auto Session::Start(CloseHandler onClose) -> void
+{
+    // may be called from any thread (the acceptor's, when sessions are handed out round-robin)
+    mIoService.dispatch(std::bind(&Session::HandleStart, shared_from_this(), onClose));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto Session::HandleStart(CloseHandler onClose) -> void
+{
+    mCloseHandler = onClose;
+    mStarted      = std::chrono::steady_clock::now();
+    mTotals->sessions_opened.Add(1);
+
+    // the resolve and connect must finish within the connect timeout
+    auto const now = mWheel->Now();
+    mHandshakeDeadline = now + mWheel->Ticks(std::chrono::milliseconds(mParams.connect_timeout_ms));
+    mLifetimeDeadline  = mParams.max_lifetime_s > 0 ? now + mWheel->Ticks(std::chrono::seconds(mParams.max_lifetime_s)) : 0;
+    ScheduleTimeout();
+
+    try
+    {
+        // we have a new connection
+        ba::ip::tcp::endpoint const& ep_local  = mListenSocket.local_endpoint();
+        ba::ip::tcp::endpoint const& ep_remote = mListenSocket.remote_endpoint();
+        std::cout << TimeStamp() << "[" << mId << "] new listening connection:    [" << ep_remote.address().to_string() << "]:" << ep_remote.port() << "  --->  [" << ep_local.address().to_string() << "]:" << ep_local.port() << std::endl;
+        mClient       = ep_remote;
+        mClientTarget = ep_local;
+    }
+    catch (std::exception& e)
+    {
+        std::cout << TimeStamp() << "[" << mId << "] ERROR:  Session::Start():  " << e.what() << std::endl;
+        Close();
+        return;
+    }
+
+    // we don't know who the client is until we have its header
+    if (mParams.proxy_protocol_in)
+    {
+        StartProxyHeaderRead();
+        return;
+    }
+
+    Connect();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The header is read straight into the first buffer of the client's ring, and whatever arrived
+// along with it stays there to be relayed - so the first chunk of the client's data is never copied
+//
+auto Session::StartProxyHeaderRead() -> void
+{
+    auto const buffer = mClientToServer.ring.PrepareRead();
+
+    mClientToServer.reading = true;
+    mListenSocket.async_read_some(
+        buffer + mProxyHeaderRead,
+        MakeCustomAllocHandler(mClientToServer.readMemory, std::bind(&Session::HandleProxyHeaderRead, shared_from_this(), std::placeholders::_1, std::placeholders::_2)));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto Session::HandleProxyHeaderRead(boost::system::error_code const& error, std::size_t bytes_transferred) -> void
+{
+    mClientToServer.reading = false;
+    if (mClosing) { return; }
+
+    if (error)
+    {
+        std::cout << TimeStamp() << "[" << mId << "] ERROR:  failed to read the PROXY protocol header:  " << error.message() << std::endl;
+        mTotals->proxy_header_errors.Add(1);
+        Close();
+        return;
+    }
+
+    mProxyHeaderRead += bytes_transferred;
+    mClientToServer.metrics.reads.Add(1);
+    mClientToServer.metrics.bytes.Add(bytes_transferred);
+    mClientToServer.totals.reads.Add(1);
+    mClientToServer.totals.bytes.Add(bytes_transferred);
+
+    auto const buffer = mClientToServer.ring.PrepareRead();
+    auto const data   = ba::buffer_cast<char const*>(buffer);
+
+    ProxyHeader header;
+    std::size_t headerSize = 0;
+    auto status = ParseProxyHeader(data, mProxyHeaderRead, header, headerSize);
+    if (status == ProxyHeaderStatus::Incomplete && mProxyHeaderRead == ba::buffer_size(buffer))
+    {
+        status = ProxyHeaderStatus::Invalid;
+    }
+
+    switch (status)
+    {
+    case ProxyHeaderStatus::Incomplete:
+        StartProxyHeaderRead();
+        return;
+
+    case ProxyHeaderStatus::Invalid:
+        std::cout << TimeStamp() << "[" << mId << "] ERROR:  the client did not send a valid PROXY protocol header" << std::endl;
+        mTotals->proxy_header_errors.Add(1);
+        Close();
+        return;
+
+    case ProxyHeaderStatus::Complete:
+        break;
+    }
+
+    if (!header.local)
+    {
+        std::cout << TimeStamp() << "[" << mId << "] PROXY protocol:  the client is [" << header.source.address().to_string() << "]:" << header.source.port() << "  --->  [" << header.destination.address().to_string() << "]:" << header.destination.port() << std::endl;
+        mClient       = header.source;
+        mClientTarget = header.destination;
+    }
+
+    if (mProxyHeaderRead > headerSize)
+    {
+        CommitRead(mClientToServer, data + headerSize, mProxyHeaderRead - headerSize);
+    }
+
+    Connect();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Now that we know who the client is, pick (and connect to) the destination
+//
+auto Session::Connect() -> void
+{
+    auto const client = mClient.address();
+
+    // the buckets that this session's traffic is shaped by
+    if (mLimiter->Enabled())
+    {
+        for (auto dir : { &mClientToServer, &mServerToClient })
+        {
+            auto const clientToServer = dir == &mClientToServer;
+            dir->buckets[0] = mLimiter->ForSession(clientToServer);
+            dir->buckets[1] = mLimiter->ForClient(clientToServer, client);
+            dir->buckets[2] = mLimiter->ForAll(clientToServer);
+        }
+    }
+
+    // pick the destination
+    mDestination     = mBalancer->Choose(client);
+    mHaveDestination = true;
+    auto const& destination = mBalancer->GetDestination(mDestination);
+
+    // a warm connection from the pool skips straight to relaying
+    if (mUpstream && (*mUpstream)[mDestination]->Acquire(mDestSocket))
+    {
+        std::cout << TimeStamp() << "[" << mId << "] using a pooled destination connection" << std::endl;
+        HandleConnect(boost::system::error_code());
+        return;
+    }
+
+    // resolve destination address/port
+    std::cout << TimeStamp() << "[" << mId << "] resolving destination address:  [" << destination.addr << "]:" << destination.port << std::endl;
+    mDns->Resolve(
+        destination.addr,
+        destination.port,
+        mIoService,
+        std::bind(&Session::HandleResolve, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto Session::HandleResolve(boost::system::error_code const& error, ba::ip::tcp::resolver::iterator iterator) -> void
+{
+    if (mClosing) { return; }
+
+    if (error)
+    {
+        std::cout << TimeStamp() << "[" << mId << "] ERROR:  failed to resolve destination:  " << error.message() << std::endl;
+        mTotals->connect_failures.Add(1);
+        mBalancer->Failed(mDestination);
+        Close();
+        return;
+    }
+
+    // establish connection.  If the connect takes too long, the timeout closes the socket - which
+    // aborts the connect.
+    ba::async_connect(
+        mDestSocket,
+        iterator,
+        std::bind(&Session::HandleConnect, shared_from_this(), std::placeholders::_1));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto Session::HandleConnect(boost::system::error_code const& error) -> void
+{
+    if (mClosing) { return; }
+
+    if (error)
+    {
+        std::cout << TimeStamp() << "[" << mId << "] ERROR:  failed to connect to destination:  " << error.message() << std::endl;
+        mTotals->connect_failures.Add(1);
+        mBalancer->Failed(mDestination);
+        Close();
+        return;
+    }
+
+    mBalancer->Connected(mDestination);
+
+    // from now on, only the idle and lifetime timeouts apply
+    mConnected = true;
+    mLastRead  = mWheel->Now();
+    ScheduleTimeout();
+
+    auto const connect_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - mStarted).count();
+    mMetrics.connect_us.Add(connect_us);
+    mTotals->RecordConnect(connect_us);
+
+    boost::system::error_code ec;
+    ba::ip::tcp::endpoint const ep_local  = mDestSocket.local_endpoint(ec);
+    ba::ip::tcp::endpoint const ep_remote = mDestSocket.remote_endpoint(ec);
+    std::cout << TimeStamp() << "[" << mId << "] new destination connection:    [" << ep_local.address().to_string() << "]:" << ep_local.port() << "  --->  [" << ep_remote.address().to_string() << "]:" << ep_remote.port() << std::endl;
+
+    if (mDump)
+    {
+        mDumping = mDump->Open(mId, mClient, ep_remote);
+    }
+
+    // the destination hears who the client is before anything else
+    if (mParams.proxy_protocol_out)
+    {
+        mClientToServer.prefix = ba::buffer(mProxyHeader, WriteProxyHeaderV2(mClient, mClientTarget, mProxyHeader));
+    }
+
+    StartRelay();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Set the timer for whichever deadline comes first
+//
+auto Session::ScheduleTimeout() -> void
+{
+    auto next = std::numeric_limits<unsigned long long>::max();
+    if (!mConnected)
+    {
+        next = mHandshakeDeadline;
+    }
+    if (mLifetimeDeadline)
+    {
+        next = std::min(next, mLifetimeDeadline);
+    }
+    if (mConnected && mIdleReadTicks && !IsThrottled())
+    {
+        next = std::min(next, mLastRead + mIdleReadTicks);
+    }
+    if (mConnected && mIdleWriteTicks)
+    {
+        if (mClientToServer.writing) { next = std::min(next, mClientToServer.writeStartedTick + mIdleWriteTicks); }
+        if (mServerToClient.writing) { next = std::min(next, mServerToClient.writeStartedTick + mIdleWriteTicks); }
+    }
+
+    if (next == std::numeric_limits<unsigned long long>::max())
+    {
+        mWheel->Cancel(mTimeout);
+        return;
+    }
+
+    mTimeoutAt = next;
+    mWheel->ScheduleAt(mTimeout, next, [this]() { HandleTimeout(); });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The timer is cancelled when the session closes, so the session is still alive.  Reads and
+// writes don't move the timer, so it may find that nothing has actually expired yet.
+//
+auto Session::HandleTimeout() -> void
+{
+    if (mClosing) { return; }
+    auto const now = mWheel->Now();
+
+    // the client's PROXY header must arrive within the same timeout
+    if (!mConnected && now >= mHandshakeDeadline && !mHaveDestination)
+    {
+        std::cout << TimeStamp() << "[" << mId << "] ERROR:  timed out waiting for the PROXY protocol header after " << mParams.connect_timeout_ms << "ms" << std::endl;
+        mTotals->proxy_header_errors.Add(1);
+        Close();
+        return;
+    }
+
+    if (!mConnected && now >= mHandshakeDeadline)
+    {
+        std::cout << TimeStamp() << "[" << mId << "] ERROR:  timed out connecting to destination after " << mParams.connect_timeout_ms << "ms" << std::endl;
+        mTotals->connect_failures.Add(1);
+        mBalancer->Failed(mDestination);
+        Close();
+        return;
+    }
+
+    if (mLifetimeDeadline && now >= mLifetimeDeadline)
+    {
+        std::cout << TimeStamp() << "[" << mId << "] closing:  the session has been open for " << mParams.max_lifetime_s << "s" << std::endl;
+        mTotals->lifetime_timeouts.Add(1);
+        Close();
+        return;
+    }
+
+    if (mConnected && mIdleReadTicks && !IsThrottled() && now >= mLastRead + mIdleReadTicks)
+    {
+        std::cout << TimeStamp() << "[" << mId << "] closing:  nothing has been read for " << mParams.idle_read_timeout_s << "s" << std::endl;
+        mTotals->idle_read_timeouts.Add(1);
+        Close();
+        return;
+    }
+
+    for (auto dir : { &mClientToServer, &mServerToClient })
+    {
+        if (mConnected && mIdleWriteTicks && dir->writing && now >= dir->writeStartedTick + mIdleWriteTicks)
+        {
+            std::cout << TimeStamp() << "[" << mId << "] closing:  the write to the " << dir->toName << " has been blocked for " << mParams.idle_write_timeout_s << "s" << std::endl;
+            mTotals->idle_write_timeouts.Add(1);
+            Close();
+            return;
+        }
+    }
+
+    ScheduleTimeout();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// We aren't reading because of our own limits, so the peer isn't idle
+//
+auto Session::IsThrottled() const -> bool
+{
+    return mClientToServer.throttled || mServerToClient.throttled;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto Session::StartRelay() -> void
+{
+    // when nobody needs to see (or shape) the traffic, it can be relayed without ever leaving the
+    // kernel - once the PROXY header, and anything that arrived along with the client's, are out
+    if (mParams.splice && !mDump && !mClientToServer.rewriter && !mLimiter->Enabled() && SpliceRelay::IsSupported())
+    {
+        if (ba::buffer_size(mClientToServer.prefix) > 0 || !mClientToServer.ring.Empty())
+        {
+            mSplicePending = true;
+            StartWrite(mClientToServer);
+            return;
+        }
+        if (StartSplice()) { return; }
+    }
+
+    // kick off an async 'read' operation on both the listen and dest connections (and send
+    // anything that is already waiting)
+    StartWrite(mClientToServer);
+    StartRead(mClientToServer);
+    StartRead(mServerToClient);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto Session::StartSplice() -> bool
+{
+    try
+    {
+        mSpliceRelay.Start(
+            shared_from_this(),
+            std::bind(&Session::HandleSpliceDone, shared_from_this(), std::placeholders::_1, std::placeholders::_2),
+            std::bind(&Session::HandleSpliceProgress, this, std::placeholders::_1, std::placeholders::_2));
+        return true;
+    }
+    catch (std::exception& e)
+    {
+        std::cout << TimeStamp() << "[" << mId << "] WARNING:  unable to start splice relay, falling back to buffered relay:  " << e.what() << std::endl;
+        return false;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto Session::HandleSpliceDone(std::string const& what, boost::system::error_code const& error) -> void
+{
+    if (mClosing)
+    {
+        std::cout << TimeStamp() << "[" << mId << "] sockets successfully shut down:  " << error.message() << std::endl;
+    }
+    else
+    {
+        std::cout << TimeStamp() << "[" << mId << "] " << what << ":  " << error.message() << std::endl;
+        Close();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Each splice out of the pipe counts as one read and one write
+//
+auto Session::HandleSpliceProgress(bool clientToServer, std::size_t bytes) -> void
+{
+    auto& dir = clientToServer ? mClientToServer : mServerToClient;
+    mLastRead = mWheel->Now();
+    dir.metrics.bytes.Add(bytes);
+    dir.metrics.reads.Add(1);
+    dir.metrics.writes.Add(1);
+    dir.totals.bytes.Add(bytes);
+    dir.totals.reads.Add(1);
+    dir.totals.writes.Add(1);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto Session::Stop() -> void
+{
+    // may be called from any thread
+    mIoService.post(std::bind(&Session::Close, shared_from_this()));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Close both sockets (which cancels any outstanding operations), then let the owner know that
+// this session is finished.  Safe to call more than once.
+//
+auto Session::Close() -> void
+{
+    if (mClosing) { return; }
+    mClosing = true;
+    mTotals->sessions_closed.Add(1);
+
+    if (mHaveDestination)
+    {
+        mBalancer->Release(mDestination);
+    }
+
+    mWheel->Cancel(mTimeout);
+    mWheel->Cancel(mClientToServer.throttle);
+    mWheel->Cancel(mServerToClient.throttle);
+
+    boost::system::error_code ignored;
+    mListenSocket.close(ignored);
+    mDestSocket.close(ignored);
+
+    if (mDumping)
+    {
+        mDump->Close(mId, mClientToServer.dumpSkipped, mServerToClient.dumpSkipped);
+    }
+
+    if (mCloseHandler)
+    {
+        mIoService.post(std::bind(mCloseHandler, shared_from_this()));
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Keep reading for as long as there is a free buffer in the ring.  Once the ring is full we stop
+// reading until the other side has caught up - so each direction never buffers more than
+// buffer_count x buffer_size bytes.
+//
+auto Session::StartRead(Direction& dir) -> void
+{
+    if (dir.reading || dir.throttled || dir.eof || dir.ring.Full() || mClosing) { return; }
+
+    dir.reading = true;
+    dir.from.async_read_some(
+        dir.ring.PrepareRead(),
+        MakeCustomAllocHandler(dir.readMemory, std::bind(&Session::HandleRead, shared_from_this(), std::ref(dir), std::placeholders::_1, std::placeholders::_2)));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// 'bytes' have been read into 'data', which is somewhere in the buffer from PrepareRead().  Put
+// them in the ring (rewritten, if need be) to be written, without copying them.
+//
+auto Session::CommitRead(Direction& dir, char const* data, std::size_t bytes) -> void
+{
+    if (dir.rewriter)
+    {
+        // the rewritten heads go into the ring's scratch space, everything else is written
+        // straight out of the read buffer
+        dir.segments.clear();
+        dir.rewriter->Process(data, bytes, dir.ring.ReadScratch(), dir.segments);
+        dir.ring.CommitRead(dir.segments);
+    }
+    else if (data == ba::buffer_cast<char const*>(dir.ring.PrepareRead()))
+    {
+        dir.segments.assign(1, dir.ring.CommitRead(bytes));
+    }
+    else
+    {
+        dir.segments.assign(1, ba::const_buffer(data, bytes));
+        dir.ring.CommitRead(dir.segments);
+    }
+
+    // hand a copy of what is being sent to the dump thread - this never blocks
+    if (mDumping)
+    {
+        for (auto const& segment : dir.segments)
+        {
+            mDump->Capture(mId, dir.dumpDirection, ba::buffer_cast<char const*>(segment), ba::buffer_size(segment), dir.dumpSkipped);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Take what was just read from each of the direction's buckets.  If any of them has gone into
+// debt, the next read waits (on the wheel, rather than blocking the thread) until the slowest of
+// them has been paid off - so TCP flow control pushes back on the sender in the meantime.
+//
+// The wait is rounded down to whole ticks, and a debt of less than a tick is carried (in the
+// buckets) into the next read, rather than sleeping for it.  Rounding up would oversleep by up to
+// a tick, and a bucket only refills up to 'rate_burst' - so anything faster than about one burst
+// per tick could never be reached.
+//
+auto Session::Throttle(Direction& dir, std::size_t bytes) -> void
+{
+    auto const now = TokenBucket::Clock::now();
+    auto wait      = TokenBucket::Clock::duration::zero();
+    for (auto const& bucket : dir.buckets)
+    {
+        if (bucket)
+        {
+            wait = std::max(wait, bucket->Take(bytes, now));
+        }
+    }
+    auto const ticks = mWheel->WholeTicks(wait);
+    if (ticks == 0) { return; }
+
+    dir.throttled = true;
+    mWheel->ScheduleAt(dir.throttle, mWheel->Now() + ticks, [this, &dir]()
+    {
+        dir.throttled = false;
+        mLastRead     = mWheel->Now();
+        if (!mTimeout.Pending())
+        {
+            ScheduleTimeout();
+        }
+        StartRead(dir);
+    });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Write everything that has been read so far with one gathering write.  Anything read while
+// this write is in flight goes out with the next one.
+//
+auto Session::StartWrite(Direction& dir) -> void
+{
+    if (dir.writing || (dir.ring.Empty() && ba::buffer_size(dir.prefix) == 0) || mClosing) { return; }
+
+    dir.writing          = true;
+    dir.writeStarted     = std::chrono::steady_clock::now();
+    dir.writeStartedTick = mWheel->Now();
+
+    // the write may need an earlier timeout than the one that is set
+    if (mIdleWriteTicks && (!mTimeout.Pending() || mTimeoutAt > dir.writeStartedTick + mIdleWriteTicks))
+    {
+        ScheduleTimeout();
+    }
+    auto const buffers = dir.ring.PrepareWrite(dir.prefix);
+    dir.prefix = ba::const_buffer();
+    ba::async_write(
+        dir.to,
+        buffers,
+        MakeCustomAllocHandler(dir.writeMemory, std::bind(&Session::HandleWrite, shared_from_this(), std::ref(dir), std::placeholders::_1)));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto Session::HandleRead(Direction& dir, boost::system::error_code const& error, std::size_t bytes_transferred) -> void
+{
+    dir.reading = false;
+
+    if (!error)
+    {
+        mLastRead = mWheel->Now();
+        dir.metrics.reads.Add(1);
+        dir.metrics.bytes.Add(bytes_transferred);
+        dir.totals.reads.Add(1);
+        dir.totals.bytes.Add(bytes_transferred);
+
+        CommitRead(dir, ba::buffer_cast<char const*>(dir.ring.PrepareRead()), bytes_transferred);
+        Throttle(dir, bytes_transferred);
+        StartWrite(dir);
+        StartRead(dir);
+    }
+    else
+    {
+        if (mClosing)
+        {
+            std::cout << TimeStamp() << "[" << mId << "] " << dir.fromName << " socket successfully shut down:  " << error.message() << std::endl;
+        }
+        else
+        {
+            std::cout << TimeStamp() << "[" << mId << "] " << dir.fromName << " has closed the connection:  " << error.message() << std::endl;
+
+            // anything that has already been read still gets passed on before we close
+            dir.eof = true;
+            if (!dir.writing && dir.ring.Empty())
+            {
+                Close();
+            }
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto Session::HandleWrite(Direction& dir, boost::system::error_code const& error) -> void
+{
+    dir.writing = false;
+
+    if (!error)
+    {
+        auto const blocked_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - dir.writeStarted).count();
+        dir.metrics.writes.Add(1);
+        dir.metrics.write_blocked_us.Add(blocked_us);
+        dir.totals.writes.Add(1);
+        dir.totals.write_blocked_us.Add(blocked_us);
+
+        dir.ring.CommitWrite();
+
+        if (dir.eof && dir.ring.Empty())
+        {
+            Close();
+            return;
+        }
+
+        // everything that was read before the relay started has gone, so the rest can be spliced
+        if (mSplicePending)
+        {
+            mSplicePending = false;
+            if (!StartSplice())
+            {
+                StartRead(mClientToServer);
+                StartRead(mServerToClient);
+            }
+            return;
+        }
+
+        // and kick off another write (if anything arrived in the meantime), and another read
+        // (if we had stopped reading because the ring was full)
+        StartWrite(dir);
+        StartRead(dir);
+    }
+    else
+    {
+        if (!mClosing)
+        {
+            std::cout << TimeStamp() << "[" << mId << "] WARNING:  failed writing to " << dir.toName << ":  " << error.message() << std::endl;
+            Close();
+        }
+    }
+}
@@ -0,0 +1,176 @@
+#ifndef INCLUDED_SESSION_HEADER
+#define INCLUDED_SESSION_HEADER
+
+
+#include <memory>
+#include <chrono>
+#include <functional>
+#include <boost/noncopyable.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+#include "proxy.h"
+#include "splice_relay.h"
+#include "buffer_ring.h"
+#include "traffic_dump.h"
+#include "http_rewriter.h"
+#include "metrics.h"
+#include "upstream_pool.h"
+#include "load_balancer.h"
+#include "dns_cache.h"
+#include "block_pool.h"
+#include "handler_allocator.h"
+#include "timer_wheel.h"
+#include "rate_limiter.h"
+#include "proxy_protocol.h"
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// A single proxied connection:  one accepted client socket, plus its own connection to the
+// destination.  Each session owns its own buffers, so any number of sessions may be active at once.
+// All of a session's handlers run on the thread of the io_service that it was created with.
+//
+class Session : public std::enable_shared_from_this<Session>, private boost::noncopyable
+{
+public:
+    typedef std::function<void(std::shared_ptr<Session> const&)> CloseHandler;
+
+    // 'dump' may be null, in which case the traffic is not dumped.  'totals' are the metrics of
+    // the worker thread that this session runs on.  'balancer' picks the destination, and 'dns'
+    // resolves it.  'upstream' (which may be null) are that worker thread's pools of destination
+    // connections, and the relay buffers come from that worker thread's 'buffers'.  The
+    // session's timeouts run on that worker thread's 'wheel', and its traffic is shaped by the
+    // buckets from 'limiter'.
+    Session(boost::asio::io_service& io_service, ProxyParameters const& params, unsigned long long id, std::shared_ptr<TrafficDump::Producer> const& dump, std::shared_ptr<WorkerMetrics> const& totals, std::shared_ptr<LoadBalancer> const& balancer, std::shared_ptr<DnsCache> const& dns, std::shared_ptr<UpstreamPools const> const& upstream, std::shared_ptr<BlockPool> const& buffers, std::shared_ptr<TimerWheel> const& wheel, std::shared_ptr<RateLimiter> const& limiter);
+
+    auto Id() const -> unsigned long long;
+    auto Metrics() const -> SessionMetrics const&;
+
+    // the client-side socket.  The proxy accepts the incomming connection into this socket.
+    auto ListenSocket() -> boost::asio::ip::tcp::socket&;
+
+    // asynchronously read the client's PROXY header (if expected), resolve and connect to the
+    // destination (unless there is a connection waiting in the upstream pool), then start
+    // relaying.  'onClose' is called (exactly once) after both sockets have been closed.  Both
+    // may be called from any thread.
+    auto Start(CloseHandler onClose) -> void;
+    auto Stop() -> void;
+
+private:
+    auto HandleStart(CloseHandler onClose) -> void;
+    auto Close() -> void;
+    auto Connect() -> void;
+    auto StartRelay() -> void;
+    auto StartSplice() -> bool;
+    auto HandleSpliceDone(std::string const& what, boost::system::error_code const& error) -> void;
+    auto HandleSpliceProgress(bool clientToServer, std::size_t bytes) -> void;
+
+    auto StartProxyHeaderRead() -> void;
+    auto HandleProxyHeaderRead(boost::system::error_code const& error, std::size_t bytes_transferred) -> void;
+    auto HandleResolve       (boost::system::error_code const& error, boost::asio::ip::tcp::resolver::iterator iterator) -> void;
+    auto HandleConnect       (boost::system::error_code const& error)                                -> void;
+
+    // a single timer covers all of the session's timeouts.  Reads and writes only note the time,
+    // and the timer works out which deadline is next when it expires.
+    auto ScheduleTimeout() -> void;
+    auto HandleTimeout() -> void;
+    auto IsThrottled() const -> bool;
+
+    // one direction of the buffered relay:  'from' --> ring --> 'to'
+    struct Direction
+    {
+        Direction(boost::asio::ip::tcp::socket& from, boost::asio::ip::tcp::socket& to, char const* fromName, char const* toName, DumpDirection dumpDirection, ProxyParameters const& params, BlockPool& buffers, DirectionMetrics& metrics, DirectionMetrics& totals);
+
+        boost::asio::ip::tcp::socket&   from;
+        boost::asio::ip::tcp::socket&   to;
+        char const* const               fromName;
+        char const* const               toName;
+        DumpDirection const             dumpDirection;
+        unsigned long long              dumpSkipped;    // bytes dropped by the dump since the last that it took
+        BufferRing                      ring;
+        bool                            reading;
+        bool                            writing;
+        bool                            eof;        // 'from' has closed - close once the ring has drained
+
+        // there is only ever one read and one write outstanding, so each reuses the same memory
+        // for its handler - the relay loop never allocates
+        HandlerMemory                   readMemory;
+        HandlerMemory                   writeMemory;
+
+        // when set, the requests read from 'from' are rewritten before they are written to 'to'
+        std::unique_ptr<HttpRewriter>           rewriter;
+        std::vector<boost::asio::const_buffer>  segments;
+
+        // written to 'to' ahead of everything in the ring, by the next write
+        boost::asio::const_buffer               prefix;
+
+        DirectionMetrics&                       metrics;
+        DirectionMetrics&                       totals;
+        std::chrono::steady_clock::time_point   writeStarted;
+        unsigned long long                      writeStartedTick;   // on the timer wheel
+
+        // the session, client and aggregate buckets (any of which may be null).  When they are
+        // in debt, the next read waits on 'throttle' until they have been paid off.
+        std::shared_ptr<TokenBucket>            buckets[3];
+        WheelTimer                              throttle;
+        bool                                    throttled;
+    };
+
+    auto StartRead  (Direction& dir) -> void;
+    auto CommitRead (Direction& dir, char const* data, std::size_t bytes) -> void;
+    auto Throttle   (Direction& dir, std::size_t bytes) -> void;
+    auto StartWrite (Direction& dir) -> void;
+    auto HandleRead (Direction& dir, boost::system::error_code const& error, std::size_t bytes_transferred) -> void;
+    auto HandleWrite(Direction& dir, boost::system::error_code const& error)                                -> void;
+
+private:
+    unsigned long long const        mId;
+    ProxyParameters const           mParams;
+
+    boost::asio::io_service&        mIoService;
+    boost::asio::ip::tcp::socket    mListenSocket;
+    boost::asio::ip::tcp::socket    mDestSocket;
+    CloseHandler                    mCloseHandler;
+    std::shared_ptr<TrafficDump::Producer> const mDump;
+    bool                            mDumping;           // the dump took the session when it opened
+    std::shared_ptr<LoadBalancer> const mBalancer;
+    std::shared_ptr<DnsCache> const mDns;
+    std::shared_ptr<UpstreamPools const> const mUpstream;
+
+    // who the client really is, and the address that it connected to - from its PROXY header, if
+    // it sent one
+    boost::asio::ip::tcp::endpoint  mClient;
+    boost::asio::ip::tcp::endpoint  mClientTarget;
+    std::size_t                     mProxyHeaderRead;   // bytes of the client's header read so far
+    char                            mProxyHeader[PROXY_HEADER_V2_MAX];  // the destination's header
+
+    std::size_t                     mDestination;       // index into the balancer's destinations
+    bool                            mHaveDestination;
+    SpliceRelay                     mSpliceRelay;
+    bool                            mSplicePending;     // once what has already been read is written
+
+    SessionMetrics                  mMetrics;
+    std::shared_ptr<WorkerMetrics> const mTotals;
+    std::chrono::steady_clock::time_point mStarted;
+
+    // the timeouts, in wheel ticks (0 = none)
+    std::shared_ptr<TimerWheel> const mWheel;          // must outlive mTimeout
+    WheelTimer                      mTimeout;
+    unsigned long long              mTimeoutAt;
+    unsigned long long const        mIdleReadTicks;
+    unsigned long long const        mIdleWriteTicks;
+    unsigned long long              mHandshakeDeadline;
+    unsigned long long              mLifetimeDeadline;
+    unsigned long long              mLastRead;
+    bool                            mConnected;
+
+    std::shared_ptr<RateLimiter> const mLimiter;
+    std::shared_ptr<BlockPool> const mBuffers;          // must outlive the directions' rings
+    Direction                       mClientToServer;
+    Direction                       mServerToClient;
+
+    bool                            mClosing;
+};
+
+
+#endif  //INCLUDED_SESSION_HEADER
@@ -0,0 +1,240 @@
+#include "stdafx.h"
+#include "splice_relay.h"
+#include <stdexcept>
+
+#include <boost/asio.hpp>
+namespace ba = boost::asio;
+
+
+#if defined(__linux__)
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// One direction of the relay:  'from' --> pipe --> 'to'
+//
+struct SpliceRelay::Direction
+{
+    Direction(ba::ip::tcp::socket& from, ba::ip::tcp::socket& to, std::string const& fromName, std::string const& toName)
+        : from      (from)
+        , to        (to)
+        , fromName  (fromName)
+        , toName    (toName)
+        , capacity  {0}
+        , pending   {0}
+    {
+        pipe[0] = pipe[1] = -1;
+    }
+
+    ~Direction()
+    {
+        if (pipe[0] != -1) { ::close(pipe[0]); }
+        if (pipe[1] != -1) { ::close(pipe[1]); }
+    }
+
+    ba::ip::tcp::socket&    from;
+    ba::ip::tcp::socket&    to;
+    std::string const       fromName;
+    std::string const       toName;
+    int                     pipe[2];    // [0] is the read end, [1] is the write end
+    std::size_t             capacity;   // how much the pipe can hold
+    std::size_t             pending;    // how much is currently sitting in the pipe
+};
+
+namespace
+{
+    // ask for a bigger pipe than the default 64 KB, so that each wakeup moves more data
+    int const PIPE_SIZE = 256*1024;
+    unsigned int const SPLICE_FLAGS = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+
+    auto LastError() -> boost::system::error_code
+    {
+        return boost::system::error_code(errno, boost::system::system_category());
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+SpliceRelay::SpliceRelay(ba::ip::tcp::socket& listenSocket, ba::ip::tcp::socket& destSocket)
+    : mClientToServer   {new Direction(listenSocket, destSocket, "client", "server")}
+    , mServerToClient   {new Direction(destSocket, listenSocket, "server", "client")}
+    , mDone             {false}
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+SpliceRelay::~SpliceRelay()
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto SpliceRelay::IsSupported() -> bool
+{
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto SpliceRelay::Start(std::shared_ptr<void> const& owner, DoneHandler onDone, ProgressHandler onProgress) -> void
+{
+    mDoneHandler     = onDone;
+    mProgressHandler = onProgress;
+
+    for (auto dir : { mClientToServer.get(), mServerToClient.get() })
+    {
+        if (::pipe2(dir->pipe, O_NONBLOCK | O_CLOEXEC) != 0)
+        {
+            throw boost::system::system_error(LastError(), "pipe2");
+        }
+
+        // not fatal if this fails - we just end up with the default size
+        ::fcntl(dir->pipe[1], F_SETPIPE_SZ, PIPE_SIZE);
+        auto const capacity = ::fcntl(dir->pipe[1], F_GETPIPE_SZ);
+        dir->capacity = capacity > 0 ? capacity : 64*1024;
+
+        dir->from.non_blocking(true);
+    }
+
+    WaitReadable(owner, *mClientToServer);
+    WaitReadable(owner, *mServerToClient);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto SpliceRelay::WaitReadable(std::shared_ptr<void> const& owner, Direction& dir) -> void
+{
+    dir.from.async_read_some(
+        ba::null_buffers(),
+        std::bind(&SpliceRelay::HandleReadable, this, owner, std::ref(dir), std::placeholders::_1));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto SpliceRelay::WaitWritable(std::shared_ptr<void> const& owner, Direction& dir) -> void
+{
+    dir.to.async_write_some(
+        ba::null_buffers(),
+        std::bind(&SpliceRelay::HandleWritable, this, owner, std::ref(dir), std::placeholders::_1));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto SpliceRelay::HandleReadable(std::shared_ptr<void> const& owner, Direction& dir, boost::system::error_code const& error) -> void
+{
+    if (mDone) { return; }
+    if (error) { Done(dir.fromName + " read failed", error); return; }
+
+    // the owner may have closed the sockets before this handler ran - in which case the file
+    // descriptors may already belong to someone else
+    if (!dir.from.is_open() || !dir.to.is_open()) { return; }
+
+    while (true)
+    {
+        auto const n = ::splice(dir.from.native_handle(), nullptr, dir.pipe[1], nullptr, dir.capacity, SPLICE_FLAGS);
+        if (n > 0)
+        {
+            dir.pending += n;
+            break;
+        }
+        else if (n == 0)
+        {
+            Done(dir.fromName + " has closed the connection", ba::error::eof);
+            return;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            WaitReadable(owner, dir);
+            return;
+        }
+        else if (errno != EINTR)
+        {
+            Done(dir.fromName + " read failed", LastError());
+            return;
+        }
+    }
+
+    Flush(owner, dir);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto SpliceRelay::HandleWritable(std::shared_ptr<void> const& owner, Direction& dir, boost::system::error_code const& error) -> void
+{
+    if (mDone) { return; }
+    if (error) { Done(dir.toName + " write failed", error); return; }
+    if (!dir.from.is_open() || !dir.to.is_open()) { return; }
+
+    Flush(owner, dir);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Move everything in the pipe out to the 'to' socket.  Once the pipe is empty we go back to
+// waiting for more data on the 'from' socket, otherwise we wait for the 'to' socket to drain.
+//
+auto SpliceRelay::Flush(std::shared_ptr<void> const& owner, Direction& dir) -> void
+{
+    while (dir.pending > 0)
+    {
+        auto const n = ::splice(dir.pipe[0], nullptr, dir.to.native_handle(), nullptr, dir.pending, SPLICE_FLAGS);
+        if (n > 0)
+        {
+            dir.pending -= n;
+            if (mProgressHandler) { mProgressHandler(&dir == mClientToServer.get(), n); }
+        }
+        else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            WaitWritable(owner, dir);
+            return;
+        }
+        else if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else
+        {
+            Done(dir.toName + " write failed", n < 0 ? LastError() : ba::error::eof);
+            return;
+        }
+    }
+
+    WaitReadable(owner, dir);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto SpliceRelay::Done(std::string const& what, boost::system::error_code const& error) -> void
+{
+    if (mDone) { return; }
+    mDone = true;
+
+    // the handler typically holds a reference to our owner, so don't hang on to it
+    DoneHandler handler;
+    handler.swap(mDoneHandler);
+    if (handler)
+    {
+        handler(what, error);
+    }
+}
+
+
+#else  // __linux__
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+struct SpliceRelay::Direction {};
+
+SpliceRelay::SpliceRelay(ba::ip::tcp::socket&, ba::ip::tcp::socket&) : mDone{false} {}
+SpliceRelay::~SpliceRelay() {}
+
+auto SpliceRelay::IsSupported() -> bool { return false; }
+
+auto SpliceRelay::Start(std::shared_ptr<void> const&, DoneHandler, ProgressHandler) -> void
+{
+    throw std::runtime_error("SpliceRelay:  splice(2) is only available on Linux");
+}
+
+auto SpliceRelay::WaitReadable  (std::shared_ptr<void> const&, Direction&) -> void {}
+auto SpliceRelay::WaitWritable  (std::shared_ptr<void> const&, Direction&) -> void {}
+auto SpliceRelay::HandleReadable(std::shared_ptr<void> const&, Direction&, boost::system::error_code const&) -> void {}
+auto SpliceRelay::HandleWritable(std::shared_ptr<void> const&, Direction&, boost::system::error_code const&) -> void {}
+auto SpliceRelay::Flush         (std::shared_ptr<void> const&, Direction&) -> void {}
+auto SpliceRelay::Done(std::string const&, boost::system::error_code const&) -> void {}
+
+
+#endif  // __linux__
@@ -0,0 +1,56 @@
+#ifndef INCLUDED_SPLICE_RELAY_HEADER
+#define INCLUDED_SPLICE_RELAY_HEADER
+
+
+#include <memory>
+#include <string>
+#include <functional>
+#include <boost/noncopyable.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// A zero-copy relay engine for Linux.  Rather than reading each chunk into a user-space buffer and
+// writing it back out again, the data is moved socket --> pipe --> socket with splice(2), so it
+// never leaves the kernel.  The sockets are still driven by the asio reactor - we only ask asio
+// to tell us when a socket is readable/writable, and do the actual transfer ourselves.
+//
+// This relay cannot be used when the traffic needs to be inspected (i.e. dumped or rewritten).
+// On other platforms IsSupported() returns false, and Start() throws.
+//
+class SpliceRelay : private boost::noncopyable
+{
+public:
+    // called (once) when either direction hits EOF or an error.  'what' describes which side.
+    typedef std::function<void(std::string const& what, boost::system::error_code const& error)> DoneHandler;
+
+    // called each time some data has been moved out to the receiving socket
+    typedef std::function<void(bool clientToServer, std::size_t bytes)> ProgressHandler;
+
+    SpliceRelay(boost::asio::ip::tcp::socket& listenSocket, boost::asio::ip::tcp::socket& destSocket);
+    ~SpliceRelay();
+
+    static auto IsSupported() -> bool;
+
+    // 'owner' is kept alive by every outstanding handler.  It must own both of the sockets.
+    auto Start(std::shared_ptr<void> const& owner, DoneHandler onDone, ProgressHandler onProgress) -> void;
+
+private:
+    struct Direction;
+    auto WaitReadable  (std::shared_ptr<void> const& owner, Direction& dir) -> void;
+    auto WaitWritable  (std::shared_ptr<void> const& owner, Direction& dir) -> void;
+    auto HandleReadable(std::shared_ptr<void> const& owner, Direction& dir, boost::system::error_code const& error) -> void;
+    auto HandleWritable(std::shared_ptr<void> const& owner, Direction& dir, boost::system::error_code const& error) -> void;
+    auto Flush         (std::shared_ptr<void> const& owner, Direction& dir) -> void;
+    auto Done(std::string const& what, boost::system::error_code const& error) -> void;
+
+private:
+    std::unique_ptr<Direction>  mClientToServer;
+    std::unique_ptr<Direction>  mServerToClient;
+    DoneHandler                 mDoneHandler;
+    ProgressHandler             mProgressHandler;
+    bool                        mDone;
+};
+
+
+#endif  //INCLUDED_SPLICE_RELAY_HEADER
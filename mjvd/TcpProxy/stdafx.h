@@ -1,5 +1,8 @@
 #pragma once
 
+// the remainder of this file only applies to Windows builds
+#if defined(_WIN32)
+
 #ifndef NOMINMAX
 #define NOMINMAX
 #endif
@@ -28,3 +31,4 @@
 
 #include <sdkddkver.h>
 
+#endif  // _WIN32
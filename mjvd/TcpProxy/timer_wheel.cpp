@@ -0,0 +1,279 @@
+#include "stdafx.h"
+#include "timer_wheel.h"
+#include <algorithm>
+
+#include <boost/asio.hpp>
+namespace ba = boost::asio;
+
+
+namespace
+{
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // move every node of the list at 'from' onto the (empty) list at 'to'
+    auto Splice(TimerNode& from, TimerNode& to) -> void
+    {
+        if (from.next == &from) { return; }
+
+        to.next         = from.next;
+        to.prev         = from.prev;
+        to.next->prev   = &to;
+        to.prev->next   = &to;
+        from.next       = &from;
+        from.prev       = &from;
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+WheelTimer::WheelTimer()
+    : mWheel    {nullptr}
+    , mExpiry   {0}
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+WheelTimer::~WheelTimer()
+{
+    if (mWheel)
+    {
+        mWheel->Cancel(*this);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto WheelTimer::Pending() const -> bool
+{
+    return mWheel != nullptr;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+TimerWheel::TimerWheel(ba::io_service& io_service, std::chrono::milliseconds tick)
+    : mIoService    (io_service)
+    , mTick         {std::max(Clock::duration(1), std::chrono::duration_cast<Clock::duration>(tick))}
+    , mEpoch        {Clock::now()}
+    , mTimer        {io_service}
+    , mNow          {0}
+    , mPending      {0}
+    , mTicking      {false}
+    , mStopped      {false}
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Anything still scheduled is forgotten, so that its destructor doesn't come looking for us
+//
+TimerWheel::~TimerWheel()
+{
+    for (auto& level : mSlots)
+    {
+        for (auto& head : level)
+        {
+            while (head.next != &head)
+            {
+                auto& timer = static_cast<WheelTimer&>(*head.next);
+                Unlink(timer);
+            }
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto TimerWheel::Stop() -> void
+{
+    mIoService.post(std::bind(&TimerWheel::HandleStop, shared_from_this()));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto TimerWheel::HandleStop() -> void
+{
+    mStopped = true;
+
+    boost::system::error_code ignored;
+    mTimer.cancel(ignored);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto TimerWheel::ClockTicks() const -> unsigned long long
+{
+    return static_cast<unsigned long long>((Clock::now() - mEpoch) / mTick);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// While the wheel is idle, mNow isn't kept up to date
+//
+auto TimerWheel::Now() const -> unsigned long long
+{
+    return mTicking ? mNow : ClockTicks();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Rounded up, so that a timer never expires early
+//
+auto TimerWheel::Ticks(Clock::duration duration) const -> unsigned long long
+{
+    return static_cast<unsigned long long>((duration + mTick - Clock::duration(1)) / mTick);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Rounded down
+//
+auto TimerWheel::WholeTicks(Clock::duration duration) const -> unsigned long long
+{
+    return static_cast<unsigned long long>(duration / mTick);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto TimerWheel::ScheduleAt(WheelTimer& timer, unsigned long long expiry, WheelTimer::Handler handler) -> void
+{
+    if (timer.mWheel)
+    {
+        timer.mWheel->Cancel(timer);
+    }
+    if (mStopped) { return; }
+
+    // nothing is scheduled while we are idle, so we can skip straight to the present
+    if (!mTicking)
+    {
+        mNow = ClockTicks();
+    }
+
+    timer.mExpiry   = std::max(expiry, mNow + 1);
+    timer.mHandler  = std::move(handler);
+    timer.mWheel    = this;
+    Insert(timer);
+    ++mPending;
+
+    if (!mTicking)
+    {
+        StartTicking();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto TimerWheel::Cancel(WheelTimer& timer) -> void
+{
+    if (timer.mWheel != this) { return; }
+
+    Unlink(timer);
+    timer.mHandler = WheelTimer::Handler();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The level is picked by how far away the expiry is, and the slot by the expiry itself - so a
+// slot of level n holds the timers that are due in the same SLOTS^n ticks
+//
+auto TimerWheel::Insert(WheelTimer& timer) -> void
+{
+    auto const delta = timer.mExpiry > mNow ? timer.mExpiry - mNow : 0;
+
+    unsigned level = 0;
+    while (level + 1 < LEVELS && delta >= (1ull << (SLOT_BITS * (level + 1))))
+    {
+        ++level;
+    }
+
+    auto& head = mSlots[level][(timer.mExpiry >> (SLOT_BITS * level)) & (SLOTS - 1)];
+    TimerNode& node = timer;
+    node.prev       = head.prev;
+    node.next       = &head;
+    head.prev->next = &node;
+    head.prev       = &node;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto TimerWheel::Unlink(WheelTimer& timer) -> void
+{
+    TimerNode& node = timer;
+    node.prev->next = node.next;
+    node.next->prev = node.prev;
+    node.prev       = &node;
+    node.next       = &node;
+
+    timer.mWheel = nullptr;
+    --mPending;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Re-file the timers in the current slot of 'level' - they are now close enough to go into one
+// of the levels below
+//
+auto TimerWheel::Cascade(unsigned level) -> void
+{
+    TimerNode list;
+    Splice(mSlots[level][(mNow >> (SLOT_BITS * level)) & (SLOTS - 1)], list);
+
+    while (list.next != &list)
+    {
+        auto& timer = static_cast<WheelTimer&>(*list.next);
+        TimerNode& node = timer;
+        node.prev->next = node.next;
+        node.next->prev = node.prev;
+        Insert(timer);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Move on by one tick, and expire everything that is due
+//
+auto TimerWheel::Advance() -> void
+{
+    ++mNow;
+
+    // each level is cascaded as the one below it wraps around
+    for (unsigned level = 1; level < LEVELS; ++level)
+    {
+        if ((mNow & ((1ull << (SLOT_BITS * level)) - 1)) != 0) { break; }
+        Cascade(level);
+    }
+
+    // the handlers may schedule or cancel any timer (including the ones still waiting to expire
+    // here), so the due timers are taken off one at a time
+    TimerNode due;
+    Splice(mSlots[0][mNow & (SLOTS - 1)], due);
+
+    while (due.next != &due)
+    {
+        auto& timer = static_cast<WheelTimer&>(*due.next);
+        Unlink(timer);
+
+        auto handler = std::move(timer.mHandler);
+        timer.mHandler = WheelTimer::Handler();
+        handler();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto TimerWheel::StartTicking() -> void
+{
+    mTicking = true;
+    mTimer.expires_at(mEpoch + mTick * static_cast<Clock::rep>(mNow + 1));
+    mTimer.async_wait(std::bind(&TimerWheel::HandleTick, shared_from_this(), std::placeholders::_1));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Catch up with the clock (the io_service may have been busy), then wait for the next tick - or
+// go idle once nothing is scheduled
+//
+auto TimerWheel::HandleTick(boost::system::error_code const& error) -> void
+{
+    if (error || mStopped)
+    {
+        mTicking = false;
+        return;
+    }
+
+    auto const target = ClockTicks();
+    while (mNow < target && mPending > 0)
+    {
+        Advance();
+    }
+
+    if (mPending == 0)
+    {
+        mTicking = false;
+        return;
+    }
+
+    StartTicking();
+}
@@ -0,0 +1,114 @@
+#ifndef INCLUDED_TIMER_WHEEL_HEADER
+#define INCLUDED_TIMER_WHEEL_HEADER
+
+
+#include <memory>
+#include <chrono>
+#include <functional>
+#include <boost/noncopyable.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+
+class TimerWheel;
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// the links that put a timer (or a wheel slot's list head) in a slot's list
+struct TimerNode
+{
+    TimerNode() : prev(this), next(this) {}
+
+    TimerNode*  prev;
+    TimerNode*  next;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// One timer on a TimerWheel.  Embedded in its owner, so scheduling it never allocates.  It must
+// only be used on the wheel's own thread, and it is cancelled when it is destroyed - so the wheel
+// must outlive it.
+//
+class WheelTimer : private TimerNode, private boost::noncopyable
+{
+public:
+    typedef std::function<void()> Handler;
+
+    WheelTimer();
+    ~WheelTimer();
+
+    auto Pending() const -> bool;
+
+private:
+    friend class TimerWheel;
+
+    TimerWheel*         mWheel;     // while pending
+    unsigned long long  mExpiry;    // in ticks
+    Handler             mHandler;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// A hierarchical timing wheel, for the timeouts of many sessions on one io_service.  Rather than
+// an asio timer per session (each of which is a heap operation on the io_service's timer queue
+// whenever it is set or cancelled), there is a single asio timer that ticks the wheel, and
+// scheduling, cancelling or expiring a timer is O(1).
+//
+// There are LEVELS wheels of SLOTS slots.  Level 0 holds the timers that expire within the next
+// SLOTS ticks, one slot per tick.  Each slot of level n covers SLOTS^n ticks, and as level n-1
+// wraps around, the next slot of level n is cascaded down into the levels below.  Timers further
+// out than SLOTS^LEVELS ticks wait in the last level, and are cascaded again until they are due.
+//
+// The wheel only ticks while it has timers pending.  Everything (except Stop()) must be called
+// on the wheel's io_service.
+//
+class TimerWheel : public std::enable_shared_from_this<TimerWheel>, private boost::noncopyable
+{
+public:
+    TimerWheel(boost::asio::io_service& io_service, std::chrono::milliseconds tick);
+    ~TimerWheel();
+
+    // may be called from any thread.  Stops ticking - pending timers will never expire.
+    auto Stop() -> void;
+
+    // the current time, in ticks
+    auto Now() const -> unsigned long long;
+    auto Ticks(std::chrono::steady_clock::duration duration) const -> unsigned long long;
+    auto WholeTicks(std::chrono::steady_clock::duration duration) const -> unsigned long long;
+
+    // call 'handler' once Now() has reached 'expiry'.  Replaces anything that 'timer' was
+    // already scheduled for.
+    auto ScheduleAt(WheelTimer& timer, unsigned long long expiry, WheelTimer::Handler handler) -> void;
+    auto Cancel(WheelTimer& timer) -> void;
+
+private:
+    static unsigned const           SLOT_BITS = 6;
+    static unsigned const           SLOTS     = 1u << SLOT_BITS;
+    static unsigned const           LEVELS    = 4;
+
+    typedef std::chrono::steady_clock Clock;
+
+    auto HandleStop() -> void;
+    auto ClockTicks() const -> unsigned long long;
+    auto Insert(WheelTimer& timer) -> void;
+    auto Unlink(WheelTimer& timer) -> void;
+    auto Cascade(unsigned level) -> void;
+    auto Advance() -> void;
+    auto StartTicking() -> void;
+    auto HandleTick(boost::system::error_code const& error) -> void;
+
+private:
+    boost::asio::io_service&        mIoService;
+    Clock::duration const           mTick;
+    Clock::time_point const         mEpoch;
+    boost::asio::steady_timer       mTimer;
+
+    TimerNode                       mSlots[LEVELS][SLOTS];  // list heads
+    unsigned long long              mNow;                   // the last tick that was processed
+    std::size_t                     mPending;
+    bool                            mTicking;
+    bool                            mStopped;
+};
+
+
+#endif  //INCLUDED_TIMER_WHEEL_HEADER
@@ -0,0 +1,407 @@
+#include "stdafx.h"
+#include "traffic_dump.h"
+#include "pcapng_writer.h"
+#include "utils.h"
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/algorithm/string/replace.hpp>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/date_time/c_local_time_adjustor.hpp>
+namespace pt = boost::posix_time;
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+struct TrafficDump::Record
+{
+    enum class Type { Open, Data, Close };
+
+    explicit Record(std::size_t capacity) : type{Type::Data}, timestamp_us{0}, session_id{0}, direction{DumpDirection::ClientToServer}, skipped(), size{0}, data(capacity) {}
+
+    Type                            type;
+    long long                       timestamp_us;   // micro-seconds since the epoch (UTC)
+    unsigned long long              session_id;
+    DumpDirection                   direction;      // Data only
+    unsigned long long              skipped[2];     // by DumpDirection:  bytes dropped ahead of this record (Data and Close)
+    std::size_t                     size;           // Data only
+    std::vector<char>               data;           // Data only
+    boost::asio::ip::tcp::endpoint  client;         // Open only
+    boost::asio::ip::tcp::endpoint  server;         // Open only
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+struct TrafficDump::Producer::Queues
+{
+    Queues(std::size_t records, std::size_t controls) : free(records), controls(controls), full(records + controls) {}
+
+    boost::lockfree::spsc_queue<Record*>    free;       // writer --> producer
+    boost::lockfree::spsc_queue<Record*>    controls;   // writer --> producer (open and close records)
+    boost::lockfree::spsc_queue<Record*>    full;       // producer --> writer
+    unsigned long long                      reported_dropped = 0;           // only touched by the writer
+    unsigned long long                      reported_dropped_sessions = 0;  // only touched by the writer
+};
+
+
+namespace
+{
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // same format as TimeStamp(), but for the time at which the record was captured
+    auto FormatTimeStamp(long long timestamp_us) -> std::string
+    {
+        auto const utc   = pt::from_time_t(static_cast<std::time_t>(timestamp_us / 1000000)) + pt::microseconds(timestamp_us % 1000000);
+        auto const local = boost::date_time::c_local_adjustor<pt::ptime>::utc_to_local(utc);
+
+        std::string t = pt::to_simple_string(local.time_of_day());
+        t.resize(12, '0');
+        return t.append(1, ' ');
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto Now() -> long long
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto Index(DumpDirection direction) -> std::size_t
+    {
+        return direction == DumpDirection::ClientToServer ? 0 : 1;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto Label(DumpDirection direction) -> char const*
+    {
+        return direction == DumpDirection::ClientToServer ? "client --> server" : "client <-- server";
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    auto WriteHex(std::ostream& os, char const* data, std::size_t size) -> void
+    {
+        static char const HEX[] = "0123456789abcdef";
+
+        for (std::size_t offset = 0; offset < size; offset += 16)
+        {
+            auto const n = std::min<std::size_t>(16, size - offset);
+
+            os << "    " << std::hex << std::setw(8) << std::setfill('0') << offset << std::dec << "  ";
+            for (std::size_t i = 0; i < 16; ++i)
+            {
+                if (i < n)
+                {
+                    auto const c = static_cast<unsigned char>(data[offset + i]);
+                    os << HEX[c >> 4] << HEX[c & 0x0f] << ' ';
+                }
+                else
+                {
+                    os << "   ";
+                }
+                if (i == 7) { os << ' '; }
+            }
+
+            os << " |";
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                auto const c = static_cast<unsigned char>(data[offset + i]);
+                os << (c >= 0x20 && c < 0x7f ? static_cast<char>(c) : '.');
+            }
+            os << "|\n";
+        }
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// There are as many open and close records as there are data records (and at least enough for
+// one session) - they don't carry any data, so they are cheap.
+//
+TrafficDump::Producer::Producer(std::size_t recordSize, std::size_t records)
+    : mQueues       {new Queues(records, std::max<std::size_t>(records, 2))}
+    , mRecordSize   {recordSize}
+    , mOpenSessions {0}
+    , mDropped      {0}
+    , mDroppedSessions{0}
+{
+    for (std::size_t i = 0; i < records; ++i)
+    {
+        mRecords.emplace_back(new Record(recordSize));
+        mQueues->free.push(mRecords.back().get());
+    }
+
+    for (std::size_t i = 0; i < std::max<std::size_t>(records, 2); ++i)
+    {
+        mControls.emplace_back(new Record(0));
+        mQueues->controls.push(mControls.back().get());
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+TrafficDump::Producer::~Producer()
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Take a free record, or count a drop if there aren't any
+//
+auto TrafficDump::Producer::Acquire(unsigned long long sessionId) -> Record*
+{
+    Record* record = nullptr;
+    if (!mQueues->free.pop(record))
+    {
+        mDropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    record->timestamp_us = Now();
+    record->session_id   = sessionId;
+    return record;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Only ever called when there is a control record to take (see Open())
+//
+auto TrafficDump::Producer::AcquireControl(unsigned long long sessionId) -> Record*
+{
+    Record* record = nullptr;
+    mQueues->controls.pop(record);
+
+    record->timestamp_us = Now();
+    record->session_id   = sessionId;
+    record->skipped[0]   = 0;
+    record->skipped[1]   = 0;
+    return record;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto TrafficDump::Producer::Capture(unsigned long long sessionId, DumpDirection direction, char const* data, std::size_t size, unsigned long long& skipped) -> void
+{
+    while (size > 0)
+    {
+        auto record = Acquire(sessionId);
+        if (!record)
+        {
+            skipped += size;
+            return;
+        }
+
+        auto const n = std::min(size, mRecordSize);
+        record->type      = Record::Type::Data;
+        record->direction = direction;
+        record->skipped[Index(direction)]     = skipped;
+        record->skipped[1 - Index(direction)] = 0;
+        record->size      = n;
+        std::memcpy(record->data.data(), data, n);
+        skipped = 0;
+
+        // can't fail - there are never more records in flight than the queue can hold
+        mQueues->full.push(record);
+
+        data += n;
+        size -= n;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Takes a control record for the open, and sets another aside for the close:  there must always
+// be at least one for each session that is open.
+//
+auto TrafficDump::Producer::Open(unsigned long long sessionId, boost::asio::ip::tcp::endpoint const& client, boost::asio::ip::tcp::endpoint const& server) -> bool
+{
+    if (mQueues->controls.read_available() < mOpenSessions + 2)
+    {
+        mDroppedSessions.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    ++mOpenSessions;
+
+    auto record = AcquireControl(sessionId);
+    record->type   = Record::Type::Open;
+    record->client = client;
+    record->server = server;
+    mQueues->full.push(record);
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto TrafficDump::Producer::Close(unsigned long long sessionId, unsigned long long skippedToServer, unsigned long long skippedToClient) -> void
+{
+    --mOpenSessions;
+
+    auto record = AcquireControl(sessionId);
+    record->type = Record::Type::Close;
+    record->skipped[Index(DumpDirection::ClientToServer)] = skippedToServer;
+    record->skipped[Index(DumpDirection::ServerToClient)] = skippedToClient;
+    mQueues->full.push(record);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+TrafficDump::TrafficDump(std::string const& filename, DumpFormat format, std::size_t producers, std::size_t recordSize, std::size_t recordsPerProducer)
+    : mOut          {&std::cout}
+    , mFormat       {format}
+    , mShuttingDown {false}
+{
+    if (!filename.empty())
+    {
+        std::unique_ptr<std::ofstream> file(new std::ofstream(filename, std::ios::out | std::ios::trunc | std::ios::binary));
+        if (!file->is_open()) { throw std::runtime_error("TrafficDump:  unable to open dump file:  " + filename); }
+        mFile = std::move(file);
+        mOut  = mFile.get();
+    }
+
+    if (format == DumpFormat::Pcapng)
+    {
+        if (!mFile) { throw std::runtime_error("TrafficDump:  pcapng output must be written to a file"); }
+        mPcapng.reset(new PcapngWriter(*mOut));
+    }
+
+    for (std::size_t i = 0; i < producers; ++i)
+    {
+        mProducers.emplace_back(new Producer(recordSize, recordsPerProducer));
+    }
+
+    mWorker.reset(new std::thread([this]() { MainLoop(); }));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+TrafficDump::~TrafficDump()
+{
+    // the writer drains whatever is left in the queues before it exits
+    mShuttingDown = true;
+    mWorker->join();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto TrafficDump::GetProducer(std::size_t index) -> Producer&
+{
+    return *mProducers[index % mProducers.size()];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The writer never signals the producers (and they never signal it) - when there is nothing to
+// do it just naps for a milli-second.  That keeps every syscall off the relay threads.
+//
+auto TrafficDump::MainLoop() -> void
+{
+    try
+    {
+        while (true)
+        {
+            bool idle = true;
+
+            for (auto& producer : mProducers)
+            {
+                auto& queues = *producer->mQueues;
+
+                Record* record = nullptr;
+                while (queues.full.pop(record))
+                {
+                    WriteRecord(*record);
+                    (record->type == Record::Type::Data ? queues.free : queues.controls).push(record);
+                    idle = false;
+                }
+
+                // a capture file can't say so itself, so it is reported on the console
+                auto& report = mPcapng ? std::cout : *mOut;
+
+                auto const dropped = producer->mDropped.load(std::memory_order_relaxed);
+                if (dropped != queues.reported_dropped)
+                {
+                    report << TimeStamp() << "*** traffic dump fell behind - dropped " << (dropped - queues.reported_dropped) << " chunk(s) ***\n" << std::endl;
+                }
+                queues.reported_dropped = dropped;
+
+                auto const droppedSessions = producer->mDroppedSessions.load(std::memory_order_relaxed);
+                if (droppedSessions != queues.reported_dropped_sessions)
+                {
+                    report << TimeStamp() << "*** traffic dump fell behind - did not capture " << (droppedSessions - queues.reported_dropped_sessions) << " session(s) ***\n" << std::endl;
+                }
+                queues.reported_dropped_sessions = droppedSessions;
+            }
+
+            if (idle)
+            {
+                Flush();
+                if (mShuttingDown) { return; }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+    catch (std::exception& e)
+    {
+        std::cout << TimeStamp() << "ERROR:  TrafficDump::MainLoop():  " << e.what() << std::endl;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto TrafficDump::Flush() -> void
+{
+    if (mPcapng) { mPcapng->Flush(); }
+    else         { mOut->flush(); }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto TrafficDump::WriteRecord(Record const& record) -> void
+{
+    if (mPcapng)
+    {
+        mPcapng->Skip(record.session_id, true,  record.skipped[Index(DumpDirection::ClientToServer)]);
+        mPcapng->Skip(record.session_id, false, record.skipped[Index(DumpDirection::ServerToClient)]);
+
+        switch (record.type)
+        {
+        case Record::Type::Open:  mPcapng->Open (record.timestamp_us, record.session_id, record.client, record.server); break;
+        case Record::Type::Close: mPcapng->Close(record.timestamp_us, record.session_id); break;
+        case Record::Type::Data:  mPcapng->Data (record.timestamp_us, record.session_id, record.direction == DumpDirection::ClientToServer, record.data.data(), record.size); break;
+        }
+        return;
+    }
+
+    auto& os = *mOut;
+    for (auto const direction : { DumpDirection::ClientToServer, DumpDirection::ServerToClient })
+    {
+        if (auto const skipped = record.skipped[Index(direction)])
+        {
+            os << FormatTimeStamp(record.timestamp_us) << "[" << record.session_id << "] " << Label(direction) << ":  *** " << skipped << " bytes not captured ***\n\n";
+        }
+    }
+
+    os << FormatTimeStamp(record.timestamp_us) << "[" << record.session_id << "] ";
+
+    switch (record.type)
+    {
+    case Record::Type::Open:
+        os << "session opened:  [" << record.client.address().to_string() << "]:" << record.client.port() << "  --->  [" << record.server.address().to_string() << "]:" << record.server.port() << "\n\n";
+        return;
+
+    case Record::Type::Close:
+        os << "session closed\n\n";
+        return;
+
+    case Record::Type::Data:
+        os << Label(record.direction);
+        break;
+    }
+
+    switch (mFormat)
+    {
+    case DumpFormat::Text:
+        {
+            std::string const data(record.data.data(), record.size);
+            os << ":\n    |" << boost::replace_all_copy(data, "\n", "\n    |") << "\n\n";
+            break;
+        }
+
+    case DumpFormat::Hex:
+    case DumpFormat::Pcapng:
+        os << ":  " << record.size << " bytes\n";
+        WriteHex(os, record.data.data(), record.size);
+        os << "\n";
+        break;
+    }
+}
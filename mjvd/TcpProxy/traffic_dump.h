@@ -0,0 +1,114 @@
+#ifndef INCLUDED_TRAFFIC_DUMP_HEADER
+#define INCLUDED_TRAFFIC_DUMP_HEADER
+
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <iosfwd>
+#include <boost/noncopyable.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+enum class DumpFormat
+{
+    Text,   // the raw data, as text (this is what TcpProxy has always written to the console)
+    Hex,    // hexdump -C style
+    Pcapng, // a capture file that Wireshark can open (see PcapngWriter)
+};
+
+enum class DumpDirection
+{
+    ClientToServer,
+    ServerToClient,
+};
+
+
+class PcapngWriter;
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Writes the proxied traffic out on a background thread, so that the console (or the disk) can
+// never slow down the relay.
+//
+// Each relay thread gets its own Producer.  A producer hands records to the writer thread through
+// lock-free single-producer/single-consumer queues:  'free' records flow from the writer to the
+// producer, and 'full' records flow back.  Every record is allocated up front, so capturing a
+// chunk is just a memcpy.  If the writer falls behind and the producer runs out of free records,
+// the chunk is dropped (and counted) - capture never stalls relaying.  The bytes that were dropped
+// are carried by the next record of the same direction, so the gap shows up in the output.
+//
+// A session's open and close records come from a separate pool, and its close record is set
+// aside when it opens - so they are never dropped.  If that pool has run out, the session isn't
+// captured at all (and is counted).
+//
+class TrafficDump : private boost::noncopyable
+{
+public:
+    class Producer;
+
+    // 'filename' may be empty, in which case everything is written to stdout (not for pcapng)
+    TrafficDump(std::string const& filename, DumpFormat format, std::size_t producers, std::size_t recordSize, std::size_t recordsPerProducer);
+    ~TrafficDump();
+
+    auto GetProducer(std::size_t index) -> Producer&;
+
+private:
+    struct Record;
+    auto MainLoop() -> void;
+    auto WriteRecord(Record const& record) -> void;
+    auto Flush() -> void;
+
+private:
+    std::unique_ptr<std::ostream>           mFile;
+    std::ostream*                           mOut;
+    DumpFormat const                        mFormat;
+    std::unique_ptr<PcapngWriter>           mPcapng;
+    std::vector<std::unique_ptr<Producer>>  mProducers;
+    std::atomic<bool>                       mShuttingDown;
+    std::unique_ptr<std::thread>            mWorker;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Must only ever be used from a single thread.
+//
+class TrafficDump::Producer : private boost::noncopyable
+{
+public:
+    Producer(std::size_t recordSize, std::size_t records);
+    ~Producer();
+
+    // the session is connected to its destination.  Never blocks.  Returns false if the session
+    // can't be captured - in which case neither Capture() nor Close() may be called for it.
+    auto Open(unsigned long long sessionId, boost::asio::ip::tcp::endpoint const& client, boost::asio::ip::tcp::endpoint const& server) -> bool;
+
+    // never blocks.  Chunks bigger than a record are split over several records.  'skipped' is
+    // the number of bytes in this direction that have been dropped since the last chunk that was
+    // captured:  it is written ahead of this chunk (and reset), or grows if this one is dropped too.
+    auto Capture(unsigned long long sessionId, DumpDirection direction, char const* data, std::size_t size, unsigned long long& skipped) -> void;
+
+    // the session has closed, with the bytes dropped at the end of each direction.  Never blocks,
+    // and is never dropped.
+    auto Close(unsigned long long sessionId, unsigned long long skippedToServer, unsigned long long skippedToClient) -> void;
+
+private:
+    auto Acquire(unsigned long long sessionId) -> Record*;
+    auto AcquireControl(unsigned long long sessionId) -> Record*;
+
+    friend class TrafficDump;
+    struct Queues;
+    std::unique_ptr<Queues>                 mQueues;
+    std::vector<std::unique_ptr<Record>>    mRecords;
+    std::vector<std::unique_ptr<Record>>    mControls;      // open and close records
+    std::size_t const                       mRecordSize;
+    std::size_t                             mOpenSessions;  // each has a control record set aside for its close
+    std::atomic<unsigned long long>         mDropped;
+    std::atomic<unsigned long long>         mDroppedSessions;
+};
+
+
+#endif  //INCLUDED_TRAFFIC_DUMP_HEADER
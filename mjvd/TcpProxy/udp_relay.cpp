@@ -0,0 +1,334 @@
+#include "stdafx.h"
+#include "udp_relay.h"
+#include "utils.h"
+#include <iostream>
+
+#include <boost/asio.hpp>
+namespace ba = boost::asio;
+
+
+namespace
+{
+    // the flows only expire after seconds, so the wheel needn't tick any faster than this
+    auto const TIMER_TICK = std::chrono::milliseconds(100);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+struct UdpRelay::Flow : private boost::noncopyable
+{
+    Flow(ba::io_service& io_service, unsigned long long id, ba::ip::udp::endpoint const& client, std::size_t destination, std::size_t batch)
+        : id            {id}
+        , client        (client)
+        , destination   {destination}
+        , upstream      {io_service}
+        , lastActive    {0}
+        , replied       {false}
+        , closed        {false}
+    {
+        pending.reserve(batch);
+    }
+
+    unsigned long long const        id;
+    ba::ip::udp::endpoint const     client;
+    std::size_t const               destination;    // the balancer's index
+    ba::ip::udp::socket             upstream;       // connected to the destination
+    WheelTimer                      expiry;
+    unsigned long long              lastActive;     // in wheel ticks
+    bool                            replied;
+    bool                            closed;
+
+    // the datagrams in the batch being relayed that are for this flow
+    std::vector<std::size_t>        pending;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+UdpRelay::UdpRelay(ba::io_service& io_service, ProxyParameters const& params)
+    : mParams       (params)
+    , mIoService    (io_service)
+    , mSignals      {io_service}
+    , mSocket       {io_service}
+    , mStopped      {false}
+    , mBalancer     (std::make_shared<LoadBalancer>(params))
+    , mWheel        (std::make_shared<TimerWheel>(io_service, TIMER_TICK))
+    , mIdleTicks    {mWheel->Ticks(std::chrono::seconds(params.udp_idle_timeout_s))}
+    , mNextFlowId   {0}
+    , mBatch        (params.udp_batch)
+    , mDropped      {0}
+    , mFlowsOpened  {0}
+{
+    mDatagrams[0] = mDatagrams[1] = 0;
+    mBytes[0]     = mBytes[1]     = 0;
+    mTouched.reserve(params.udp_batch);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+UdpRelay::~UdpRelay()
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The listening address and the destinations are resolved once, up front
+//
+auto UdpRelay::Start() -> void
+{
+    mSignals.add(SIGINT);
+    mSignals.add(SIGTERM);
+#if defined (SIGQUIT)
+    mSignals.add(SIGQUIT);
+#endif
+    mSignals.async_wait(std::bind(&UdpRelay::HandleSignal, shared_from_this(), std::placeholders::_1));
+
+    ba::ip::udp::resolver resolver(mIoService);
+    std::cout << TimeStamp() << "resolving listening address:  [" << mParams.listen_addr << "]:" << mParams.listen_port << std::endl;
+    ba::ip::udp::endpoint const endpoint = *resolver.resolve(ba::ip::udp::resolver::query(mParams.listen_addr, mParams.listen_port));
+
+    for (std::size_t d = 0; d < mBalancer->Size(); ++d)
+    {
+        auto const& destination = mBalancer->GetDestination(d);
+        std::cout << TimeStamp() << "resolving destination address:  [" << destination.addr << "]:" << destination.port << std::endl;
+        mDestinations.push_back(*resolver.resolve(ba::ip::udp::resolver::query(destination.addr, destination.port)));
+    }
+
+    mSocket.open(endpoint.protocol());
+    mSocket.set_option(ba::ip::udp::socket::reuse_address(true));
+    mSocket.bind(endpoint);
+    mSocket.non_blocking(true);
+
+    std::cout << TimeStamp() << "relaying UDP from [" << endpoint.address().to_string() << "]:" << endpoint.port() << " in batches of up to " << mBatch.Capacity() << " datagrams" << std::endl;
+    StartClientWait();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto UdpRelay::Stop() -> void
+{
+    mIoService.post(std::bind(&UdpRelay::HandleStop, shared_from_this()));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto UdpRelay::HandleSignal(boost::system::error_code const& error) -> void
+{
+    // cancelled by HandleStop()
+    if (error == ba::error::operation_aborted) { return; }
+
+    HandleStop();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto UdpRelay::HandleStop() -> void
+{
+    if (mStopped) { return; }
+    mStopped = true;
+    std::cout << TimeStamp() << "shutting down the UDP relay" << std::endl;
+
+    boost::system::error_code ignored;
+    mSignals.cancel(ignored);
+    mSocket.close(ignored);
+
+    std::cout << TimeStamp() << "closing " << mFlows.size() << " active flow(s)" << std::endl;
+    while (!mFlows.empty())
+    {
+        CloseFlow(*mFlows.begin()->second);
+    }
+    mWheel->Stop();
+
+    std::cout
+        << TimeStamp() << mFlowsOpened << " flow(s):  "
+        << mDatagrams[0] << " datagram(s) (" << mBytes[0] << " bytes) client --> server, "
+        << mDatagrams[1] << " datagram(s) (" << mBytes[1] << " bytes) server --> client, "
+        << mDropped << " dropped"
+        << std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// We only ask asio to tell us when there is something to read - the batch does the reading
+//
+auto UdpRelay::StartClientWait() -> void
+{
+    mSocket.async_receive(ba::null_buffers(), std::bind(&UdpRelay::HandleClientReadable, shared_from_this(), std::placeholders::_1));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Take everything that is waiting (up to a batch), sort it by flow, then send each flow's share
+// with a single call
+//
+auto UdpRelay::HandleClientReadable(boost::system::error_code const& error) -> void
+{
+    if (mStopped) { return; }
+
+    if (error)
+    {
+        std::cout << TimeStamp() << "WARNING:  UdpRelay::HandleClientReadable():  failed:  " << error.message() << std::endl;
+        StartClientWait();
+        return;
+    }
+
+    boost::system::error_code ec;
+    auto const received = mBatch.Receive(mSocket, ec);
+    if (ec)
+    {
+        std::cout << TimeStamp() << "WARNING:  failed to receive from the clients:  " << ec.message() << std::endl;
+    }
+
+    auto const now = mWheel->Now();
+    for (std::size_t i = 0; i < received; ++i)
+    {
+        auto const flow = GetFlow(mBatch.From(i));
+        if (!flow)
+        {
+            ++mDropped;
+            continue;
+        }
+
+        if (flow->pending.empty())
+        {
+            mTouched.push_back(flow);
+        }
+        flow->pending.push_back(i);
+        flow->lastActive = now;
+
+        ++mDatagrams[0];
+        mBytes[0] += mBatch.Size(i);
+    }
+
+    for (auto flow : mTouched)
+    {
+        auto const sent = mBatch.Send(flow->upstream, flow->pending.data(), flow->pending.size());
+        mDropped += flow->pending.size() - sent;
+        flow->pending.clear();
+    }
+    mTouched.clear();
+
+    StartClientWait();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The client's flow - opened (on the destination that the balancer picks) if this is the first
+// that we have heard from it.  Null if it can't have one.
+//
+auto UdpRelay::GetFlow(ba::ip::udp::endpoint const& client) -> Flow*
+{
+    auto const it = mFlows.find(client);
+    if (it != mFlows.end()) { return it->second.get(); }
+
+    if (mFlows.size() >= mParams.udp_max_flows) { return nullptr; }
+
+    auto const destination = mBalancer->Choose(client.address());
+    auto const flow = std::make_shared<Flow>(mIoService, ++mNextFlowId, client, destination, mBatch.Capacity());
+
+    boost::system::error_code ec;
+    flow->upstream.open(mDestinations[destination].protocol(), ec);
+    if (!ec) { flow->upstream.connect(mDestinations[destination], ec); }
+    if (!ec) { flow->upstream.non_blocking(true, ec); }
+    if (ec)
+    {
+        std::cout << TimeStamp() << "[" << flow->id << "] ERROR:  failed to open a flow to the destination:  " << ec.message() << std::endl;
+        mBalancer->Failed(destination);
+        mBalancer->Release(destination);
+        return nullptr;
+    }
+
+    auto const local = flow->upstream.local_endpoint(ec);
+    std::cout << TimeStamp() << "[" << flow->id << "] new flow:    [" << client.address().to_string() << "]:" << client.port() << "  --->  [" << local.address().to_string() << "]:" << local.port() << "  --->  [" << mDestinations[destination].address().to_string() << "]:" << mDestinations[destination].port() << std::endl;
+
+    mFlows[client] = flow;
+    ++mFlowsOpened;
+
+    flow->lastActive = mWheel->Now();
+    ScheduleExpiry(*flow);
+    StartUpstreamWait(flow);
+    return flow.get();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Closing the socket cancels the wait, whose handler keeps the flow alive until it has run
+//
+auto UdpRelay::CloseFlow(Flow& flow) -> void
+{
+    flow.closed = true;
+    mWheel->Cancel(flow.expiry);
+    mBalancer->Release(flow.destination);
+
+    boost::system::error_code ignored;
+    flow.upstream.close(ignored);
+
+    std::cout << TimeStamp() << "[" << flow.id << "] flow closed" << std::endl;
+    mFlows.erase(flow.client);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// As with a session's timeouts, relaying only notes the time, and the timer works out whether
+// the flow really has been idle when it expires
+//
+auto UdpRelay::ScheduleExpiry(Flow& flow) -> void
+{
+    auto const flowPtr = &flow;
+    mWheel->ScheduleAt(flow.expiry, flow.lastActive + mIdleTicks, [this, flowPtr]() { HandleExpiry(*flowPtr); });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto UdpRelay::HandleExpiry(Flow& flow) -> void
+{
+    if (mWheel->Now() < flow.lastActive + mIdleTicks)
+    {
+        ScheduleExpiry(flow);
+        return;
+    }
+
+    std::cout << TimeStamp() << "[" << flow.id << "] closing:  nothing has been relayed for " << mParams.udp_idle_timeout_s << "s" << std::endl;
+    CloseFlow(flow);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto UdpRelay::StartUpstreamWait(std::shared_ptr<Flow> const& flow) -> void
+{
+    flow->upstream.async_receive(ba::null_buffers(), std::bind(&UdpRelay::HandleUpstreamReadable, shared_from_this(), flow, std::placeholders::_1));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The replies all go back to the flow's client, with a single call.  Once the destination has
+// refused the flow (an ICMP port unreachable, on the connected socket), there is no point in
+// keeping it.
+//
+auto UdpRelay::HandleUpstreamReadable(std::shared_ptr<Flow> const& flow, boost::system::error_code const& error) -> void
+{
+    if (mStopped || flow->closed) { return; }
+
+    boost::system::error_code ec = error;
+    std::size_t received = 0;
+    if (!ec)
+    {
+        received = mBatch.Receive(flow->upstream, ec);
+    }
+
+    if (ec)
+    {
+        std::cout << TimeStamp() << "[" << flow->id << "] ERROR:  failed to receive from the destination:  " << ec.message() << std::endl;
+        if (!flow->replied)
+        {
+            mBalancer->Failed(flow->destination);
+        }
+        CloseFlow(*flow);
+        return;
+    }
+
+    if (received > 0)
+    {
+        if (!flow->replied)
+        {
+            flow->replied = true;
+            mBalancer->Connected(flow->destination);
+        }
+        flow->lastActive = mWheel->Now();
+
+        for (std::size_t i = 0; i < received; ++i)
+        {
+            mBytes[1] += mBatch.Size(i);
+        }
+        mDatagrams[1] += received;
+        mDropped      += received - mBatch.SendTo(mSocket, received, flow->client);
+    }
+
+    StartUpstreamWait(flow);
+}
@@ -0,0 +1,84 @@
+#ifndef INCLUDED_UDP_RELAY_HEADER
+#define INCLUDED_UDP_RELAY_HEADER
+
+
+#include <map>
+#include <memory>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <boost/asio/signal_set.hpp>
+
+#include "proxy.h"
+#include "load_balancer.h"
+#include "timer_wheel.h"
+#include "datagram_batch.h"
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Relays UDP, rather than TCP.  Each client endpoint gets a flow:  its own socket, connected to
+// the destination that the balancer picked for it, so that the replies can be told apart and sent
+// back to the right client.  A client's datagrams keep going to the same destination for as long
+// as its flow lasts - until it has been idle for 'udp_idle_timeout_s'.
+//
+// Datagrams are moved in batches (see DatagramBatch), and the batch that was just received from
+// the clients goes out with one send per flow.  Everything runs on the one io_service, so nothing
+// needs locking.
+//
+class UdpRelay : public std::enable_shared_from_this<UdpRelay>, private boost::noncopyable
+{
+public:
+    UdpRelay(boost::asio::io_service& io_service, ProxyParameters const& params);
+    ~UdpRelay();
+
+    auto Start() -> void;
+
+    // may be called from any thread
+    auto Stop() -> void;
+
+private:
+    struct Flow;
+
+    auto HandleSignal(boost::system::error_code const& error) -> void;
+    auto HandleStop() -> void;
+
+    auto StartClientWait() -> void;
+    auto HandleClientReadable(boost::system::error_code const& error) -> void;
+    auto GetFlow(boost::asio::ip::udp::endpoint const& client) -> Flow*;
+    auto CloseFlow(Flow& flow) -> void;
+    auto ScheduleExpiry(Flow& flow) -> void;
+    auto HandleExpiry(Flow& flow) -> void;
+
+    auto StartUpstreamWait(std::shared_ptr<Flow> const& flow) -> void;
+    auto HandleUpstreamReadable(std::shared_ptr<Flow> const& flow, boost::system::error_code const& error) -> void;
+
+private:
+    ProxyParameters const                   mParams;
+    boost::asio::io_service&                mIoService;
+    boost::asio::signal_set                 mSignals;
+    boost::asio::ip::udp::socket            mSocket;        // the clients send to this
+    bool                                    mStopped;
+
+    std::shared_ptr<LoadBalancer> const     mBalancer;
+    std::vector<boost::asio::ip::udp::endpoint> mDestinations;  // resolved, by balancer index
+
+    std::shared_ptr<TimerWheel> const       mWheel;         // must outlive the flows
+    unsigned long long const                mIdleTicks;
+
+    std::map<boost::asio::ip::udp::endpoint, std::shared_ptr<Flow>> mFlows;
+    unsigned long long                      mNextFlowId;
+
+    // the datagrams being relayed, and the flows that the last batch from the clients was for
+    DatagramBatch                           mBatch;
+    std::vector<Flow*>                      mTouched;
+
+    // totals, reported when we stop
+    unsigned long long                      mDatagrams[2];  // [0] client --> server, [1] server --> client
+    unsigned long long                      mBytes[2];
+    unsigned long long                      mDropped;
+    unsigned long long                      mFlowsOpened;
+};
+
+
+#endif  //INCLUDED_UDP_RELAY_HEADER
@@ -0,0 +1,280 @@
+#include "stdafx.h"
+#include "upstream_pool.h"
+#include "utils.h"
+#include <iostream>
+#include <algorithm>
+
+#include <boost/asio.hpp>
+namespace ba = boost::asio;
+
+
+namespace
+{
+    // how often idle connections are checked for the idle timeout
+    auto const SWEEP_INTERVAL = std::chrono::seconds(1);
+
+    // after a failed connect, wait before trying again - doubling each time, up to the maximum
+    auto const MIN_BACKOFF = std::chrono::milliseconds(100);
+    auto const MAX_BACKOFF = std::chrono::milliseconds(30000);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+UpstreamPool::UpstreamPool(ba::io_service& io_service, ProxyParameters const& params, Destination const& destination, std::shared_ptr<DnsCache> const& dns)
+    : mIoService    (io_service)
+    , mParams       (params)
+    , mDestination  (destination)
+    , mDns          (dns)
+    , mSweepTimer   {io_service}
+    , mRetryTimer   {io_service}
+    , mConnecting   {0}
+    , mResolving    {false}
+    , mRetrying     {false}
+    , mBackoff      {MIN_BACKOFF}
+    , mStopped      {false}
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto UpstreamPool::Start() -> void
+{
+    mIoService.post(std::bind(&UpstreamPool::HandleStart, shared_from_this()));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto UpstreamPool::Stop() -> void
+{
+    mIoService.post(std::bind(&UpstreamPool::HandleStop, shared_from_this()));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto UpstreamPool::HandleStart() -> void
+{
+    if (mStopped) { return; }
+
+    Resolve();
+    StartSweep();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Close every idle connection, and cancel everything that is outstanding - so that the io_service
+// can run out of work
+//
+auto UpstreamPool::HandleStop() -> void
+{
+    mStopped = true;
+
+    boost::system::error_code ignored;
+    mSweepTimer.cancel(ignored);
+    mRetryTimer.cancel(ignored);
+
+    for (auto& connection : mIdle)
+    {
+        connection->idle = false;
+        connection->socket.close(ignored);
+    }
+    mIdle.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto UpstreamPool::Resolve() -> void
+{
+    if (mResolving || mStopped) { return; }
+    mResolving = true;
+
+    mDns->Resolve(
+        mDestination.addr,
+        mDestination.port,
+        mIoService,
+        std::bind(&UpstreamPool::HandleResolve, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto UpstreamPool::HandleResolve(boost::system::error_code const& error, ba::ip::tcp::resolver::iterator iterator) -> void
+{
+    mResolving = false;
+    if (mStopped || mRetrying) { return; }     // a connect has failed in the meantime
+
+    if (error)
+    {
+        std::cout << TimeStamp() << "WARNING:  upstream pool failed to resolve destination [" << mDestination.addr << "]:" << mDestination.port << ":  " << error.message() << std::endl;
+
+        // try again later
+        mRetrying = true;
+        mRetryTimer.expires_from_now(mBackoff);
+        mRetryTimer.async_wait(std::bind(&UpstreamPool::HandleRetry, shared_from_this(), std::placeholders::_1));
+        mBackoff = std::min(mBackoff * 2, MAX_BACKOFF);
+        return;
+    }
+
+    // open as many connections as are missing by now, counting those that are still being
+    // established
+    for (auto n = Shortfall(); n > 0; --n)
+    {
+        auto connection = std::make_shared<Connection>(mIoService);
+        ++mConnecting;
+        ba::async_connect(
+            connection->socket,
+            iterator,
+            std::bind(&UpstreamPool::HandleConnect, shared_from_this(), connection, std::placeholders::_1));
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Look the destination up again for each batch of connections, rather than keep the first answer
+// for good - so that the connections go wherever the destination is now
+//
+auto UpstreamPool::Fill() -> void
+{
+    if (mStopped || mRetrying || Shortfall() == 0) { return; }
+
+    Resolve();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto UpstreamPool::Shortfall() const -> std::size_t
+{
+    auto const have = mIdle.size() + mConnecting;
+    return have < mParams.upstream_pool_size ? mParams.upstream_pool_size - have : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto UpstreamPool::HandleConnect(ConnectionPtr const& connection, boost::system::error_code const& error) -> void
+{
+    --mConnecting;
+
+    boost::system::error_code ignored;
+    if (mStopped)
+    {
+        connection->socket.close(ignored);
+        return;
+    }
+
+    if (error)
+    {
+        // back off, and look the destination up again in case it has moved.  Sessions go back to
+        // connecting for themselves until the pool recovers.
+        if (!mRetrying)
+        {
+            std::cout << TimeStamp() << "WARNING:  upstream pool failed to connect to destination [" << mDestination.addr << "]:" << mDestination.port << " (retrying in " << mBackoff.count() << "ms):  " << error.message() << std::endl;
+
+            mRetrying  = true;
+            mRetryTimer.expires_from_now(mBackoff);
+            mRetryTimer.async_wait(std::bind(&UpstreamPool::HandleRetry, shared_from_this(), std::placeholders::_1));
+            mBackoff = std::min(mBackoff * 2, MAX_BACKOFF);
+        }
+        return;
+    }
+
+    mBackoff              = MIN_BACKOFF;
+    connection->idle      = true;
+    connection->idleSince = Clock::now();
+    mIdle.push_back(connection);
+
+    // an idle connection should never become readable - if it does, the destination has either
+    // closed it or is sending us something that we have no session to pass on to
+    connection->socket.async_read_some(
+        ba::null_buffers(),
+        std::bind(&UpstreamPool::HandleReadable, shared_from_this(), connection, std::placeholders::_1));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto UpstreamPool::HandleRetry(boost::system::error_code const& error) -> void
+{
+    if (error || mStopped) { return; }
+
+    mRetrying = false;
+    Fill();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto UpstreamPool::HandleReadable(ConnectionPtr const& connection, boost::system::error_code const& /*error*/) -> void
+{
+    // the wait is cancelled when the connection is handed out or evicted
+    if (!connection->idle || mStopped) { return; }
+
+    Evict(connection);
+    Fill();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto UpstreamPool::Evict(ConnectionPtr const& connection) -> void
+{
+    connection->idle = false;
+
+    boost::system::error_code ignored;
+    connection->socket.close(ignored);
+    mIdle.remove(connection);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto UpstreamPool::StartSweep() -> void
+{
+    mSweepTimer.expires_from_now(SWEEP_INTERVAL);
+    mSweepTimer.async_wait(std::bind(&UpstreamPool::HandleSweep, shared_from_this(), std::placeholders::_1));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Replace the connections that have been idle for too long.  They are oldest first, so we can stop
+// at the first one that is still young enough.
+//
+auto UpstreamPool::HandleSweep(boost::system::error_code const& error) -> void
+{
+    if (error || mStopped) { return; }
+
+    auto const expired = Clock::now() - std::chrono::seconds(mParams.upstream_idle_timeout_s);
+    while (!mIdle.empty() && mIdle.front()->idleSince < expired)
+    {
+        Evict(mIdle.front());
+    }
+
+    Fill();
+    StartSweep();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// A last check before a connection is handed out, in case the destination has closed it and we
+// haven't heard about it yet:  peek (without blocking) to see if there is anything to read.
+//
+auto UpstreamPool::IsHealthy(Connection& connection) -> bool
+{
+    boost::system::error_code ec;
+    char c;
+
+    connection.socket.non_blocking(true, ec);
+    connection.socket.receive(ba::buffer(&c, 1), ba::socket_base::message_peek, ec);
+    auto const healthy = ec == ba::error::would_block;
+
+    connection.socket.non_blocking(false, ec);
+    return healthy;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto UpstreamPool::Acquire(ba::ip::tcp::socket& socket) -> bool
+{
+    auto found = false;
+
+    while (!found && !mIdle.empty())
+    {
+        auto connection = mIdle.front();
+        mIdle.pop_front();
+        connection->idle = false;
+
+        boost::system::error_code ignored;
+        connection->socket.cancel(ignored);
+
+        if (IsHealthy(*connection))
+        {
+            socket = std::move(connection->socket);
+            found  = true;
+        }
+        else
+        {
+            connection->socket.close(ignored);
+        }
+    }
+
+    // and replace whatever we have used up
+    Fill();
+    return found;
+}
@@ -0,0 +1,98 @@
+#ifndef INCLUDED_UPSTREAM_POOL_HEADER
+#define INCLUDED_UPSTREAM_POOL_HEADER
+
+
+#include <list>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <boost/noncopyable.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include "proxy.h"
+#include "dns_cache.h"
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// A pool of connections to one destination that have been established ahead of time, so that a
+// new session can start relaying straight away instead of waiting for a resolve and a handshake.
+// The pool keeps 'upstream_pool_size' idle connections open, and replaces each one as it is taken.
+//
+// Idle connections are health checked in two ways:  we wait for each one to become readable (if
+// the destination sends anything, or closes the connection, while it is idle then it is no longer
+// any use to us), and each one is checked again as it is handed out.  Connections that have been
+// idle for longer than 'upstream_idle_timeout_s' are closed and replaced, so we don't hand out
+// connections that the destination is just about to time out.
+//
+// Each batch of connections looks the destination up through the DnsCache again (an answer that
+// is cached is just posted back), so the pool follows the destination when its address changes -
+// and the cache sees that the name is still in use, so it keeps it refreshed.
+//
+// Sockets belong to an io_service, so there is one pool per worker thread (and destination).
+// Other than Start() and Stop(), everything must be called on the pool's own io_service.
+//
+class UpstreamPool : public std::enable_shared_from_this<UpstreamPool>, private boost::noncopyable
+{
+public:
+    UpstreamPool(boost::asio::io_service& io_service, ProxyParameters const& params, Destination const& destination, std::shared_ptr<DnsCache> const& dns);
+
+    // may be called from any thread
+    auto Start() -> void;
+    auto Stop()  -> void;
+
+    // move a warm connection into 'socket', which must belong to the pool's io_service.  Returns
+    // false if there are no idle connections.
+    auto Acquire(boost::asio::ip::tcp::socket& socket) -> bool;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Connection
+    {
+        explicit Connection(boost::asio::io_service& io_service) : socket(io_service), idle(false) {}
+
+        boost::asio::ip::tcp::socket    socket;
+        Clock::time_point               idleSince;
+        bool                            idle;       // cleared once the connection leaves the pool
+    };
+    typedef std::shared_ptr<Connection> ConnectionPtr;
+
+    auto HandleStart() -> void;
+    auto HandleStop()  -> void;
+    auto Resolve() -> void;
+    auto Fill() -> void;
+    auto Shortfall() const -> std::size_t;
+    auto Evict(ConnectionPtr const& connection) -> void;
+    auto IsHealthy(Connection& connection) -> bool;
+    auto StartSweep() -> void;
+
+    auto HandleResolve (boost::system::error_code const& error, boost::asio::ip::tcp::resolver::iterator iterator) -> void;
+    auto HandleConnect (ConnectionPtr const& connection, boost::system::error_code const& error) -> void;
+    auto HandleReadable(ConnectionPtr const& connection, boost::system::error_code const& error) -> void;
+    auto HandleSweep   (boost::system::error_code const& error) -> void;
+    auto HandleRetry   (boost::system::error_code const& error) -> void;
+
+private:
+    boost::asio::io_service&                mIoService;
+    ProxyParameters const                   mParams;
+    Destination const                       mDestination;
+    std::shared_ptr<DnsCache> const         mDns;
+    boost::asio::steady_timer               mSweepTimer;
+    boost::asio::steady_timer               mRetryTimer;
+
+    std::list<ConnectionPtr>                mIdle;          // oldest first
+    std::size_t                             mConnecting;
+    bool                                    mResolving;
+    bool                                    mRetrying;      // backing off after a failed connect
+    std::chrono::milliseconds               mBackoff;
+    bool                                    mStopped;
+};
+
+
+// the pools for one worker thread, indexed by destination
+typedef std::vector<std::shared_ptr<UpstreamPool>> UpstreamPools;
+
+
+#endif  //INCLUDED_UPSTREAM_POOL_HEADER
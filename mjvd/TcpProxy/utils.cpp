@@ -0,0 +1,14 @@
+#include "stdafx.h"
+#include "utils.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+namespace pt = boost::posix_time;
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+auto TimeStamp() -> std::string
+{
+    std::string t = pt::to_simple_string(pt::microsec_clock::local_time().time_of_day());
+    t.resize(12, '0');
+    return t.append(1, ' ');
+}
@@ -0,0 +1,15 @@
+#ifndef INCLUDED_UTILS_HEADER
+#define INCLUDED_UTILS_HEADER
+
+
+#include <string>
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// returns the current local time-of-day (to the milli-second) followed by a single space - e.g.
+// "13:45:01.123 ".  Used to prefix every line that we write to the console.
+//
+auto TimeStamp() -> std::string;
+
+
+#endif  //INCLUDED_UTILS_HEADER